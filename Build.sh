@@ -34,7 +34,7 @@ else
 		-DUNIX || exit $?
 	# Need -ldl for dynamic loading, --export-dynamic to let compile-time functions resolve to
 	# Cakelisp symbols
-	$LINK -o $CAKELISP_BOOTSTRAP_BIN *.o -ldl -Wl,--export-dynamic || exit $?
+	$LINK -o $CAKELISP_BOOTSTRAP_BIN *.o -ldl -lpthread -Wl,--export-dynamic || exit $?
 	rm *.o
 	echo "Built $CAKELISP_BOOTSTRAP_BIN successfully. Now building with Cakelisp"
 	$CAKELISP_BOOTSTRAP_BIN Bootstrap.cake || exit $?
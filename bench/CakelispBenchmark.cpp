@@ -0,0 +1,491 @@
+// Generates a synthetic Cakelisp project, then times each phase of processing it and writes the
+// results as JSON, so that regressions can be tracked between releases. See RunBenchmark.sh
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "Evaluator.hpp"
+#include "FileUtilities.hpp"
+#include "Logging.hpp"
+#include "ModuleManager.hpp"
+#include "Tokenizer.hpp"
+#include "Utilities.hpp"
+
+struct BenchmarkSettings
+{
+	int numModules;
+	int numFunctionsPerModule;
+	int numMacroInvocationsPerModule;
+	int importFanOut;
+	const char* projectDir;
+	const char* cakelispSrcDir;
+	const char* outputFilename;
+	bool buildAndLink;
+};
+
+typedef std::chrono::steady_clock::time_point BenchmarkTime;
+
+static double secondsSince(BenchmarkTime start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+//
+// Synthetic project generation
+//
+
+static void getModuleFilename(const BenchmarkSettings& settings, int moduleIndex,
+                              bool includeProjectDir, char* bufferOut, int bufferSize)
+{
+	if (includeProjectDir)
+	{
+		SafeSnprintf(bufferOut, bufferSize, "%s/BenchModule%03d.cake", settings.projectDir,
+		             moduleIndex);
+	}
+	else
+	{
+		SafeSnprintf(bufferOut, bufferSize, "BenchModule%03d.cake", moduleIndex);
+	}
+}
+
+static void appendf(std::string& output, const char* format, ...)
+{
+	char buffer[1024] = {0};
+	va_list args;
+	va_start(args, format);
+	vsnprintf(buffer, sizeof(buffer), format, args);
+	va_end(args);
+	output.append(buffer);
+}
+
+// Files are only rewritten if they changed, so that a second run measures a warm cache
+static bool writeFileIfChanged(const char* filename, const std::string& contents)
+{
+	MappedFile existingFile;
+	if (fileExists(filename) && fileMapReadOnly(filename, &existingFile))
+	{
+		bool isSame = existingFile.size == contents.size() &&
+		              (contents.empty() ||
+		               memcmp(existingFile.contents, contents.data(), contents.size()) == 0);
+		fileUnmap(&existingFile);
+		if (isSame)
+			return true;
+	}
+
+	FILE* file = fileOpen(filename, "wb");
+	if (!file)
+		return false;
+	fwrite(contents.data(), sizeof(char), contents.size(), file);
+	fclose(file);
+	return true;
+}
+
+// Module i imports the F modules after it. Each function calls the previous function in its
+// module and its counterpart in the first imported module, so references cross modules
+static std::string generateModule(const BenchmarkSettings& settings, int moduleIndex)
+{
+	std::string output;
+	appendf(output, ";; Generated by cakelisp_benchmark\n(import \"BenchMacros.cake\"");
+	for (int i = 1; i <= settings.importFanOut && moduleIndex + i < settings.numModules; ++i)
+	{
+		char importName[MAX_PATH_LENGTH] = {0};
+		getModuleFilename(settings, moduleIndex + i, /*includeProjectDir=*/false, importName,
+		                  sizeof(importName));
+		appendf(output, "\n        \"%s\"", importName);
+	}
+	appendf(output, ")\n");
+
+	bool hasImport = settings.importFanOut > 0 && moduleIndex + 1 < settings.numModules;
+	for (int function = 0; function < settings.numFunctionsPerModule; ++function)
+	{
+		appendf(output, "\n(defun bench-%03d-function-%03d (value int &return int)\n",
+		        moduleIndex, function);
+		appendf(output, "  (var result int (* value %d))\n", function + 1);
+		if (function > 0)
+			appendf(output, "  (set result (+ result (bench-%03d-function-%03d value)))\n",
+			        moduleIndex, function - 1);
+		if (hasImport)
+			appendf(output, "  (set result (+ result (bench-%03d-function-%03d value)))\n",
+			        moduleIndex + 1, function);
+		appendf(output, "  (return result))\n");
+	}
+
+	appendf(output, "\n(defun bench-%03d-macros (value int &return int)\n", moduleIndex);
+	appendf(output, "  (var sum int 0)\n");
+	for (int invocation = 0; invocation < settings.numMacroInvocationsPerModule; ++invocation)
+		appendf(output, "  (set sum (+ sum (bench-scale value %d)))\n", invocation);
+	appendf(output, "  (return sum))\n");
+
+	return output;
+}
+
+// makeDirectory() only makes the last directory in the path
+static bool makeDirectoryAndParents(const char* path)
+{
+	char partialPath[MAX_PATH_LENGTH] = {0};
+	PrintfBuffer(partialPath, "%s", path);
+	for (char* currentChar = partialPath + 1; *currentChar; ++currentChar)
+	{
+		if (*currentChar != '/' && *currentChar != '\\')
+			continue;
+
+		char separator = *currentChar;
+		*currentChar = '\0';
+		if (!fileExists(partialPath) && !makeDirectory(partialPath))
+		{
+			Logf("error: could not make directory %s\n", partialPath);
+			return false;
+		}
+		*currentChar = separator;
+	}
+
+	if (!makeDirectory(partialPath))
+	{
+		Logf("error: could not make directory %s\n", partialPath);
+		return false;
+	}
+	return true;
+}
+
+static bool generateProject(const BenchmarkSettings& settings, const char* mainFilename,
+                            std::vector<std::string>& filenamesOut)
+{
+	if (!makeDirectoryAndParents(settings.projectDir))
+		return false;
+
+	char filename[MAX_PATH_LENGTH] = {0};
+	for (int moduleIndex = 0; moduleIndex < settings.numModules; ++moduleIndex)
+	{
+		getModuleFilename(settings, moduleIndex, /*includeProjectDir=*/true, filename,
+		                  sizeof(filename));
+		if (!writeFileIfChanged(filename, generateModule(settings, moduleIndex)))
+			return false;
+		filenamesOut.push_back(filename);
+	}
+
+	{
+		std::string output;
+		appendf(output,
+		        ";; Generated by cakelisp_benchmark\n"
+		        "(defmacro bench-scale (value symbol scale symbol)\n"
+		        "  (tokenize-push output (* (token-splice value) (token-splice scale)))\n"
+		        "  (return true))\n");
+		PrintfBuffer(filename, "%s/BenchMacros.cake", settings.projectDir);
+		if (!writeFileIfChanged(filename, output))
+			return false;
+		filenamesOut.push_back(filename);
+	}
+
+	{
+		std::string output;
+		appendf(output, ";; Generated by cakelisp_benchmark\n");
+		appendf(output, "(set-cakelisp-option cakelisp-src-dir \"%s\")\n",
+		        settings.cakelispSrcDir);
+		appendf(output, "(set-cakelisp-option executable-output \"%s/BenchProgram\")\n",
+		        settings.projectDir);
+		appendf(output, "(c-import \"<stdio.h>\")\n(import");
+		for (int moduleIndex = 0; moduleIndex < settings.numModules; ++moduleIndex)
+		{
+			char importName[MAX_PATH_LENGTH] = {0};
+			getModuleFilename(settings, moduleIndex, /*includeProjectDir=*/false, importName,
+			                  sizeof(importName));
+			appendf(output, "\n  \"%s\"", importName);
+		}
+		appendf(output, ")\n\n(defun main (&return int)\n  (var total int 0)\n");
+		if (settings.numModules && settings.numFunctionsPerModule)
+			appendf(output, "  (set total (+ total (bench-000-function-%03d 1)))\n",
+			        settings.numFunctionsPerModule - 1);
+		for (int moduleIndex = 0; moduleIndex < settings.numModules; ++moduleIndex)
+			appendf(output, "  (set total (+ total (bench-%03d-macros 1)))\n", moduleIndex);
+		appendf(output, "  (fprintf stderr \"%%d\\n\" total)\n  (return 0))\n");
+		if (!writeFileIfChanged(mainFilename, output))
+			return false;
+		filenamesOut.push_back(mainFilename);
+	}
+
+	return true;
+}
+
+//
+// Measurement
+//
+
+struct BenchmarkResults
+{
+	size_t numBytes;
+	size_t numLines;
+	size_t numTokens;
+
+	// Tokenizing every file once, outside of the pipeline. Best of several rounds
+	double tokenizeSeconds;
+
+	double loadTokensSeconds;
+	double evaluateSeconds;
+	double resolveReferencesSeconds;
+	double comptimeBuildSeconds;
+	double writeOutputSeconds;
+	double buildAndLinkSeconds;
+	double totalSeconds;
+};
+
+static bool measureTokenize(const std::vector<std::string>& filenames, BenchmarkResults& results)
+{
+	const int numRounds = 5;
+	for (int round = 0; round < numRounds; ++round)
+	{
+		size_t numBytes = 0;
+		size_t numLines = 0;
+		size_t numTokens = 0;
+		double seconds = 0.0;
+		for (const std::string& filename : filenames)
+		{
+			MappedFile file;
+			if (!fileMapReadOnly(filename.c_str(), &file))
+				return false;
+
+			BenchmarkTime start = std::chrono::steady_clock::now();
+			std::vector<Token> tokens;
+			TokenBalanceCheck balanceCheck;
+			unsigned int lineNumber = 1;
+			const char* error = tokenizeBufferCheckBalance(file.contents, file.contents + file.size,
+			                                               filename.c_str(), &lineNumber, tokens,
+			                                               balanceCheck);
+			seconds += secondsSince(start);
+
+			numBytes += file.size;
+			numLines += lineNumber;
+			numTokens += tokens.size();
+			fileUnmap(&file);
+
+			if (error)
+			{
+				Logf("%s:%d: error: %s\n", filename.c_str(), lineNumber, error);
+				return false;
+			}
+		}
+
+		results.numBytes = numBytes;
+		results.numLines = numLines;
+		results.numTokens = numTokens;
+		if (round == 0 || seconds < results.tokenizeSeconds)
+			results.tokenizeSeconds = seconds;
+	}
+
+	return true;
+}
+
+static bool measurePipeline(const BenchmarkSettings& settings, const char* mainFilename,
+                            BenchmarkResults& results)
+{
+	BenchmarkTime totalStart = std::chrono::steady_clock::now();
+
+	ModuleManager moduleManager = {};
+	moduleManagerInitialize(moduleManager);
+
+	BenchmarkTime start = std::chrono::steady_clock::now();
+	bool succeeded = moduleManagerAddEvaluateFile(moduleManager, mainFilename,
+	                                              /*moduleOut=*/nullptr);
+	// Imports are loaded while their importers are evaluated
+	results.loadTokensSeconds = g_nestedPhaseTimes.loadTokensSeconds;
+	results.evaluateSeconds = secondsSince(start) - results.loadTokensSeconds;
+
+	if (succeeded)
+	{
+		start = std::chrono::steady_clock::now();
+		succeeded = moduleManagerEvaluateResolveReferences(moduleManager);
+		// Compile-time code is built as references are resolved
+		results.comptimeBuildSeconds = g_nestedPhaseTimes.comptimeBuildSeconds;
+		results.resolveReferencesSeconds = secondsSince(start) - results.comptimeBuildSeconds;
+	}
+
+	if (succeeded)
+	{
+		start = std::chrono::steady_clock::now();
+		succeeded = moduleManagerWriteGeneratedOutput(moduleManager);
+		results.writeOutputSeconds = secondsSince(start);
+	}
+
+	if (succeeded && settings.buildAndLink)
+	{
+		start = std::chrono::steady_clock::now();
+		std::vector<std::string> builtOutputs;
+		succeeded = moduleManagerBuildAndLink(moduleManager, builtOutputs);
+		results.buildAndLinkSeconds = secondsSince(start);
+	}
+
+	moduleManagerDestroy(moduleManager);
+
+	results.totalSeconds = secondsSince(totalStart);
+	return succeeded;
+}
+
+static bool writeResults(const BenchmarkSettings& settings, const BenchmarkResults& results)
+{
+	FILE* output = stdout;
+	if (settings.outputFilename)
+	{
+		output = fileOpen(settings.outputFilename, "w");
+		if (!output)
+			return false;
+	}
+
+	fprintf(output,
+	        "{\n"
+	        "  \"parameters\": {\n"
+	        "    \"modules\": %d,\n"
+	        "    \"functionsPerModule\": %d,\n"
+	        "    \"macroInvocationsPerModule\": %d,\n"
+	        "    \"importFanOut\": %d,\n"
+	        "    \"buildAndLink\": %s\n"
+	        "  },\n"
+	        "  \"project\": {\n"
+	        "    \"files\": %d,\n"
+	        "    \"bytes\": %lu,\n"
+	        "    \"lines\": %lu,\n"
+	        "    \"tokens\": %lu\n"
+	        "  },\n"
+	        "  \"seconds\": {\n"
+	        "    \"tokenize\": %.6f,\n"
+	        "    \"loadTokens\": %.6f,\n"
+	        "    \"evaluate\": %.6f,\n"
+	        "    \"resolveReferences\": %.6f,\n"
+	        "    \"comptimeBuild\": %.6f,\n"
+	        "    \"writeOutput\": %.6f,\n"
+	        "    \"buildAndLink\": %.6f,\n"
+	        "    \"total\": %.6f\n"
+	        "  },\n"
+	        "  \"tokenizeMegabytesPerSecond\": %.3f\n"
+	        "}\n",
+	        settings.numModules, settings.numFunctionsPerModule,
+	        settings.numMacroInvocationsPerModule, settings.importFanOut,
+	        settings.buildAndLink ? "true" : "false", settings.numModules + 2,
+	        (unsigned long)results.numBytes, (unsigned long)results.numLines,
+	        (unsigned long)results.numTokens, results.tokenizeSeconds, results.loadTokensSeconds,
+	        results.evaluateSeconds, results.resolveReferencesSeconds,
+	        results.comptimeBuildSeconds, results.writeOutputSeconds, results.buildAndLinkSeconds,
+	        results.totalSeconds,
+	        results.tokenizeSeconds > 0.0 ?
+	            ((double)results.numBytes / (1024.0 * 1024.0)) / results.tokenizeSeconds :
+	            0.0);
+
+	if (output != stdout)
+		fclose(output);
+	return true;
+}
+
+static void printUsage()
+{
+	Log("Usage: cakelisp_benchmark [options]\n"
+	    "  --modules N          Number of generated modules (default 20)\n"
+	    "  --functions M        Functions per module (default 20)\n"
+	    "  --macros K           Macro invocations per module (default 20)\n"
+	    "  --fan-out F          Modules imported by each module (default 3)\n"
+	    "  --project-dir DIR    Where to generate the project (default bench_cache)\n"
+	    "  --cakelisp-src-dir DIR  Cakelisp src/, for building compile-time code (default src)\n"
+	    "  --output FILE        Write JSON results to FILE instead of stdout\n"
+	    "  --build              Also build and link the generated project\n");
+}
+
+int main(int numArguments, char** arguments)
+{
+	BenchmarkSettings settings = {20, 20, 20, 3, "bench_cache", "src", nullptr, false};
+
+	for (int i = 1; i < numArguments; ++i)
+	{
+		const char* argument = arguments[i];
+		const char* value = i + 1 < numArguments ? arguments[i + 1] : nullptr;
+		int* intOut = nullptr;
+		const char** stringOut = nullptr;
+		if (strcmp(argument, "--modules") == 0)
+			intOut = &settings.numModules;
+		else if (strcmp(argument, "--functions") == 0)
+			intOut = &settings.numFunctionsPerModule;
+		else if (strcmp(argument, "--macros") == 0)
+			intOut = &settings.numMacroInvocationsPerModule;
+		else if (strcmp(argument, "--fan-out") == 0)
+			intOut = &settings.importFanOut;
+		else if (strcmp(argument, "--project-dir") == 0)
+			stringOut = &settings.projectDir;
+		else if (strcmp(argument, "--cakelisp-src-dir") == 0)
+			stringOut = &settings.cakelispSrcDir;
+		else if (strcmp(argument, "--output") == 0)
+			stringOut = &settings.outputFilename;
+		else if (strcmp(argument, "--build") == 0)
+		{
+			settings.buildAndLink = true;
+			continue;
+		}
+		else
+		{
+			Logf("error: unrecognized argument %s\n", argument);
+			printUsage();
+			return 1;
+		}
+
+		if (!value)
+		{
+			Logf("error: expected value after %s\n", argument);
+			printUsage();
+			return 1;
+		}
+		if (intOut)
+		{
+			*intOut = atoi(value);
+			if (*intOut < 0 || (intOut == &settings.numModules && *intOut > 999))
+			{
+				Logf("error: %s %s is out of range\n", argument, value);
+				return 1;
+			}
+		}
+		else
+			*stringOut = value;
+		++i;
+	}
+
+	// Compile-time code is built from the generated project's directory, so this must be absolute
+	const char* cakelispSrcDir = makeAbsolutePath_Allocated(nullptr, settings.cakelispSrcDir);
+	if (!cakelispSrcDir)
+	{
+		Logf("error: could not find Cakelisp source directory %s\n", settings.cakelispSrcDir);
+		return 1;
+	}
+	settings.cakelispSrcDir = cakelispSrcDir;
+
+	char mainFilename[MAX_PATH_LENGTH] = {0};
+	PrintfBuffer(mainFilename, "%s/BenchMain.cake", settings.projectDir);
+	std::vector<std::string> filenames;
+	if (!generateProject(settings, mainFilename, filenames))
+	{
+		Logf("error: failed to generate project in %s\n", settings.projectDir);
+		return 1;
+	}
+
+	// Keep the project's caches separate, so deleting the project directory makes a cold run
+	char workingDir[MAX_PATH_LENGTH] = {0};
+	PrintfBuffer(workingDir, "%s/cakelisp_cache", settings.projectDir);
+	cakelispWorkingDir = workingDir;
+
+	BenchmarkResults results = {};
+	if (!measureTokenize(filenames, results))
+		return 1;
+
+	if (!measurePipeline(settings, mainFilename, results))
+	{
+		Log("error: benchmark project failed to build\n");
+		return 1;
+	}
+
+	if (!writeResults(settings, results))
+	{
+		Logf("error: could not write results to %s\n", settings.outputFilename);
+		return 1;
+	}
+
+	free((void*)cakelispSrcDir);
+	return 0;
+}
@@ -0,0 +1,26 @@
+#!/bin/sh
+
+# Time Cakelisp on a generated project, once with empty caches and once with warm caches
+# Usage: bench/RunBenchmark.sh [cakelisp_benchmark options, e.g. --modules 50 --fan-out 5 --build]
+# JSON results are written to bench_cache/Cold.json and bench_cache/Warm.json
+
+PROJECT_DIR=bench_cache/Project
+
+if ! test -f bin/cakelisp; then
+	echo "bin/cakelisp does not exist. Run Build.sh first"
+	exit 1
+fi
+
+# Only rebuilds if the Cakelisp sources changed
+./bin/cakelisp bench/Benchmark.cake || exit $?
+
+rm -rf $PROJECT_DIR
+mkdir -p $PROJECT_DIR
+
+bin/cakelisp_benchmark --project-dir $PROJECT_DIR --output bench_cache/Cold.json "$@" || exit $?
+bin/cakelisp_benchmark --project-dir $PROJECT_DIR --output bench_cache/Warm.json "$@" || exit $?
+
+echo "Cold:"
+cat bench_cache/Cold.json
+echo "Warm:"
+cat bench_cache/Warm.json
@@ -0,0 +1,19 @@
+#!/bin/sh
+
+# Compare process launch latency of posix_spawn and fork as the parent's heap grows
+# Usage: bench/RunSpawnBenchmark.sh [spawns] [heap megabytes...]
+
+SPAWNS=${1:-200}
+if test $# -gt 0; then
+	shift
+fi
+CC=g++
+SOURCES="bench/SpawnBenchmark.cpp src/RunProcess.cpp src/Utilities.cpp src/Logging.cpp
+	src/FileUtilities.cpp"
+
+mkdir -p bin
+$CC -O2 -DUNIX -Isrc -o bin/SpawnBenchmark_Fork $SOURCES -DCAKELISP_RUN_PROCESS_FORK || exit $?
+$CC -O2 -DUNIX -Isrc -o bin/SpawnBenchmark $SOURCES || exit $?
+
+bin/SpawnBenchmark_Fork $SPAWNS "$@" || exit $?
+bin/SpawnBenchmark $SPAWNS "$@" || exit $?
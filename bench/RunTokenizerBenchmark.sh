@@ -0,0 +1,17 @@
+#!/bin/sh
+
+# Compare tokenizer throughput with and without the vectorized character scanners
+# Usage: bench/RunTokenizerBenchmark.sh [iterations]
+
+ITERATIONS=${1:-100}
+CC=g++
+SOURCES="bench/TokenizerBenchmark.cpp src/Tokenizer.cpp src/Utilities.cpp src/Logging.cpp
+	src/FileUtilities.cpp"
+
+mkdir -p bin
+$CC -O2 -DUNIX -Isrc -o bin/TokenizerBenchmark_Scalar $SOURCES -DCAKELISP_TOKENIZER_NO_SIMD \
+	|| exit $?
+$CC -O2 -DUNIX -Isrc -o bin/TokenizerBenchmark $SOURCES || exit $?
+
+bin/TokenizerBenchmark_Scalar $ITERATIONS test/*.cake runtime/*.cake || exit $?
+bin/TokenizerBenchmark $ITERATIONS test/*.cake runtime/*.cake || exit $?
@@ -0,0 +1,93 @@
+// Measures how long it takes to start and wait on a trivial process as the parent's heap grows
+// Build once normally and once with -DCAKELISP_RUN_PROCESS_FORK to compare posix_spawn and fork.
+// See RunSpawnBenchmark.sh
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <vector>
+
+#include "RunProcess.hpp"
+#include "Utilities.hpp"
+
+int main(int numArguments, char** arguments)
+{
+	if (numArguments < 2)
+	{
+		Log("Usage: SpawnBenchmark <spawns> [heap megabytes...]\n");
+		return 1;
+	}
+
+	int numSpawns = atoi(arguments[1]);
+	if (numSpawns <= 0)
+	{
+		Logf("error: expected positive number of spawns, got '%s'\n", arguments[1]);
+		return 1;
+	}
+
+	std::vector<int> heapMegabytes;
+	for (int i = 2; i < numArguments; ++i)
+		heapMegabytes.push_back(atoi(arguments[i]));
+	if (heapMegabytes.empty())
+	{
+		heapMegabytes.push_back(0);
+		heapMegabytes.push_back(256);
+		heapMegabytes.push_back(1024);
+	}
+
+	const char* processArguments[] = {"true", nullptr};
+	RunProcessArguments runArguments = {};
+	runArguments.fileToExecute = processArguments[0];
+	runArguments.arguments = processArguments;
+
+	// Grow the heap to each size in turn. Every page is written, so it is really mapped like the
+	// token and output heaps of a long build would be
+	std::vector<char*> heapBlocks;
+	size_t heapSize = 0;
+	for (int megabytes : heapMegabytes)
+	{
+		size_t targetSize = (size_t)megabytes * 1024 * 1024;
+		if (targetSize > heapSize)
+		{
+			char* block = (char*)malloc(targetSize - heapSize);
+			if (!block)
+			{
+				Logf("error: failed to allocate %d MB\n", megabytes);
+				return 1;
+			}
+			memset(block, 1, targetSize - heapSize);
+			heapBlocks.push_back(block);
+			heapSize = targetSize;
+		}
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (int spawn = 0; spawn < numSpawns; ++spawn)
+		{
+			int status = -1;
+			if (runProcess(runArguments, &status) != 0)
+				return 1;
+			waitForAllProcessesClosed(nullptr);
+			if (status != 0)
+			{
+				Logf("error: process exited with status %d\n", status);
+				return 1;
+			}
+		}
+		std::chrono::steady_clock::time_point stop = std::chrono::steady_clock::now();
+
+		double seconds = std::chrono::duration<double>(stop - start).count();
+		Logf("%s: %5d MB heap, %d spawns, %.1f microseconds per spawn\n",
+#ifdef CAKELISP_RUN_PROCESS_FORK
+		     "fork",
+#else
+		     "posix_spawn",
+#endif
+		     megabytes, numSpawns, (seconds * 1000000.0) / numSpawns);
+	}
+
+	for (char* block : heapBlocks)
+		free(block);
+
+	return 0;
+}
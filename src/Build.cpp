@@ -1,8 +1,10 @@
 #include "Build.hpp"
 
+#include <ctype.h>
 #include <string.h>
 
 #include <cstring>
+#include <mutex>
 #include <vector>
 
 #include "FileUtilities.hpp"
@@ -407,11 +409,267 @@ void makeTargetPlatformVersionArgument(char* resolvedArgumentOut, int resolvedAr
 #endif
 }
 
+// Header scans are kept out of Cache.cake so that older versions of Cakelisp sharing the cache
+// directory (e.g. the bootstrap executable) don't fail on entries they don't recognize
+static void buildWriteHeaderScansFile(const char* buildOutputDir, HeaderScanTable& headerScans)
+{
+	if (headerScans.empty())
+		return;
+
+	char outputFilename[MAX_PATH_LENGTH] = {0};
+	if (!outputFilenameFromSourceFilename(buildOutputDir, "HeaderScans", "cake", outputFilename,
+	                                      sizeof(outputFilename)))
+	{
+		Log("error: failed to create header scans file name\n");
+		return;
+	}
+
+	std::vector<Token> outputTokens;
+	const Token openParen = {TokenType_OpenParen, EmptyString, "Build.cpp", 1, 0, 0};
+	const Token closeParen = {TokenType_CloseParen, EmptyString, "Build.cpp", 1, 0, 0};
+	// (header-scan "resolved/path" modification-time size crc "include" "include"...)
+	const Token headerScanInvoke = {TokenType_Symbol, "header-scan", "Build.cpp", 1, 0, 0};
+	for (const HeaderScanTablePair& scanPair : headerScans)
+	{
+		outputTokens.push_back(openParen);
+		outputTokens.push_back(headerScanInvoke);
+
+		Token headerName = {TokenType_String, scanPair.first, "Build.cpp", 1, 0, 0};
+		outputTokens.push_back(headerName);
+
+		const HeaderScanCacheEntry& scan = scanPair.second;
+		Token modificationTimeToken = {
+		    TokenType_Symbol, std::to_string(scan.modificationTime), "Build.cpp", 1, 0, 0};
+		outputTokens.push_back(modificationTimeToken);
+		Token sizeToken = {TokenType_Symbol, std::to_string(scan.size), "Build.cpp", 1, 0, 0};
+		outputTokens.push_back(sizeToken);
+		Token crcToken = {TokenType_Symbol, std::to_string(scan.crc), "Build.cpp", 1, 0, 0};
+		outputTokens.push_back(crcToken);
+
+		for (const std::string& include : scan.includes)
+		{
+			Token includeToken = {TokenType_String, include, "Build.cpp", 1, 0, 0};
+			outputTokens.push_back(includeToken);
+		}
+
+		outputTokens.push_back(closeParen);
+	}
+
+	FILE* file = fileOpen(outputFilename, "wb");
+	if (!file)
+	{
+		Logf("error: Could not write header scans file %s", outputFilename);
+		return;
+	}
+
+	prettyPrintTokensToFile(file, outputTokens);
+
+	fclose(file);
+}
+
+// Returns false if there were errors; the file not existing is not an error
+static bool buildReadHeaderScansFile(const char* buildOutputDir, HeaderScanTable& headerScans)
+{
+	char inputFilename[MAX_PATH_LENGTH] = {0};
+	if (!outputFilenameFromSourceFilename(buildOutputDir, "HeaderScans", "cake", inputFilename,
+	                                      sizeof(inputFilename)))
+	{
+		Log("error: failed to create header scans file name\n");
+		return false;
+	}
+
+	if (!fileExists(inputFilename))
+		return true;
+
+	const std::vector<Token>* tokens = nullptr;
+	if (!moduleLoadTokenizeValidate(inputFilename, &tokens))
+		return false;
+
+	for (int i = 0; i < (int)(*tokens).size(); ++i)
+	{
+		if ((*tokens)[i].type != TokenType_OpenParen)
+			continue;
+
+		int endInvocationIndex = FindCloseParenTokenIndex((*tokens), i);
+		const Token& invocationToken = (*tokens)[i + 1];
+		if (invocationToken.contents.compare("header-scan") != 0)
+		{
+			Logf("error: unrecognized invocation in %s: %s\n", inputFilename,
+			     invocationToken.contents.c_str());
+			delete tokens;
+			return false;
+		}
+
+		int pathIndex =
+		    getExpectedArgument("expected header path", (*tokens), i, 1, endInvocationIndex);
+		int modificationTimeIndex =
+		    getExpectedArgument("expected modification time", (*tokens), i, 2, endInvocationIndex);
+		int sizeIndex = getExpectedArgument("expected size", (*tokens), i, 3, endInvocationIndex);
+		int crcIndex = getExpectedArgument("expected crc", (*tokens), i, 4, endInvocationIndex);
+		if (pathIndex == -1 || modificationTimeIndex == -1 || sizeIndex == -1 || crcIndex == -1)
+		{
+			delete tokens;
+			return false;
+		}
+
+		HeaderScanCacheEntry scan;
+		scan.modificationTime =
+		    static_cast<FileModifyTime>(std::stoll((*tokens)[modificationTimeIndex].contents));
+		scan.size = static_cast<uint64_t>(std::stoull((*tokens)[sizeIndex].contents));
+		scan.crc = static_cast<uint32_t>(std::stoul((*tokens)[crcIndex].contents));
+		for (int includeIndex = crcIndex + 1; includeIndex < endInvocationIndex; ++includeIndex)
+			scan.includes.push_back((*tokens)[includeIndex].contents);
+
+		headerScans[(*tokens)[pathIndex].contents] = std::move(scan);
+
+		i = endInvocationIndex;
+	}
+
+	delete tokens;
+	return true;
+}
+
+// Like header scans, kept out of Cache.cake
+static void buildWriteDependenciesFile(const char* buildOutputDir,
+                                       ArtifactDependenciesTable& artifactDependencies)
+{
+	if (artifactDependencies.empty())
+		return;
+
+	char outputFilename[MAX_PATH_LENGTH] = {0};
+	if (!outputFilenameFromSourceFilename(buildOutputDir, "CompilerDependencies", "cake",
+	                                      outputFilename, sizeof(outputFilename)))
+	{
+		Log("error: failed to create dependencies file name\n");
+		return;
+	}
+
+	std::vector<Token> outputTokens;
+	const Token openParen = {TokenType_OpenParen, EmptyString, "Build.cpp", 1, 0, 0};
+	const Token closeParen = {TokenType_CloseParen, EmptyString, "Build.cpp", 1, 0, 0};
+	// (artifact-dependencies "artifact" "dependency" modification-time crc...)
+	const Token dependenciesInvoke = {
+	    TokenType_Symbol, "artifact-dependencies", "Build.cpp", 1, 0, 0};
+	for (const ArtifactDependenciesTablePair& dependenciesPair : artifactDependencies)
+	{
+		outputTokens.push_back(openParen);
+		outputTokens.push_back(dependenciesInvoke);
+
+		Token artifactName = {TokenType_String, dependenciesPair.first, "Build.cpp", 1, 0, 0};
+		outputTokens.push_back(artifactName);
+
+		for (const ArtifactDependency& dependency : dependenciesPair.second)
+		{
+			Token dependencyToken = {TokenType_String, dependency.filename, "Build.cpp", 1, 0, 0};
+			outputTokens.push_back(dependencyToken);
+			Token modificationTimeToken = {TokenType_Symbol,
+			                               std::to_string(dependency.modificationTime),
+			                               "Build.cpp",
+			                               1,
+			                               0,
+			                               0};
+			outputTokens.push_back(modificationTimeToken);
+			Token crcToken = {
+			    TokenType_Symbol, std::to_string(dependency.crc), "Build.cpp", 1, 0, 0};
+			outputTokens.push_back(crcToken);
+		}
+
+		outputTokens.push_back(closeParen);
+	}
+
+	FILE* file = fileOpen(outputFilename, "wb");
+	if (!file)
+	{
+		Logf("error: Could not write dependencies file %s", outputFilename);
+		return;
+	}
+
+	prettyPrintTokensToFile(file, outputTokens);
+
+	fclose(file);
+}
+
+// Returns false if there were errors; the file not existing is not an error
+static bool buildReadDependenciesFile(const char* buildOutputDir,
+                                      ArtifactDependenciesTable& artifactDependencies)
+{
+	char inputFilename[MAX_PATH_LENGTH] = {0};
+	if (!outputFilenameFromSourceFilename(buildOutputDir, "CompilerDependencies", "cake",
+	                                      inputFilename, sizeof(inputFilename)))
+	{
+		Log("error: failed to create dependencies file name\n");
+		return false;
+	}
+
+	if (!fileExists(inputFilename))
+		return true;
+
+	const std::vector<Token>* tokens = nullptr;
+	if (!moduleLoadTokenizeValidate(inputFilename, &tokens))
+		return false;
+
+	for (int i = 0; i < (int)(*tokens).size(); ++i)
+	{
+		if ((*tokens)[i].type != TokenType_OpenParen)
+			continue;
+
+		int endInvocationIndex = FindCloseParenTokenIndex((*tokens), i);
+		const Token& invocationToken = (*tokens)[i + 1];
+		if (invocationToken.contents.compare("artifact-dependencies") != 0)
+		{
+			Logf("error: unrecognized invocation in %s: %s\n", inputFilename,
+			     invocationToken.contents.c_str());
+			delete tokens;
+			return false;
+		}
+
+		int artifactIndex =
+		    getExpectedArgument("expected artifact name", (*tokens), i, 1, endInvocationIndex);
+		if (artifactIndex == -1)
+		{
+			delete tokens;
+			return false;
+		}
+
+		if ((endInvocationIndex - artifactIndex - 1) % 3 != 0)
+		{
+			ErrorAtToken(invocationToken,
+			             "expected modification time and crc after each dependency");
+			delete tokens;
+			return false;
+		}
+
+		std::vector<ArtifactDependency>& dependencies =
+		    artifactDependencies[(*tokens)[artifactIndex].contents];
+		dependencies.clear();
+		for (int dependencyIndex = artifactIndex + 1; dependencyIndex < endInvocationIndex;
+		     dependencyIndex += 3)
+		{
+			ArtifactDependency dependency;
+			dependency.filename = (*tokens)[dependencyIndex].contents;
+			dependency.modificationTime =
+			    static_cast<FileModifyTime>(std::stoll((*tokens)[dependencyIndex + 1].contents));
+			dependency.crc =
+			    static_cast<uint32_t>(std::stoul((*tokens)[dependencyIndex + 2].contents));
+			dependencies.push_back(std::move(dependency));
+		}
+
+		i = endInvocationIndex;
+	}
+
+	delete tokens;
+	return true;
+}
+
 static void buildWriteCacheFile(const char* buildOutputDir, ArtifactCrcTable& cachedCommandCrcs,
                                 ArtifactCrcTable& newCommandCrcs,
                                 HashedSourceArtifactCrcTable& sourceArtifactFileCrcs,
-                                ArtifactCrcTable& headerCrcCache)
+                                ArtifactCrcTable& headerCrcCache, HeaderScanTable& headerScans,
+                                ArtifactDependenciesTable& artifactDependencies)
 {
+	buildWriteHeaderScansFile(buildOutputDir, headerScans);
+	buildWriteDependenciesFile(buildOutputDir, artifactDependencies);
+
 	char outputFilename[MAX_PATH_LENGTH] = {0};
 	if (!outputFilenameFromSourceFilename(buildOutputDir, "Cache", "cake", outputFilename,
 	                                      sizeof(outputFilename)))
@@ -431,8 +689,6 @@ static void buildWriteCacheFile(const char* buildOutputDir, ArtifactCrcTable& ca
 	std::vector<Token> outputTokens;
 	const Token openParen = {TokenType_OpenParen, EmptyString, "Build.cpp", 1, 0, 0};
 	const Token closeParen = {TokenType_CloseParen, EmptyString, "Build.cpp", 1, 0, 0};
-	const Token commandCrcInvoke = {TokenType_Symbol, "command-crc", "Build.cpp", 1, 0, 0};
-	const Token headerCrcInvoke = {TokenType_Symbol, "command-crc", "Build.cpp", 1, 0, 0};
 	const Token sourceArtifactInvoke = {TokenType_Symbol, "source-artifact-crc", "Build.cpp", 1, 0, 0};
 
 	struct
@@ -496,8 +752,13 @@ static void buildWriteCacheFile(const char* buildOutputDir, ArtifactCrcTable& ca
 // Returns false if there were errors; the file not existing is not an error
 bool buildReadCacheFile(const char* buildOutputDir, ArtifactCrcTable& cachedCommandCrcs,
                         HashedSourceArtifactCrcTable& sourceArtifactFileCrcs,
-                        ArtifactCrcTable& headerCrcCache)
+                        ArtifactCrcTable& headerCrcCache, HeaderScanTable& headerScans,
+                        ArtifactDependenciesTable& artifactDependencies)
 {
+	if (!buildReadHeaderScansFile(buildOutputDir, headerScans) ||
+	    !buildReadDependenciesFile(buildOutputDir, artifactDependencies))
+		return false;
+
 	char inputFilename[MAX_PATH_LENGTH] = {0};
 	if (!outputFilenameFromSourceFilename(buildOutputDir, "Cache", "cake", inputFilename,
 	                                      sizeof(inputFilename)))
@@ -573,14 +834,18 @@ bool buildReadCacheFile(const char* buildOutputDir, ArtifactCrcTable& cachedComm
 void buildReadMergeWriteCacheFile(const char* buildOutputDir, ArtifactCrcTable& cachedCommandCrcs,
                                   ArtifactCrcTable& newCommandCrcs,
                                   HashedSourceArtifactCrcTable& sourceArtifactFileCrcs,
-                                  ArtifactCrcTable& changedHeaderCrcCache)
+                                  ArtifactCrcTable& changedHeaderCrcCache,
+                                  HeaderScanTable& changedHeaderScans,
+                                  ArtifactDependenciesTable& changedArtifactDependencies)
 {
 	ArtifactCrcTable mergedCachedCommandCrcs;
 	HashedSourceArtifactCrcTable mergedSourceArtifactFileCrcs;
 	ArtifactCrcTable mergedLoadedHeaderCrcCache;
+	HeaderScanTable mergedHeaderScans;
+	ArtifactDependenciesTable mergedArtifactDependencies;
 
 	buildReadCacheFile(buildOutputDir, mergedCachedCommandCrcs, mergedSourceArtifactFileCrcs,
-	                   mergedLoadedHeaderCrcCache);
+	                   mergedLoadedHeaderCrcCache, mergedHeaderScans, mergedArtifactDependencies);
 
 	// Merge, using our version as latest
 	for (ArtifactCrcTablePair& crcPair : newCommandCrcs)
@@ -591,9 +856,189 @@ void buildReadMergeWriteCacheFile(const char* buildOutputDir, ArtifactCrcTable&
 	}
 	for (ArtifactCrcTablePair& crcPair : changedHeaderCrcCache)
 		mergedLoadedHeaderCrcCache[crcPair.first] = crcPair.second;
+	for (const HeaderScanTablePair& scanPair : changedHeaderScans)
+		mergedHeaderScans[scanPair.first] = scanPair.second;
+	for (const ArtifactDependenciesTablePair& dependenciesPair : changedArtifactDependencies)
+		mergedArtifactDependencies[dependenciesPair.first] = dependenciesPair.second;
 
 	buildWriteCacheFile(buildOutputDir, mergedCachedCommandCrcs, newCommandCrcs,
-	                    mergedSourceArtifactFileCrcs, mergedLoadedHeaderCrcCache);
+	                    mergedSourceArtifactFileCrcs, mergedLoadedHeaderCrcCache,
+	                    mergedHeaderScans, mergedArtifactDependencies);
+}
+
+void buildReadMergeWriteComptimeBatchesFile(const char* buildOutputDir,
+                                            ComptimeBatchTable& changedComptimeBatches)
+{
+	char outputFilename[MAX_PATH_LENGTH] = {0};
+	if (!outputFilenameFromSourceFilename(buildOutputDir, "ComptimeBatches", "cake",
+	                                      outputFilename, sizeof(outputFilename)))
+	{
+		Log("error: failed to create compile-time batches file name\n");
+		return;
+	}
+
+	// Merge, using our version as latest
+	ComptimeBatchTable mergedComptimeBatches;
+	buildReadComptimeBatchesFile(buildOutputDir, mergedComptimeBatches);
+	for (const ComptimeBatchTablePair& batchPair : changedComptimeBatches)
+	{
+		if (batchPair.second.empty())
+			mergedComptimeBatches.erase(batchPair.first);
+		else
+			mergedComptimeBatches[batchPair.first] = batchPair.second;
+	}
+
+	if (mergedComptimeBatches.empty())
+	{
+		if (fileExists(outputFilename))
+			remove(outputFilename);
+		return;
+	}
+
+	std::vector<Token> outputTokens;
+	const Token openParen = {TokenType_OpenParen, EmptyString, "Build.cpp", 1, 0, 0};
+	const Token closeParen = {TokenType_CloseParen, EmptyString, "Build.cpp", 1, 0, 0};
+	// (comptime-batch "library" "batch artifacts name")
+	const Token batchInvoke = {TokenType_Symbol, "comptime-batch", "Build.cpp", 1, 0, 0};
+	for (const ComptimeBatchTablePair& batchPair : mergedComptimeBatches)
+	{
+		outputTokens.push_back(openParen);
+		outputTokens.push_back(batchInvoke);
+
+		Token libraryName = {TokenType_String, batchPair.first, "Build.cpp", 1, 0, 0};
+		outputTokens.push_back(libraryName);
+
+		Token batchName = {TokenType_String, batchPair.second, "Build.cpp", 1, 0, 0};
+		outputTokens.push_back(batchName);
+
+		outputTokens.push_back(closeParen);
+	}
+
+	FILE* file = fileOpen(outputFilename, "wb");
+	if (!file)
+	{
+		Logf("error: Could not write compile-time batches file %s", outputFilename);
+		return;
+	}
+
+	prettyPrintTokensToFile(file, outputTokens);
+
+	fclose(file);
+}
+
+bool buildReadComptimeBatchesFile(const char* buildOutputDir, ComptimeBatchTable& comptimeBatches)
+{
+	char inputFilename[MAX_PATH_LENGTH] = {0};
+	if (!outputFilenameFromSourceFilename(buildOutputDir, "ComptimeBatches", "cake",
+	                                      inputFilename, sizeof(inputFilename)))
+	{
+		Log("error: failed to create compile-time batches file name\n");
+		return false;
+	}
+
+	if (!fileExists(inputFilename))
+		return true;
+
+	const std::vector<Token>* tokens = nullptr;
+	if (!moduleLoadTokenizeValidate(inputFilename, &tokens))
+		return false;
+
+	for (int i = 0; i < (int)(*tokens).size(); ++i)
+	{
+		if ((*tokens)[i].type != TokenType_OpenParen)
+			continue;
+
+		int endInvocationIndex = FindCloseParenTokenIndex((*tokens), i);
+		const Token& invocationToken = (*tokens)[i + 1];
+		if (invocationToken.contents.compare("comptime-batch") != 0)
+		{
+			Logf("error: unrecognized invocation in %s: %s\n", inputFilename,
+			     invocationToken.contents.c_str());
+			delete tokens;
+			return false;
+		}
+
+		int libraryIndex =
+		    getExpectedArgument("expected library name", (*tokens), i, 1, endInvocationIndex);
+		int batchIndex =
+		    getExpectedArgument("expected batch name", (*tokens), i, 2, endInvocationIndex);
+		if (libraryIndex == -1 || batchIndex == -1)
+		{
+			delete tokens;
+			return false;
+		}
+
+		comptimeBatches[(*tokens)[libraryIndex].contents] = (*tokens)[batchIndex].contents;
+
+		i = endInvocationIndex;
+	}
+
+	delete tokens;
+	return true;
+}
+
+// Read the header for its CRC and the includes it references. Includes are recorded exactly as
+// written; they are resolved by the caller, because resolution depends on the search directories
+static bool ScanHeaderFile(const char* resolvedPath, HeaderScanCacheEntry& scanOut)
+{
+	FILE* file = fileOpen(resolvedPath, "rb");
+	if (!file)
+		return false;
+
+	scanOut.crc = 0;
+	scanOut.includes.clear();
+
+	char lineBuffer[2048] = {0};
+	while (fgets(lineBuffer, sizeof(lineBuffer), file))
+	{
+		unsigned int lineLength = 0;
+
+		// I think '#   include' is valid
+		if (lineBuffer[0] != '#' || !strstr(lineBuffer, "include"))
+		{
+			// No include on this line; get the length for the CRC
+			lineLength = strlen(lineBuffer);
+		}
+		else
+		{
+			char foundInclude[MAX_PATH_LENGTH] = {0};
+			char* foundIncludeWrite = foundInclude;
+			bool foundOpening = false;
+			for (char* c = &lineBuffer[0]; *c != '\0'; ++c)
+			{
+				++lineLength;
+				if (foundOpening)
+				{
+					if (*c == '\"' || *c == '>')
+						scanOut.includes.push_back(foundInclude);
+
+					*foundIncludeWrite = *c;
+					++foundIncludeWrite;
+				}
+				else if (*c == '\"' || *c == '<')
+					foundOpening = true;
+			}
+		}
+
+		crc32(lineBuffer, lineLength, &scanOut.crc);
+	}
+
+	fclose(file);
+	return true;
+}
+
+// cppFileNeedsBuild() may be called from several threads at once. This guards the header, command,
+// and source CRC caches they share. Files are never read while it is held.
+// HeaderModificationTimeTables are not shared between threads, because their entries are incomplete
+// until the header's includes have all been checked
+static std::mutex s_buildCacheMutex;
+
+BuildCounts g_buildCounts = {};
+
+static bool IsHeaderMarkedChanged(ArtifactCrcTable& changedHeaderCrcCache, const char* filename)
+{
+	std::lock_guard<std::mutex> lock(s_buildCacheMutex);
+	return changedHeaderCrcCache.find(filename) != changedHeaderCrcCache.end();
 }
 
 // It is essential to scan the #include files to determine if any of the headers have been modified,
@@ -608,11 +1053,16 @@ void buildReadMergeWriteCacheFile(const char* buildOutputDir, ArtifactCrcTable&
 // objects is faster. We must find the absolute time because different build objects may be more
 // recently modified than others, so they shouldn't get built. If we wanted to early out, we cannot
 // share the cache because of this
+//
+// Reading the headers is the expensive part, so what each header contained is kept in headerScans
+// between builds. Headers are only read again if their modification time or size changed
 static bool AreIncludedHeadersModified_Recursive(const std::vector<std::string>& searchDirectories,
                                                  const char* filename, const char* includedInFile,
                                                  HeaderModificationTimeTable& isModifiedCache,
                                                  ArtifactCrcTable& loadedHeaderCrcCache,
                                                  ArtifactCrcTable& changedHeaderCrcCache,
+                                                 HeaderScanTable& headerScans,
+                                                 HeaderScanTable& changedHeaderScans,
                                                  FileModifyTime* mostRecentModifiedTimeOut)
 {
 	bool headerCrcDiffersFromExpected = false;
@@ -626,7 +1076,7 @@ static bool AreIncludedHeadersModified_Recursive(const std::vector<std::string>&
 				Logf("    > cache hit %s\n", filename);
 			if (mostRecentModifiedTimeOut)
 				*mostRecentModifiedTimeOut = findIt->second;
-			bool isCachedCrcDifferent = (changedHeaderCrcCache.find(filename) != changedHeaderCrcCache.end());
+			bool isCachedCrcDifferent = IsHeaderMarkedChanged(changedHeaderCrcCache, filename);
 			if (logging.includeScanning && isCachedCrcDifferent)
 				Logf("   >>> %s already marked as changed\n", filename);
 			return isCachedCrcDifferent;
@@ -661,7 +1111,7 @@ static bool AreIncludedHeadersModified_Recursive(const std::vector<std::string>&
 				Logf("    > resolved path cache hit %s\n", filename);
 			if (mostRecentModifiedTimeOut)
 				*mostRecentModifiedTimeOut = findIt->second;
-			bool isCachedCrcDifferent = (changedHeaderCrcCache.find(filename) != changedHeaderCrcCache.end());
+			bool isCachedCrcDifferent = IsHeaderMarkedChanged(changedHeaderCrcCache, filename);
 			if (logging.includeScanning && isCachedCrcDifferent)
 				Logf("   >>> %s already marked as changed\n", filename);
 			return isCachedCrcDifferent;
@@ -671,112 +1121,317 @@ static bool AreIncludedHeadersModified_Recursive(const std::vector<std::string>&
 	if (logging.includeScanning)
 		Logf("Checking %s for headers\n", resolvedPathBuffer);
 
-	const FileModifyTime thisModificationTime = fileGetLastModificationTime(resolvedPathBuffer);
+	FileModifyTime thisModificationTime = 0;
+	uint64_t thisSize = 0;
+	fileGetModificationTimeAndSize(resolvedPathBuffer, &thisModificationTime, &thisSize);
 
 	// To prevent loops, add ourselves to the cache now. We'll revise our answer higher if necessary
 	isModifiedCache[filename] = thisModificationTime;
 
 	FileModifyTime mostRecentModTime = thisModificationTime;
+
+	// Copied out, because other threads may replace the entry
 	uint32_t crc = 0;
+	std::vector<std::string> includes;
+	bool isScanCached = false;
+	{
+		std::lock_guard<std::mutex> lock(s_buildCacheMutex);
+		HeaderScanTable::iterator scanIt = headerScans.find(resolvedPathBuffer);
+		if (scanIt != headerScans.end() &&
+		    scanIt->second.modificationTime == thisModificationTime &&
+		    scanIt->second.size == thisSize)
+		{
+			crc = scanIt->second.crc;
+			includes = scanIt->second.includes;
+			isScanCached = true;
+		}
+	}
 
-	FILE* file = fileOpen(resolvedPathBuffer, "rb");
-	if (!file)
+	if (isScanCached)
 	{
-		Logf("warning: failed to open file %s even though it should exist\n", resolvedPathBuffer);
-		if (mostRecentModifiedTimeOut)
-			*mostRecentModifiedTimeOut = 0;
-		return false;
+		if (logging.includeScanning)
+			Logf("    > scan cache hit %s\n", resolvedPathBuffer);
 	}
-	char lineBuffer[2048] = {0};
-	while (fgets(lineBuffer, sizeof(lineBuffer), file))
+	else
 	{
-		unsigned int lineLength = 0;
+		// Sample the time before reading. If the header was modified in the same tick, it could be
+		// modified again without changing its time, so the scan can't be trusted next build
+		FileModifyTime scanTime = fileGetCurrentTime();
+
+		HeaderScanCacheEntry scan;
+		scan.modificationTime = thisModificationTime;
+		scan.size = thisSize;
+		if (!ScanHeaderFile(resolvedPathBuffer, scan))
+		{
+			Logf("warning: failed to open file %s even though it should exist\n",
+			     resolvedPathBuffer);
+			if (mostRecentModifiedTimeOut)
+				*mostRecentModifiedTimeOut = 0;
+			return false;
+		}
 
-		// I think '#   include' is valid
-		if (lineBuffer[0] != '#' || !strstr(lineBuffer, "include"))
+		crc = scan.crc;
+		includes = scan.includes;
+
+		std::lock_guard<std::mutex> lock(s_buildCacheMutex);
+		if (thisModificationTime && thisModificationTime < scanTime)
+			changedHeaderScans[resolvedPathBuffer] = scan;
+		else
+			changedHeaderScans.erase(resolvedPathBuffer);
+
+		headerScans[resolvedPathBuffer] = std::move(scan);
+	}
+
+	for (const std::string& include : includes)
+	{
+		if (logging.includeScanning)
+			Logf("\t%s include: %s\n", resolvedPathBuffer, include.c_str());
+
+		FileModifyTime includeModifiedTime = 0;
+		headerCrcDiffersFromExpected |= AreIncludedHeadersModified_Recursive(
+		    searchDirectories, include.c_str(), resolvedPathBuffer, isModifiedCache,
+		    loadedHeaderCrcCache, changedHeaderCrcCache, headerScans, changedHeaderScans,
+		    &includeModifiedTime);
+
+		if (logging.includeScanning)
+			Logf("\t tree modification time: " FORMAT_FILETIME "\n", includeModifiedTime);
+
+		if (includeModifiedTime > mostRecentModTime)
+			mostRecentModTime = includeModifiedTime;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(s_buildCacheMutex);
+		if (changedHeaderCrcCache.find(filename) != changedHeaderCrcCache.end())
 		{
-			// No include on this line; get the length for the CRC
-			lineLength = strlen(lineBuffer);
+			headerCrcDiffersFromExpected |= true;
+			if (logging.includeScanning)
+				Logf("   >>> Header %s already marked as different.\n", filename);
 		}
 		else
 		{
-			char foundInclude[MAX_PATH_LENGTH] = {0};
-			char* foundIncludeWrite = foundInclude;
-			bool foundOpening = false;
-			for (char* c = &lineBuffer[0]; *c != '\0'; ++c)
+			ArtifactCrcTable::iterator findIt = loadedHeaderCrcCache.find(filename);
+			if (findIt != loadedHeaderCrcCache.end())
 			{
-				++lineLength;
-				if (foundOpening)
+				bool isCrcChanged = (findIt->second != crc);
+				headerCrcDiffersFromExpected |= isCrcChanged;
+				// We only want to make an entry if we no longer match
+				if (isCrcChanged)
 				{
-					if (*c == '\"' || *c == '>')
-					{
-						if (logging.includeScanning)
-							Logf("\t%s include: %s\n", resolvedPathBuffer, foundInclude);
+					changedHeaderCrcCache[filename] = crc;
+					if (logging.includeScanning)
+						Logf("   >>> Header %s crc %u no longer matches %u.\n", filename, crc,
+						     findIt->second);
+				}
+			}
+			else
+			{
+				// We don't know anything about this header yet; we must assume it has "changed" and
+				// we need to rebuild whatever is dependent on it
+				headerCrcDiffersFromExpected |= true;
+				changedHeaderCrcCache[filename] = crc;
+				if (logging.includeScanning)
+					Logf("   >>> Header %s was unknown. Marking as changed.\n", filename);
+			}
+		}
+	}
 
-						FileModifyTime includeModifiedTime = 0;
-						headerCrcDiffersFromExpected |= AreIncludedHeadersModified_Recursive(
-						    searchDirectories, foundInclude, resolvedPathBuffer, isModifiedCache,
-						    loadedHeaderCrcCache, changedHeaderCrcCache, &includeModifiedTime);
+	if (thisModificationTime != mostRecentModTime)
+		isModifiedCache[filename] = mostRecentModTime;
 
-						if (logging.includeScanning)
-							Logf("\t tree modification time: " FORMAT_FILETIME "\n",
-							     includeModifiedTime);
+	if (mostRecentModifiedTimeOut)
+		*mostRecentModifiedTimeOut = mostRecentModTime;
+	return headerCrcDiffersFromExpected;
+}
+
+// Parses the prerequisites of the first rule in a Makefile-style dependency file, e.g.
+// "object.o: source.cpp header.hpp \<newline> other\ header.hpp"
+static bool ReadDependencyFile(const char* dependencyFilename,
+                               std::vector<std::string>& dependenciesOut)
+{
+	MappedFile dependencyFile = {0};
+	const char* error = nullptr;
+	if (!fileMapReadOnly(dependencyFilename, &dependencyFile, &error))
+	{
+		Logf("%s: error: %s\n", dependencyFilename, error);
+		return false;
+	}
 
-						if (includeModifiedTime > mostRecentModTime)
-							mostRecentModTime = includeModifiedTime;
-					}
+	const char* c = dependencyFile.contents;
+	const char* end = dependencyFile.contents + dependencyFile.size;
 
-					*foundIncludeWrite = *c;
-					++foundIncludeWrite;
-				}
-				else if (*c == '\"' || *c == '<')
-					foundOpening = true;
-			}
+	// Skip the target. Colons in Windows drive letters aren't followed by whitespace
+	bool foundColon = false;
+	for (; c < end; ++c)
+	{
+		if (*c == '\\' && c + 1 < end)
+			++c;
+		else if (*c == ':' && (c + 1 == end || isspace(*(c + 1))))
+		{
+			++c;
+			foundColon = true;
+			break;
 		}
-
-		crc32(lineBuffer, lineLength, &crc);
 	}
 
-	if (changedHeaderCrcCache.find(filename) != changedHeaderCrcCache.end())
+	if (!foundColon)
 	{
-		headerCrcDiffersFromExpected |= true;
-		if (logging.includeScanning)
-			Logf("   >>> Header %s already marked as different.\n", filename);
+		Logf("warning: could not find target in dependency file %s\n", dependencyFilename);
+		fileUnmap(&dependencyFile);
+		return false;
 	}
-	else
+
+	std::string dependency;
+	for (; c < end; ++c)
 	{
-		ArtifactCrcTable::iterator findIt = loadedHeaderCrcCache.find(filename);
-		if (findIt != loadedHeaderCrcCache.end())
+		if (*c == '\\' && c + 1 < end)
 		{
-			bool isCrcChanged = (findIt->second != crc);
-			headerCrcDiffersFromExpected |= isCrcChanged;
-			// We only want to make an entry if we no longer match
-			if (isCrcChanged)
+			const char next = *(c + 1);
+			if (next == '\n' || next == '\r')
 			{
-				changedHeaderCrcCache[filename] = crc;
-				if (logging.includeScanning)
-					Logf("   >>> Header %s crc %u no longer matches %u.\n", filename, crc, findIt->second);
+				// Line continuation
+				if (!dependency.empty())
+					dependenciesOut.push_back(dependency);
+				dependency.clear();
+				++c;
+				if (next == '\r' && c + 1 < end && *(c + 1) == '\n')
+					++c;
 			}
+			else if (next == ' ' || next == '#')
+			{
+				dependency.push_back(next);
+				++c;
+			}
+			else
+				dependency.push_back(*c);
+		}
+		else if (*c == '$' && c + 1 < end && *(c + 1) == '$')
+		{
+			dependency.push_back('$');
+			++c;
+		}
+		else if (*c == ' ' || *c == '\t' || *c == '\n' || *c == '\r')
+		{
+			if (!dependency.empty())
+				dependenciesOut.push_back(dependency);
+			dependency.clear();
+
+			// Only the first rule matters
+			if (*c == '\n' || *c == '\r')
+				break;
 		}
 		else
+			dependency.push_back(*c);
+	}
+
+	if (!dependency.empty())
+		dependenciesOut.push_back(dependency);
+
+	fileUnmap(&dependencyFile);
+	return true;
+}
+
+void makeDependencyFileArguments(const char* buildExecutable, const char* dependencyFilename,
+                                 std::vector<const char*>& argumentsOut)
+{
+	// cl.exe only reports dependencies as JSON (/sourceDependencies), so its headers are scanned
+	if (StrCompareIgnoreCase(buildExecutable, "cl.exe") == 0)
+		return;
+
+	argumentsOut.push_back("-MMD");
+	argumentsOut.push_back("-MF");
+	argumentsOut.push_back(dependencyFilename);
+}
+
+void buildRecordArtifactDependencies(EvaluatorEnvironment& environment,
+                                     const char* artifactFilename, const char* dependencyFilename,
+                                     const char* additionalDependency)
+{
+	std::vector<std::string> dependencyFilenames;
+	if (!fileExists(dependencyFilename) ||
+	    !ReadDependencyFile(dependencyFilename, dependencyFilenames))
+	{
+		environment.artifactDependencies.erase(artifactFilename);
+		environment.changedArtifactDependencies.erase(artifactFilename);
+		return;
+	}
+
+	if (additionalDependency)
+		dependencyFilenames.push_back(additionalDependency);
+
+	// Sample the time before reading, like header scans. A file modified in the same tick could be
+	// modified again without changing its time, so only its CRC can be trusted next build
+	FileModifyTime recordTime = fileGetCurrentTime();
+
+	std::vector<ArtifactDependency> dependencies;
+	dependencies.reserve(dependencyFilenames.size());
+	for (std::string& filename : dependencyFilenames)
+	{
+		ArtifactDependency dependency;
+		FileModifyTime modificationTime = fileGetLastModificationTime(filename.c_str());
+		dependency.modificationTime = modificationTime < recordTime ? modificationTime : 0;
+		dependency.crc = getFileCrc32(filename.c_str());
+		dependency.filename = std::move(filename);
+		dependencies.push_back(std::move(dependency));
+	}
+
+	if (logging.includeScanning)
+		Logf("%s has " FORMAT_SIZE_T " dependencies according to %s\n", artifactFilename,
+		     dependencies.size(), dependencyFilename);
+
+	environment.artifactDependencies[artifactFilename] = dependencies;
+	environment.changedArtifactDependencies[artifactFilename] = std::move(dependencies);
+}
+
+// Returns false if the compiler hasn't reported the artifact's dependencies, in which case the
+// headers need to be scanned instead
+static bool AreReportedDependenciesModified(EvaluatorEnvironment& environment,
+                                            const char* artifactFilename,
+                                            const char* dependencyFilename,
+                                            bool* dependenciesModifiedOut,
+                                            FileModifyTime* mostRecentModifiedTimeOut)
+{
+	ArtifactDependenciesTable::iterator findIt =
+	    environment.artifactDependencies.find(artifactFilename);
+	// The dependency file is removed before each compile. If it doesn't exist, the last compile
+	// didn't write one, and whatever we recorded before that is stale
+	if (findIt == environment.artifactDependencies.end() || !fileExists(dependencyFilename))
+		return false;
+
+	*dependenciesModifiedOut = false;
+	*mostRecentModifiedTimeOut = 0;
+	for (const ArtifactDependency& dependency : findIt->second)
+	{
+		FileModifyTime modificationTime = fileGetLastModificationTime(dependency.filename.c_str());
+		if (!modificationTime)
 		{
-			// We don't know anything about this header yet; we must assume it has "changed" and we
-			// need to rebuild whatever is dependent on it
-			headerCrcDiffersFromExpected |= true;
-			changedHeaderCrcCache[filename] = crc;
+			// Removed or renamed. Let the compiler decide whether it's still needed
 			if (logging.includeScanning)
-				Logf("   >>> Header %s was unknown. Marking as changed.\n", filename);
+				Logf("   >>> Dependency %s of %s no longer exists\n", dependency.filename.c_str(),
+				     artifactFilename);
+			*dependenciesModifiedOut = true;
+			continue;
 		}
-	}
 
-	if (thisModificationTime != mostRecentModTime)
-		isModifiedCache[filename] = mostRecentModTime;
+		if (modificationTime == dependency.modificationTime)
+			continue;
 
-	fclose(file);
+		uint32_t crc = getFileCrc32(dependency.filename.c_str());
+		if (crc == dependency.crc)
+			continue;
 
-	if (mostRecentModifiedTimeOut)
-		*mostRecentModifiedTimeOut = mostRecentModTime;
-	return headerCrcDiffersFromExpected;
+		if (logging.includeScanning)
+			Logf("   >>> Dependency %s of %s crc %u no longer matches %u\n",
+			     dependency.filename.c_str(), artifactFilename, crc, dependency.crc);
+		*dependenciesModifiedOut = true;
+		if (modificationTime > *mostRecentModifiedTimeOut)
+			*mostRecentModifiedTimeOut = modificationTime;
+	}
+
+	if (logging.includeScanning)
+		Logf("Checked " FORMAT_SIZE_T " reported dependencies of %s\n", findIt->second.size(),
+		     artifactFilename);
+	return true;
 }
 
 // commandArguments should have terminating null sentinel
@@ -812,30 +1467,89 @@ bool commandEqualsCachedCommand(ArtifactCrcTable& cachedCommandCrcs, const char*
 	return findIt->second == newCommandCrc;
 }
 
+// canUseCachedFile(), but only holding s_buildCacheMutex while touching the environment's CRC
+// tables, so other threads aren't waiting while the source is read
+static bool CanUseCachedSourceFile(EvaluatorEnvironment& environment, const char* sourceFilename,
+                                   const char* builtFilename)
+{
+	if (!environment.useCachedFiles || fileIsMoreRecentlyModified(sourceFilename, builtFilename))
+		return false;
+
+	uint32_t expectedCrc = 0;
+	bool sourceCrcCached = false;
+	uint32_t sourceCrc = 0;
+	{
+		std::lock_guard<std::mutex> lock(s_buildCacheMutex);
+		HashedSourceArtifactCrcTable::iterator expectedFindIt =
+		    environment.sourceArtifactFileCrcs.find(
+		        getSourceArtifactKey(sourceFilename, builtFilename));
+		if (expectedFindIt == environment.sourceArtifactFileCrcs.end())
+		{
+			if (logging.buildReasons)
+				Logf("Artifact %s was not associated with source %s before\n", builtFilename,
+				     sourceFilename);
+			return false;
+		}
+		expectedCrc = expectedFindIt->second;
+
+		ArtifactCrcTable::iterator findIt =
+		    environment.cachedIntraBuildFileCrcs.find(sourceFilename);
+		sourceCrcCached = findIt != environment.cachedIntraBuildFileCrcs.end();
+		if (sourceCrcCached)
+			sourceCrc = findIt->second;
+	}
+
+	if (!sourceCrcCached)
+	{
+		sourceCrc = getFileCrc32(sourceFilename);
+		std::lock_guard<std::mutex> lock(s_buildCacheMutex);
+		environment.cachedIntraBuildFileCrcs[sourceFilename] = sourceCrc;
+	}
+
+	if (sourceCrc != expectedCrc)
+	{
+		if (logging.buildReasons)
+			Logf("Artifact %s needs to build because source %s CRC is now %u (expected %u)\n",
+			     builtFilename, sourceFilename, sourceCrc, expectedCrc);
+		return false;
+	}
+	return true;
+}
+
 bool cppFileNeedsBuild(EvaluatorEnvironment& environment, const char* sourceFilename,
-                       const char* artifactFilename, const char** commandArguments,
-                       ArtifactCrcTable& cachedCommandCrcs, ArtifactCrcTable& newCommandCrcs,
+                       const char* artifactFilename, const char* builtFilename,
+                       const char** commandArguments, ArtifactCrcTable& cachedCommandCrcs,
+                       ArtifactCrcTable& newCommandCrcs,
                        HeaderModificationTimeTable& headerModifiedCache,
-                       std::vector<std::string>& headerSearchDirectories)
+                       std::vector<std::string>& headerSearchDirectories,
+                       const char* dependencyFilename)
 {
+	if (!builtFilename)
+		builtFilename = artifactFilename;
+
 	uint32_t commandCrc = 0;
 	bool commandEqualsCached = commandEqualsCachedCommand(cachedCommandCrcs, artifactFilename,
 	                                                      commandArguments, &commandCrc);
 	// We could avoid doing this work, but it makes it easier to log if we do it regardless of
 	// commandEqualsCached invalidating our cache anyways
-	bool canUseCache = canUseCachedFile(environment, sourceFilename, artifactFilename);
+	bool canUseCache = CanUseCachedSourceFile(environment, sourceFilename, builtFilename);
 	// Note that I use the .o as "includedBy" because our header may not have needed any
 	// changes if our include changed. We have to use the .o as the time reference that
 	// we've rebuilt
 	FileModifyTime mostRecentHeaderModTime = 0;
-	bool headersModified = AreIncludedHeadersModified_Recursive(
-	    headerSearchDirectories, sourceFilename,
-	    /*includedBy*/ nullptr, headerModifiedCache, environment.loadedHeaderCrcCache,
-	    environment.changedHeaderCrcCache, &mostRecentHeaderModTime);
+	bool headersModified = false;
+	if (!environment.useCompilerDependencyFiles || !dependencyFilename ||
+	    !AreReportedDependenciesModified(environment, artifactFilename, dependencyFilename,
+	                                     &headersModified, &mostRecentHeaderModTime))
+		headersModified = AreIncludedHeadersModified_Recursive(
+		    headerSearchDirectories, sourceFilename,
+		    /*includedBy*/ nullptr, headerModifiedCache, environment.loadedHeaderCrcCache,
+		    environment.changedHeaderCrcCache, environment.headerScans,
+		    environment.changedHeaderScans, &mostRecentHeaderModTime);
 
 	if (commandEqualsCached && canUseCache)
 	{
-		FileModifyTime artifactModTime = fileGetLastModificationTime(artifactFilename);
+		FileModifyTime artifactModTime = fileGetLastModificationTime(builtFilename);
 		if (artifactModTime >= mostRecentHeaderModTime && !headersModified)
 		{
 			if (logging.buildProcess)
@@ -858,7 +1572,7 @@ bool cppFileNeedsBuild(EvaluatorEnvironment& environment, const char* sourceFile
 	if (logging.buildReasons)
 	{
 		Logf("Build %s reason(s):\n", artifactFilename);
-		if (!fileExists(artifactFilename))
+		if (!fileExists(builtFilename))
 			Log("\tfile does not exist\n");
 		else if (!canUseCache)
 			Log("\tobject files updated\n");
@@ -870,7 +1584,10 @@ bool cppFileNeedsBuild(EvaluatorEnvironment& environment, const char* sourceFile
 	}
 
 	if (!commandEqualsCached)
+	{
+		std::lock_guard<std::mutex> lock(s_buildCacheMutex);
 		newCommandCrcs[artifactFilename] = commandCrc;
+	}
 
 	return true;
 }
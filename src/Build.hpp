@@ -73,7 +73,43 @@ typedef std::pair<const std::string, uint32_t> ArtifactCrcTablePair;
 
 // Uses a hash of the artifact name, then the source name
 typedef std::unordered_map<uint32_t, uint32_t> HashedSourceArtifactCrcTable;
-typedef std::pair<uint32_t, uint32_t> HashedSourceArtifactCrcTablePair;
+typedef std::pair<const uint32_t, uint32_t> HashedSourceArtifactCrcTablePair;
+
+// What the header scanner found the last time it read a header. If the header's modification time
+// and size still match, the scan results are reused instead of reading the file again
+struct HeaderScanCacheEntry
+{
+	FileModifyTime modificationTime;
+	uint64_t size;
+	uint32_t crc;
+	// Direct includes, exactly as written in the header (not resolved)
+	std::vector<std::string> includes;
+};
+
+// Keyed by resolved header path
+typedef std::unordered_map<std::string, HeaderScanCacheEntry> HeaderScanTable;
+typedef std::pair<const std::string, HeaderScanCacheEntry> HeaderScanTablePair;
+
+// A file the compiler reported reading, as it was right after the compile. If its modification time
+// still matches, it wasn't modified. Otherwise its CRC decides, so a file rewritten with the same
+// contents doesn't cause a rebuild
+struct ArtifactDependency
+{
+	std::string filename;
+	// Zero if it was modified in the same tick it was recorded, which means it could be modified
+	// again without the time changing
+	FileModifyTime modificationTime;
+	uint32_t crc;
+};
+
+// Keyed by artifact. The files the compiler reported reading the last time it built the artifact
+typedef std::unordered_map<std::string, std::vector<ArtifactDependency>> ArtifactDependenciesTable;
+typedef std::pair<const std::string, std::vector<ArtifactDependency>> ArtifactDependenciesTablePair;
+
+// Keyed by the library a compile-time definition would be built into on its own. The artifacts name
+// of the batch library it was built into instead
+typedef std::unordered_map<std::string, std::string> ComptimeBatchTable;
+typedef std::pair<const std::string, std::string> ComptimeBatchTablePair;
 
 // Why read, merge, write? Because it's possible we ran another instance of cakelisp in the same
 // directory during our build phase. The caches are shared state, so we don't want to blow away
@@ -81,12 +117,23 @@ typedef std::pair<uint32_t, uint32_t> HashedSourceArtifactCrcTablePair;
 void buildReadMergeWriteCacheFile(const char* buildOutputDir, ArtifactCrcTable& cachedCommandCrcs,
                                   ArtifactCrcTable& newCommandCrcs,
                                   HashedSourceArtifactCrcTable& sourceArtifactFileCrcs,
-                                  ArtifactCrcTable& changedHeaderCrcCache);
+                                  ArtifactCrcTable& changedHeaderCrcCache,
+                                  HeaderScanTable& changedHeaderScans,
+                                  ArtifactDependenciesTable& changedArtifactDependencies);
 
 // Returns false if there were errors; the file not existing is not an error
 bool buildReadCacheFile(const char* buildOutputDir, ArtifactCrcTable& cachedCommandCrcs,
                         HashedSourceArtifactCrcTable& sourceArtifactFileCrcs,
-                        ArtifactCrcTable& headerCrcCache);
+                        ArtifactCrcTable& headerCrcCache, HeaderScanTable& headerScans,
+                        ArtifactDependenciesTable& artifactDependencies);
+
+// Kept out of Cache.cake, because only the evaluator builds in batches. An empty batch name in
+// changedComptimeBatches means the definition has its own library again
+void buildReadMergeWriteComptimeBatchesFile(const char* buildOutputDir,
+                                            ComptimeBatchTable& changedComptimeBatches);
+
+// Returns false if there were errors; the file not existing is not an error
+bool buildReadComptimeBatchesFile(const char* buildOutputDir, ComptimeBatchTable& comptimeBatches);
 
 // commandArguments should have terminating null sentinel
 bool commandEqualsCachedCommand(ArtifactCrcTable& cachedCommandCrcs, const char* artifactKey,
@@ -94,11 +141,43 @@ bool commandEqualsCachedCommand(ArtifactCrcTable& cachedCommandCrcs, const char*
 
 struct EvaluatorEnvironment;
 
-// Check command, headers, and cache for whether the artifact is still valid
+// Check command, headers, and cache for whether the artifact is still valid. If the environment
+// uses compiler dependency files and dependencyFilename (which may be null) exists, the
+// dependencies the compiler reported are checked instead of scanning headers. Several threads may
+// check at once, as long as each has its own headerModifiedCache. builtFilename is the file the
+// artifact was built into, if it isn't artifactFilename itself (otherwise null), e.g. when several
+// compile-time definitions share a batch library
 bool cppFileNeedsBuild(EvaluatorEnvironment& environment, const char* sourceFilename,
-                       const char* artifactFilename, const char** commandArguments,
+                       const char* artifactFilename, const char* builtFilename,
+                       const char** commandArguments,
                        ArtifactCrcTable& cachedCommandCrcs, ArtifactCrcTable& newCommandCrcs,
                        HeaderModificationTimeTable& headerModifiedCache,
-                       std::vector<std::string>& headerSearchDirectories);
+                       std::vector<std::string>& headerSearchDirectories,
+                       const char* dependencyFilename);
+
+// Leaves argumentsOut empty if the compiler can't write Makefile-style dependency files. The
+// arguments point into dependencyFilename
+void makeDependencyFileArguments(const char* buildExecutable, const char* dependencyFilename,
+                                 std::vector<const char*>& argumentsOut);
+
+// Read the dependency file the compiler wrote while building the artifact, and remember it for
+// later cppFileNeedsBuild() checks. additionalDependency may be null, or a file the compiler won't
+// report, like a precompiled header. If the compiler didn't write a dependency file (e.g. cl.exe),
+// the artifact's headers will be scanned instead
+void buildRecordArtifactDependencies(EvaluatorEnvironment& environment,
+                                     const char* artifactFilename, const char* dependencyFilename,
+                                     const char* additionalDependency);
+
+// Compiles started by every environment in this process. Lets tests check that a build with no
+// changes compiled nothing, and that batches were built (or failed) as expected
+struct BuildCounts
+{
+	int numComptimeCompiles;
+	int numCompiles;
+	// Batch compiles are also counted in numComptimeCompiles
+	int numComptimeBatchCompiles;
+	int numFailedComptimeBatchCompiles;
+};
+extern CAKELISP_API BuildCounts g_buildCounts;
 
 CAKELISP_API bool setPlatformEnvironmentVariable(const char* name, const char* value);
@@ -3,6 +3,10 @@
 #include <stdio.h>
 #include <string.h>
 
+#include <algorithm>
+#include <chrono>
+#include <deque>
+
 #include "Build.hpp"
 #include "Converters.hpp"
 #include "DynamicLoader.hpp"
@@ -91,7 +95,19 @@ bool addObjectDefinition(EvaluatorEnvironment& environment, ObjectDefinition& de
 			return false;
 		}
 
-		environment.definitions[definition.name] = definition;
+		definition.nameId = internString(definition.name);
+		ObjectDefinition* newDefinition =
+		    &(environment.definitions[definition.name] = definition);
+
+		// Let references which came before the definition know about it
+		ObjectReferencePoolMap::iterator findPool =
+		    environment.referencePools.find(definition.nameId);
+		if (findPool != environment.referencePools.end())
+		{
+			for (ObjectReferenceStatus* referenceStatus : findPool->second.statuses)
+				referenceStatus->definition = newDefinition;
+		}
+		environment.requiredPropagationQueue.push_back(newDefinition);
 		return true;
 	}
 	else
@@ -116,28 +132,30 @@ const ObjectReferenceStatus* addObjectReference(EvaluatorEnvironment& environmen
                                                 ObjectReference& reference)
 {
 	// Default to the module requiring the reference, for top-level references
-	std::string definitionName = globalDefinitionName;
+	const char* defName = globalDefinitionName;
 	if (!reference.context.definitionName && reference.context.scope != EvaluatorScope_Module)
 		Log("error: addObjectReference() expects a definitionName\n");
 
 	if (reference.context.definitionName)
 	{
-		definitionName = reference.context.definitionName->contents;
+		defName = reference.context.definitionName->contents.c_str();
 	}
 
-	const char* defName = definitionName.c_str();
 	if (logging.references)
 		Logf("Adding reference %s to %s\n", referenceNameToken.contents.c_str(), defName);
 
+	// Tables of references are keyed by interned name, which token contents already are
+	InternedString referenceNameId = referenceNameToken.contents.internedId();
+
 	// Add the reference requirement to the definition it occurred in
 	ObjectReferenceStatus* refStatus = nullptr;
-	ObjectDefinitionMap::iterator findDefinition = environment.definitions.find(definitionName);
+	bool isNewStatus = false;
+	ObjectDefinitionMap::iterator findDefinition = environment.definitions.find(defName);
 	if (findDefinition == environment.definitions.end())
 	{
-		if (definitionName.compare(globalDefinitionName) != 0)
+		if (strcmp(defName, globalDefinitionName) != 0)
 		{
-			Logf("error: expected definition %s to already exist. Things will break\n",
-			     definitionName.c_str());
+			Logf("error: expected definition %s to already exist. Things will break\n", defName);
 		}
 		else
 		{
@@ -152,19 +170,26 @@ const ObjectReferenceStatus* addObjectReference(EvaluatorEnvironment& environmen
 		// make a good link to the reference in the reference pool, because it can easily be moved
 		// by hash realloc or vector resize
 		ObjectReferenceStatusMap::iterator findRefIt =
-		    findDefinition->second.references.find(referenceNameToken.contents.c_str());
+		    findDefinition->second.references.find(referenceNameId);
 		if (findRefIt == findDefinition->second.references.end())
 		{
 			ObjectReferenceStatus newStatus;
 			newStatus.name = &referenceNameToken;
+			newStatus.owner = &findDefinition->second;
+			newStatus.definition =
+			    findObjectDefinition(environment, referenceNameToken.contents.c_str());
+			// The referenced definition needs to become required if this one already is
+			if (newStatus.definition)
+				environment.requiredPropagationQueue.push_back(newStatus.definition);
 			newStatus.guessState = reference.type == ObjectReferenceResolutionType_AlreadyLoaded ?
 			                           GuessState_Resolved :
 			                           GuessState_None;
 			newStatus.references.push_back(reference);
 			std::pair<ObjectReferenceStatusMap::iterator, bool> newRefStatusResult =
 			    findDefinition->second.references.emplace(
-			        std::make_pair(referenceNameToken.contents, std::move(newStatus)));
+			        std::make_pair(referenceNameId, std::move(newStatus)));
 			refStatus = &newRefStatusResult.first->second;
+			isNewStatus = true;
 		}
 		else
 		{
@@ -175,18 +200,11 @@ const ObjectReferenceStatus* addObjectReference(EvaluatorEnvironment& environmen
 
 	// Add the reference to the reference pool. This makes it easier to find all places where it is
 	// referenced during resolve time
-	ObjectReferencePoolMap::iterator findIt =
-	    environment.referencePools.find(referenceNameToken.contents);
-	if (findIt == environment.referencePools.end())
-	{
-		ObjectReferencePool newPool = {};
-		newPool.references.push_back(reference);
-		environment.referencePools[referenceNameToken.contents] = std::move(newPool);
-	}
-	else
-	{
-		findIt->second.references.push_back(reference);
-	}
+	ObjectReferencePool& pool = environment.referencePools[referenceNameId];
+	pool.references.push_back(reference);
+	// Statuses never move, so the pool can keep them up to date when the name is defined
+	if (isNewStatus)
+		pool.statuses.push_back(refStatus);
 
 	return refStatus;
 }
@@ -222,8 +240,14 @@ bool CreateCompileTimeVariable(EvaluatorEnvironment& environment, const char* na
 
 	// Make sure it gets built and loaded once it is defined
 	if (destroyCompileTimeFuncName)
+	{
 		environment.requiredCompileTimeFunctions[destroyCompileTimeFuncName] =
 		    "compile time variable destructor";
+		ObjectDefinition* destroyDefinition =
+		    findObjectDefinition(environment, destroyCompileTimeFuncName);
+		if (destroyDefinition)
+			environment.requiredPropagationQueue.push_back(destroyDefinition);
+	}
 
 	return true;
 }
@@ -271,18 +295,36 @@ bool HandleInvocation_Recursive(EvaluatorEnvironment& environment, const Evaluat
 	{
 		// We must use a separate vector for each macro because Token lists must be immutable. If
 		// they weren't, pointers to tokens would be invalidated
-		const std::vector<Token>* macroOutputTokens = nullptr;
+		std::vector<Token>* macroOutputTokens = nullptr;
 		bool macroSucceeded;
 		{
-			// Do NOT modify token lists after they are created. You can change the token contents
-			std::vector<Token>* macroOutputTokensNoConst_CREATIONONLY = new std::vector<Token>();
+			// Reuse scratch space for the macro to write to, rather than growing a new list
+			std::vector<Token>* scratchTokens = nullptr;
+			if (environment.macroOutputScratch.empty())
+				scratchTokens = new std::vector<Token>();
+			else
+			{
+				scratchTokens = environment.macroOutputScratch.back();
+				environment.macroOutputScratch.pop_back();
+			}
 
 			// Have the macro generate some code for us!
-			macroSucceeded = invokedMacro(environment, context, tokens, invocationStartIndex,
-			                              *macroOutputTokensNoConst_CREATIONONLY);
+			macroSucceeded =
+			    invokedMacro(environment, context, tokens, invocationStartIndex, *scratchTokens);
+
+			// Do NOT modify token lists after they are created. You can change the token contents.
+			// The tokens are kept for later referencing until environmentDestroyInvalidateTokens(),
+			// even if evaluating them fails, because the environment might still hold references
+			// to them. It's also necessary for error reporting
+			if (macroSucceeded && !scratchTokens->empty())
+			{
+				environment.macroExpansionTokens.emplace_back(scratchTokens->begin(),
+				                                              scratchTokens->end());
+				macroOutputTokens = &environment.macroExpansionTokens.back();
+			}
 
-			// Make it const to save any temptation of modifying the list and breaking everything
-			macroOutputTokens = macroOutputTokensNoConst_CREATIONONLY;
+			scratchTokens->clear();
+			environment.macroOutputScratch.push_back(scratchTokens);
 		}
 
 		// Don't even try to validate the code if the macro wasn't satisfied
@@ -290,25 +332,18 @@ bool HandleInvocation_Recursive(EvaluatorEnvironment& environment, const Evaluat
 		{
 			ErrorAtTokenf(invocationName, "macro '%s' returned failure",
 			              invocationName.contents.c_str());
-
-			// Deleting these tokens is only safe at this point because we know we have not
-			// evaluated them. As soon as they are evaluated, they must be kept around
-			delete macroOutputTokens;
 			return false;
 		}
 
 		// The macro had no output, but we won't let that bother us
-		if (macroOutputTokens->empty())
-		{
-			delete macroOutputTokens;
+		if (!macroOutputTokens)
 			return true;
-		}
 
 		// TODO: Pretty print to macro expand file and change output token source to
 		// point there
 
 		// Macro must generate valid parentheses pairs!
-		bool validateResult = validateTokens(*macroOutputTokens);
+		bool validateResult = validateTokensAddParenTable(*macroOutputTokens);
 		if (!validateResult)
 		{
 			NoteAtToken(invocationStart,
@@ -318,17 +353,10 @@ bool HandleInvocation_Recursive(EvaluatorEnvironment& environment, const Evaluat
 			Log("\n");
 			// Deleting these tokens is only safe at this point because we know we have not
 			// evaluated them. As soon as they are evaluated, they must be kept around
-			delete macroOutputTokens;
+			environment.macroExpansionTokens.pop_back();
 			return false;
 		}
 
-		// Macro succeeded and output valid tokens. Keep its tokens for later referencing and
-		// destruction. Note that macroOutputTokens cannot be destroyed safely until all pointers to
-		// its Tokens are cleared. This means even if we fail while evaluating the tokens, we will
-		// keep the array around because the environment might still hold references to the tokens.
-		// It's also necessary for error reporting
-		environment.comptimeTokens.push_back(macroOutputTokens);
-
 		// Let the definition know about the expansion so it is easy to construct an expanded list
 		// of all tokens in the definition
 		if (context.definitionName)
@@ -552,9 +580,9 @@ int EvaluateGenerateAll_Recursive(EvaluatorEnvironment& environment,
 	// Note that in most cases, we will continue evaluation in order to turn up more errors
 	int numErrors = 0;
 
-	bool isDelimiterUsed = !context.delimiterTemplate.output.empty() ||
+	bool isDelimiterUsed = context.delimiterTemplate.outputLength ||
 	                       context.delimiterTemplate.modifiers != StringOutMod_None;
-	bool isDelimiterSyntactic = !context.delimiterTemplate.output.empty() ||
+	bool isDelimiterSyntactic = context.delimiterTemplate.outputLength ||
 	                            context.delimiterTemplate.modifiers != StringOutMod_NewlineAfter;
 
 	// Used to detect when something was actually output during evaluation
@@ -628,6 +656,29 @@ bool ReplaceAndEvaluateDefinition(EvaluatorEnvironment& environment,
 	// its own output. Have the environment hold on to it for later destruction
 	environment.orphanedOutputs.push_back(definitionOutput);
 
+	// References to the definition and the statuses it owns must not outlive it. The replacement
+	// will be linked back up to the references when it is added
+	ObjectReferencePoolMap::iterator findPool =
+	    environment.referencePools.find(findIt->second.nameId);
+	if (findPool != environment.referencePools.end())
+	{
+		for (ObjectReferenceStatus* referenceStatus : findPool->second.statuses)
+			referenceStatus->definition = nullptr;
+	}
+	for (ObjectReferenceStatusPair& referencePair : findIt->second.references)
+	{
+		findPool = environment.referencePools.find(referencePair.first);
+		if (findPool == environment.referencePools.end())
+			continue;
+		std::vector<ObjectReferenceStatus*>& statuses = findPool->second.statuses;
+		statuses.erase(std::remove(statuses.begin(), statuses.end(), &referencePair.second),
+		               statuses.end());
+	}
+	std::vector<ObjectDefinition*>& propagationQueue = environment.requiredPropagationQueue;
+	propagationQueue.erase(
+	    std::remove(propagationQueue.begin(), propagationQueue.end(), &findIt->second),
+	    propagationQueue.end());
+
 	// This makes me nervous because the user could have a reference to this when calling this
 	// function. I can't think of a safer way to get rid of the reference without deleting it
 	environment.definitions.erase(findIt);
@@ -679,69 +730,94 @@ bool ClearAndEvaluateAtSplicePoint(EvaluatorEnvironment& environment, const char
 	return result;
 }
 
-// Determine what needs to be built, iteratively
-// TODO This can be made faster. I did the most naive version first, for now
+// Determine what needs to be built. Only definitions which might have changed since the last call
+// are checked, then required-ness spreads from them to the definitions they reference
 static void PropagateRequiredToReferences(EvaluatorEnvironment& environment)
 {
-	// Figure out what is required
-	// This needs to loop so long as it doesn't recurse to references
-	int numRequiresStatusChanged = 0;
-	do
+	std::vector<ObjectDefinition*> newlyRequired;
+	for (ObjectDefinition* definition : environment.requiredPropagationQueue)
 	{
-		numRequiresStatusChanged = 0;
-		for (ObjectDefinitionPair& definitionPair : environment.definitions)
+		// Automatically require a compile-time function if the environment needs it (typically
+		// because some other function was called that added the requirement before the
+		// definition was available)
+		if (definition->type == ObjectType_CompileTimeFunction && !definition->isRequired)
 		{
-			ObjectDefinition& definition = definitionPair.second;
+			RequiredCompileTimeFunctionReasonsTableIterator findIt =
+			    environment.requiredCompileTimeFunctions.find(definition->name.c_str());
 
-			// Automatically require a compile-time function if the environment needs it (typically
-			// because some other function was called that added the requirement before the
-			// definition was available)
-			if (definition.type == ObjectType_CompileTimeFunction && !definition.isRequired)
+			if (findIt != environment.requiredCompileTimeFunctions.end())
 			{
-				RequiredCompileTimeFunctionReasonsTableIterator findIt =
-				    environment.requiredCompileTimeFunctions.find(definition.name.c_str());
+				if (logging.dependencyPropagation)
+					Logf("Define %s promoted to required because %s\n", definition->name.c_str(),
+					     findIt->second);
+
+				definition->isRequired = true;
+				definition->environmentRequired = true;
+			}
+		}
 
-				if (findIt != environment.requiredCompileTimeFunctions.end())
+		// A reference from a required definition may have been added, or made before this
+		// definition existed
+		if (!definition->isRequired)
+		{
+			ObjectReferencePoolMap::iterator findPool =
+			    environment.referencePools.find(definition->nameId);
+			if (findPool != environment.referencePools.end())
+			{
+				for (ObjectReferenceStatus* referenceStatus : findPool->second.statuses)
 				{
+					if (!referenceStatus->owner->isRequired)
+						continue;
+
 					if (logging.dependencyPropagation)
-						Logf("Define %s promoted to required because %s\n", definition.name.c_str(),
-						     findIt->second);
+						Logf("\t Infecting %s with required due to %s\n",
+						     definition->name.c_str(), referenceStatus->owner->name.c_str());
 
-					definition.isRequired = true;
-					definition.environmentRequired = true;
+					definition->isRequired = true;
+					break;
 				}
 			}
+		}
+
+		if (logging.dependencyPropagation)
+		{
+			const char* status = definition->isRequired ? "(required)" : "(not required)";
+			Logf("Define %s %s\n", definition->name.c_str(), status);
+		}
+
+		if (definition->isRequired && !definition->hasPropagatedRequired)
+			newlyRequired.push_back(definition);
+	}
+	environment.requiredPropagationQueue.clear();
+
+	while (!newlyRequired.empty())
+	{
+		ObjectDefinition* definition = newlyRequired.back();
+		newlyRequired.pop_back();
+		if (definition->hasPropagatedRequired)
+			continue;
+		definition->hasPropagatedRequired = true;
+
+		for (ObjectReferenceStatusPair& reference : definition->references)
+		{
+			ObjectReferenceStatus& referenceStatus = reference.second;
 
 			if (logging.dependencyPropagation)
-			{
-				const char* status = definition.isRequired ? "(required)" : "(not required)";
-				Logf("Define %s %s\n", definition.name.c_str(), status);
-			}
+				Logf("\t%s refers to %s\n", definition->name.c_str(),
+				     referenceStatus.name->contents.c_str());
 
-			for (ObjectReferenceStatusPair& reference : definition.references)
+			ObjectDefinition* referencedDefinition = referenceStatus.definition;
+			if (referencedDefinition && !referencedDefinition->isRequired)
 			{
-				ObjectReferenceStatus& referenceStatus = reference.second;
-
 				if (logging.dependencyPropagation)
-					Logf("\tRefers to %s\n", referenceStatus.name->contents.c_str());
-
-				if (definition.isRequired)
-				{
-					ObjectDefinitionMap::iterator findIt =
-					    environment.definitions.find(referenceStatus.name->contents);
-					if (findIt != environment.definitions.end() && !findIt->second.isRequired)
-					{
-						if (logging.dependencyPropagation)
-							Logf("\t Infecting %s with required due to %s\n",
-							     referenceStatus.name->contents.c_str(), definition.name.c_str());
+					Logf("\t Infecting %s with required due to %s\n",
+					     referenceStatus.name->contents.c_str(), definition->name.c_str());
 
-						++numRequiresStatusChanged;
-						findIt->second.isRequired = true;
-					}
-				}
+				referencedDefinition->isRequired = true;
+				newlyRequired.push_back(referencedDefinition);
 			}
 		}
-	} while (numRequiresStatusChanged);
+	}
 }
 
 static void OnCompileProcessOutput(const char* output)
@@ -759,9 +835,9 @@ enum BuildStage
 	BuildStage_Finished
 };
 
-// Note: environment.definitions can be resized/rehashed during evaluation, which invalidates
-// iterators. For now, I will rely on the fact that std::unordered_map does not invalidate
-// references on resize. This will need to change if the data structure changes
+// Note: environment.definitions can grow during evaluation. This relies on FlatHashMap never moving
+// its values, so references to definitions stay valid. This will need to change if the data
+// structure changes
 struct ComptimeBuildObject
 {
 	int buildId = -1;
@@ -774,10 +850,48 @@ struct ComptimeBuildObject
 	std::string buildObjectName;
 	std::vector<std::string> importLibraries;
 	ObjectDefinition* definition = nullptr;
+	// Built as part of a ComptimeBuildBatch. The definition is loaded from the batch's library,
+	// and nothing is built at dynamicLibraryPath, which stays the definition's key in the cache
+	bool isBatched = false;
+	std::string batchLibraryPath;
+};
+
+// Several macros and generators compiled as one translation unit and linked into one library, so
+// they share the compiler startup and the parsing of the Cakelisp headers
+struct ComptimeBuildBatch
+{
+	int status = -1;
+	BuildStage stage = BuildStage_None;
+	std::string artifactsName;
+	std::string sourceOutputName;
+	std::string buildObjectName;
+	std::string dynamicLibraryPath;
+	std::vector<std::string> importLibraries;
+	std::vector<ComptimeBuildObject*> members;
+};
+
+// The compile-time objects built by one BuildEvaluateReferences() pass. A definition joins while
+// the others are still building, as soon as the last thing it references is loaded
+struct ComptimeBuildQueue
+{
+	// Adding to a deque doesn't move the other objects, whose statuses processes write to
+	std::deque<ComptimeBuildObject> objects;
+	// Declared here to reduce memory allocations by re-using buffer for every definition
+	std::vector<ObjectReferenceStatus*> referencesToCheck;
+	// If it's possible a definition has new requirements, make sure we do another pass to add
+	// those requirements to the build
+	bool requireDependencyPropagation = false;
 };
 
-static std::vector<ObjectReference>* GetReferenceListFromReference(EvaluatorEnvironment& environment,
-                                       const char* referenceToResolve)
+static bool CheckDefinitionReadyToBuild(EvaluatorEnvironment& environment,
+                                        ObjectDefinition& definition,
+                                        std::vector<ObjectReferenceStatus*>& referencesToCheck,
+                                        bool& hasAnyRefsOut, bool& requireDependencyPropagation);
+static void AddComptimeBuildObject(EvaluatorEnvironment& environment, ObjectDefinition& definition,
+                                   bool hasAnyRefs, std::deque<ComptimeBuildObject>& objects);
+
+static std::vector<ObjectReference>* GetReferenceListFromReference(
+    EvaluatorEnvironment& environment, InternedString referenceToResolve)
 {
 	ObjectReferencePoolMap::iterator referencePoolIt =
 	    environment.referencePools.find(referenceToResolve);
@@ -790,14 +904,15 @@ static std::vector<ObjectReference>* GetReferenceListFromReference(EvaluatorEnvi
 // Once a definition is known, references to it can be re-evaluated to splice in the appropriate
 // code. Returns the number of references resolved
 static int ReevaluateResolveReferences(EvaluatorEnvironment& environment,
-                                       const char* referenceToResolve, bool warnIfNoReferences,
-                                       int& numErrorsOut)
+                                       InternedString referenceToResolveId,
+                                       bool warnIfNoReferences, int& numErrorsOut)
 {
 	int numReferencesResolved = 0;
+	const char* referenceToResolve = internedStringGet(referenceToResolveId);
 
 	// Resolve references
 	std::vector<ObjectReference>* references =
-	    GetReferenceListFromReference(environment, referenceToResolve);
+	    GetReferenceListFromReference(environment, referenceToResolveId);
 	if (!references)
 	{
 		if (warnIfNoReferences)
@@ -850,17 +965,12 @@ static int ReevaluateResolveReferences(EvaluatorEnvironment& environment,
 			referenceValidPreEval->context.resolvingReference =
 			    &(*referenceValidPreEval->tokens)[referenceValidPreEval->startIndex + 1];
 
-			size_t referencePoolSizePreEval = environment.referencePools.size();
+			// Evaluation can add references to this pool, moving the list's elements. The list
+			// itself stays put, because reference pools never move
 			int result = EvaluateGenerate_Recursive(
 			    environment, referenceValidPreEval->context, *referenceValidPreEval->tokens,
 			    referenceValidPreEval->startIndex, *referenceValidPreEval->spliceOutput);
 			referenceValidPreEval = nullptr;
-			// We must now re-look up the reference pool and reference list if there's a chance the
-			// memory has been moved due to evaluation adding new references.
-			// As an optimization, only do this if the pool size changed, which should be the only
-			// case where the memory could have been moved.
-			if (environment.referencePools.size() != referencePoolSizePreEval)
-				references = GetReferenceListFromReference(environment, referenceToResolve);
 			hasErrors |= result > 0;
 			numErrorsOut += result;
 		}
@@ -963,15 +1073,18 @@ bool ComptimePrepareHeaders(EvaluatorEnvironment& environment)
 
 	// Can we use the cached version?
 	if (!cppFileNeedsBuild(environment, combinedHeaderRelativePath, precompiledHeaderFilename,
-	                       buildArguments, environment.comptimeCachedCommandCrcs,
+	                       /*builtFilename=*/nullptr, buildArguments,
+	                       environment.comptimeCachedCommandCrcs,
 	                       environment.comptimeNewCommandCrcs,
-	                       environment.comptimeHeaderModifiedCache, headerSearchDirectories))
+	                       environment.comptimeHeaderModifiedCache, headerSearchDirectories,
+	                       /*dependencyFilename=*/nullptr))
 	{
 		if (logging.buildProcess)
 			Logf("No need to update precompiled header %s\n", precompiledHeaderFilename);
 
 		environment.comptimeHeadersPrepared = true;
 		environment.comptimeCombinedHeaderFilename = combinedHeaderName;
+		environment.comptimePrecompiledHeaderFilename = precompiledHeaderFilename;
 		free(buildArguments);
 		return true;
 	}
@@ -998,6 +1111,7 @@ bool ComptimePrepareHeaders(EvaluatorEnvironment& environment)
 	{
 		environment.comptimeHeadersPrepared = true;
 		environment.comptimeCombinedHeaderFilename = combinedHeaderName;
+		environment.comptimePrecompiledHeaderFilename = precompiledHeaderFilename;
 		setSourceArtifactCrc(environment, combinedHeaderRelativePath, precompiledHeaderFilename);
 		return true;
 	}
@@ -1007,11 +1121,356 @@ bool ComptimePrepareHeaders(EvaluatorEnvironment& environment)
 	return false;
 }
 
+// The command to compile a single compile-time translation unit. The arguments point into this
+// struct, so it must stay around until the process is started
+struct ComptimeCompileCommand
+{
+	char headerInclude[MAX_PATH_LENGTH];
+	char buildObjectArgument[MAX_PATH_LENGTH];
+	char debugSymbolsName[MAX_PATH_LENGTH];
+	char debugSymbolsArgument[MAX_PATH_LENGTH];
+	char dependencyFilename[MAX_PATH_LENGTH];
+	const char** arguments;
+};
+
+static void MakeComptimeDependencyFilename(char* bufferOut, int bufferSize,
+                                           const char* artifactsName)
+{
+	SafeSnprintf(bufferOut, bufferSize, "%s/%s.d", cakelispWorkingDir, artifactsName);
+}
+
+static void MakeComptimeLibraryPath(char* bufferOut, int bufferSize, const char* artifactsName)
+{
+	SafeSnprintf(bufferOut, bufferSize, "%s/%s%s.%s", cakelispWorkingDir,
+	             linkerDynamicLibraryPrefix, artifactsName, linkerDynamicLibraryExtension);
+}
+
+// Record which batch library a definition's library was built into, or that it has its own again
+// if batchArtifactsName is empty. A batch library no definition is in any more is removed
+static void SetComptimeBatch(EvaluatorEnvironment& environment, const std::string& libraryPath,
+                             const std::string& batchArtifactsName)
+{
+	std::string previousBatchArtifactsName;
+	ComptimeBatchTable::iterator findIt = environment.comptimeBatches.find(libraryPath);
+	if (findIt != environment.comptimeBatches.end())
+	{
+		previousBatchArtifactsName = findIt->second;
+		if (batchArtifactsName.empty())
+			environment.comptimeBatches.erase(findIt);
+	}
+	else if (batchArtifactsName.empty())
+		return;
+
+	if (!batchArtifactsName.empty())
+		environment.comptimeBatches[libraryPath] = batchArtifactsName;
+	environment.changedComptimeBatches[libraryPath] = batchArtifactsName;
+
+	if (previousBatchArtifactsName.empty() || previousBatchArtifactsName == batchArtifactsName)
+		return;
+	for (const ComptimeBatchTablePair& batchPair : environment.comptimeBatches)
+	{
+		if (batchPair.second == previousBatchArtifactsName)
+			return;
+	}
+
+	char previousBatchLibraryPath[MAX_PATH_LENGTH] = {0};
+	MakeComptimeLibraryPath(previousBatchLibraryPath, sizeof(previousBatchLibraryPath),
+	                        previousBatchArtifactsName.c_str());
+	if (logging.buildProcess)
+		Logf("Removing %s, which no definition is built into any more\n",
+		     previousBatchLibraryPath);
+	if (fileExists(previousBatchLibraryPath))
+		remove(previousBatchLibraryPath);
+}
+
+static bool MakeComptimeCompileCommand(EvaluatorEnvironment& environment,
+                                       const char* compileTimeBuildExecutable,
+                                       const char* sourceOutputName, const char* buildObjectName,
+                                       const char* artifactsName,
+                                       const char* precompiledHeadersInclude,
+                                       std::vector<const char*>& precompiledHeadersToInclude,
+                                       ComptimeCompileCommand& commandOut)
+{
+	makeIncludeArgument(commandOut.headerInclude, sizeof(commandOut.headerInclude),
+	                    environment.cakelispSrcDir.c_str());
+
+	makeObjectOutputArgument(commandOut.buildObjectArgument,
+	                         sizeof(commandOut.buildObjectArgument), buildObjectName);
+
+	PrintfBuffer(commandOut.debugSymbolsName, "%s/%s.%s", cakelispWorkingDir, artifactsName,
+	             compilerDebugSymbolsExtension);
+	makeDebugSymbolsOutputArgument(commandOut.debugSymbolsArgument,
+	                               sizeof(commandOut.debugSymbolsArgument),
+	                               commandOut.debugSymbolsName);
+
+	MakeComptimeDependencyFilename(commandOut.dependencyFilename,
+	                               sizeof(commandOut.dependencyFilename), artifactsName);
+	std::vector<const char*> dependencyFileArguments;
+	if (environment.useCompilerDependencyFiles)
+		makeDependencyFileArguments(environment.compileTimeBuildCommand.fileToExecute.c_str(),
+		                            commandOut.dependencyFilename, dependencyFileArguments);
+
+	ProcessCommandInput compileTimeInputs[] = {
+	    {ProcessCommandArgumentType_SourceInput, {sourceOutputName}},
+	    {ProcessCommandArgumentType_ObjectOutput, {commandOut.buildObjectArgument}},
+	    {ProcessCommandArgumentType_DebugSymbolsOutput, {commandOut.debugSymbolsArgument}},
+	    {ProcessCommandArgumentType_DependencyFileOutput, dependencyFileArguments},
+	    {ProcessCommandArgumentType_CakelispHeadersInclude,
+	     {commandOut.headerInclude, precompiledHeadersInclude}},
+	    {ProcessCommandArgumentType_PrecompiledHeaderInclude, precompiledHeadersToInclude}};
+	commandOut.arguments = MakeProcessArgumentsFromCommand(
+	    compileTimeBuildExecutable, environment.compileTimeBuildCommand.arguments,
+	    compileTimeInputs, ArraySize(compileTimeInputs));
+	return commandOut.arguments != nullptr;
+}
+
+// Frees the command's arguments. Returns the result of runProcess()
+static int RunComptimeCompileCommand(const char* compileTimeBuildExecutable,
+                                     ComptimeCompileCommand& command, int* statusOut)
+{
+	// Annoying Windows workaround: delete PDB to fix fatal error C1052
+	// Technically we only need to do this for /DEBUG:fastlink
+	if (command.debugSymbolsArgument[0] && fileExists(command.debugSymbolsName))
+		remove(command.debugSymbolsName);
+
+	// A dependency file left over from an earlier compile must not be mistaken for this one's
+	if (fileExists(command.dependencyFilename))
+		remove(command.dependencyFilename);
+
+	RunProcessArguments compileArguments = {};
+	compileArguments.fileToExecute = compileTimeBuildExecutable;
+	compileArguments.arguments = command.arguments;
+	int result = runProcess(compileArguments, statusOut);
+	if (result == 0)
+		++g_buildCounts.numComptimeCompiles;
+	free(command.arguments);
+	command.arguments = nullptr;
+	return result;
+}
+
+// Returns whether the linker was started
+static bool RunComptimeLinkCommand(EvaluatorEnvironment& environment,
+                                   const ObjectDefinition& blameDefinition,
+                                   const char* buildObjectName, const char* dynamicLibraryPath,
+                                   const std::vector<std::string>& comptimeImportLibraries,
+                                   int* statusOut, int& numErrorsOut)
+{
+	std::vector<std::string> importLibraryPaths;
+	std::vector<std::string> importLibraries;
+	// Need to be able to find imported dll import libraries
+	importLibraryPaths.push_back(cakelispWorkingDir);
+	PushBackAll(importLibraries, comptimeImportLibraries);
+	if (environment.isMsvcCompiler)
+	{
+		if (environment.cakelispLibDir.empty())
+		{
+			ErrorAtTokenf(*blameDefinition.definitionInvocation,
+			              "cannot link definition '%s' because cakelisp-lib-dir is not set. "
+			              "Set it with e.g.:\n"
+			              "\t(set-cakelisp-option cakelisp-lib-dir \"Dependencies/cakelisp/bin\")",
+			              blameDefinition.name.c_str());
+			++numErrorsOut;
+			return false;
+		}
+		importLibraryPaths.push_back(environment.cakelispLibDir);
+		importLibraries.push_back("cakelisp.lib");
+	}
+
+	std::vector<const char*> importLibraryPathsArgs;
+	std::vector<const char*> importLibrariesArgs;
+	BuildArgumentConverter convertedArguments[] = {
+	    {&importLibraryPaths, {}, &importLibraryPathsArgs, makeImportLibraryPathArgument},
+	    {&importLibraries, {}, &importLibrariesArgs, nullptr}};
+	convertBuildArguments(convertedArguments, ArraySize(convertedArguments),
+	                      environment.compileTimeLinkCommand.fileToExecute.c_str());
+
+	char dynamicLibraryOutArgument[MAX_PATH_LENGTH] = {0};
+	makeDynamicLibraryOutputArgument(dynamicLibraryOutArgument, sizeof(dynamicLibraryOutArgument),
+	                                 dynamicLibraryPath,
+	                                 environment.compileTimeLinkCommand.fileToExecute.c_str());
+
+	char compileTimeLinkExecutable[MAX_PATH_LENGTH] = {0};
+	if (!resolveExecutablePath(environment.compileTimeLinkCommand.fileToExecute.c_str(),
+	                           compileTimeLinkExecutable, sizeof(compileTimeLinkExecutable)))
+		return false;
+
+	ProcessCommandInput linkTimeInputs[] = {
+	    {ProcessCommandArgumentType_DynamicLibraryOutput, {dynamicLibraryOutArgument}},
+	    {ProcessCommandArgumentType_ObjectInput, {buildObjectName}},
+	    {ProcessCommandArgumentType_ImportLibraryPaths, importLibraryPathsArgs},
+	    {ProcessCommandArgumentType_ImportLibraries, importLibrariesArgs}};
+	const char** linkArgumentList = MakeProcessArgumentsFromCommand(
+	    compileTimeLinkExecutable, environment.compileTimeLinkCommand.arguments, linkTimeInputs,
+	    ArraySize(linkTimeInputs));
+	if (!linkArgumentList)
+		return false;
+
+	RunProcessArguments linkArguments = {};
+	linkArguments.fileToExecute = compileTimeLinkExecutable;
+	linkArguments.arguments = linkArgumentList;
+	int result = runProcess(linkArguments, statusOut);
+	free(linkArgumentList);
+	return result == 0;
+}
+
+// The definition was just loaded. Anything which was only waiting on it joins the build
+static void QueueReadyDependents(EvaluatorEnvironment& environment, ComptimeBuildQueue& buildQueue,
+                                 const ObjectDefinition& loadedDefinition)
+{
+	ObjectReferencePoolMap::iterator findPool =
+	    environment.referencePools.find(loadedDefinition.nameId);
+	if (findPool == environment.referencePools.end())
+		return;
+
+	// Resolving references may have required new definitions
+	PropagateRequiredToReferences(environment);
+
+	for (ObjectReferenceStatus* referenceStatus : findPool->second.statuses)
+	{
+		ObjectDefinition* dependent = referenceStatus->owner;
+		if (!dependent->isRequired || dependent->isLoaded || dependent->forbidBuild ||
+		    !isCompileTimeObject(dependent->type))
+			continue;
+
+		bool isAlreadyQueued = false;
+		for (const ComptimeBuildObject& buildObject : buildQueue.objects)
+		{
+			if (buildObject.definition == dependent)
+			{
+				isAlreadyQueued = true;
+				break;
+			}
+		}
+		if (isAlreadyQueued)
+			continue;
+
+		bool hasAnyRefs = false;
+		if (!CheckDefinitionReadyToBuild(environment, *dependent, buildQueue.referencesToCheck,
+		                                 hasAnyRefs, buildQueue.requireDependencyPropagation))
+			continue;
+
+		if (logging.compileTimeBuildObjects)
+			Logf("Building %s now that %s is loaded\n", dependent->name.c_str(),
+			     loadedDefinition.name.c_str());
+
+		AddComptimeBuildObject(environment, *dependent, hasAnyRefs, buildQueue.objects);
+	}
+}
+
+// Load a linked object's library, add its function to the environment, and resolve the
+// references waiting on it. Returns the number of references resolved
+static int LoadComptimeBuildObject(EvaluatorEnvironment& environment,
+                                   ComptimeBuildQueue& buildQueue,
+                                   ComptimeBuildObject& buildObject, int& numErrorsOut)
+{
+	if (buildObject.status != 0)
+	{
+		ErrorAtToken(*buildObject.definition->definitionInvocation, "Failed to link definition");
+		++numErrorsOut;
+		return 0;
+	}
+
+	buildObject.stage = BuildStage_Loading;
+
+	if (logging.buildProcess)
+		Logf("Linked %s successfully\n", buildObject.definition->name.c_str());
+
+	const char* libraryPath = buildObject.dynamicLibraryPath.c_str();
+	if (!buildObject.batchLibraryPath.empty())
+		libraryPath = buildObject.batchLibraryPath.c_str();
+	else
+		SetComptimeBatch(environment, buildObject.dynamicLibraryPath, EmptyString);
+
+	setSourceArtifactCrc(environment, buildObject.sourceOutputName.c_str(), libraryPath);
+
+	DynamicLibHandle builtLib = loadDynamicLibrary(libraryPath);
+	if (!builtLib)
+	{
+		ErrorAtToken(*buildObject.definition->definitionInvocation,
+		             "Failed to load compile-time library");
+		++numErrorsOut;
+		return 0;
+	}
+
+	// We need to do name conversion to be compatible with C naming
+	// TODO: Make these come from the top
+	NameStyleSettings nameSettings;
+	char symbolNameBuffer[MAX_NAME_LENGTH] = {0};
+	lispNameStyleToCNameStyle(nameSettings.functionNameMode, buildObject.definition->name.c_str(),
+	                          symbolNameBuffer, sizeof(symbolNameBuffer),
+	                          *buildObject.definition->definitionInvocation);
+	void* compileTimeFunction = getSymbolFromDynamicLibrary(builtLib, symbolNameBuffer);
+	if (!compileTimeFunction)
+	{
+		ErrorAtToken(*buildObject.definition->definitionInvocation,
+		             "Failed to find symbol in loaded library");
+		++numErrorsOut;
+		return 0;
+	}
+
+	// Add to environment
+	switch (buildObject.definition->type)
+	{
+		case ObjectType_CompileTimeMacro:
+			if (findMacro(environment, buildObject.definition->name.c_str()))
+				NoteAtToken(*buildObject.definition->definitionInvocation, "redefined macro");
+			environment.macros[buildObject.definition->name] = (MacroFunc)compileTimeFunction;
+			break;
+		case ObjectType_CompileTimeGenerator:
+			if (findGenerator(environment, buildObject.definition->name.c_str()))
+				NoteAtToken(*buildObject.definition->definitionInvocation, "redefined generator");
+			environment.generators[buildObject.definition->name] =
+			    (GeneratorFunc)compileTimeFunction;
+			break;
+		case ObjectType_CompileTimeFunction:
+			if (findCompileTimeFunction(environment, buildObject.definition->name.c_str()))
+				NoteAtToken(*buildObject.definition->definitionInvocation, "redefined function");
+			environment.compileTimeFunctions[buildObject.definition->name] =
+			    (void*)compileTimeFunction;
+			break;
+		default:
+			ErrorAtToken(*buildObject.definition->definitionInvocation,
+			             "Tried to build definition which is not compile-time object. Code error?");
+			break;
+	}
+
+	buildObject.stage = BuildStage_ResolvingReferences;
+
+	// warnIfNoReferences is only enabled if the environment didn't require this definition for some
+	// other reason. environmentRequired is the catch-all for comptime functions that aren't
+	// necessarily referenced by the user's code (e.g. comptime var destructors)
+	int numErrorsOutBefore = numErrorsOut;
+	int numReferencesResolved = ReevaluateResolveReferences(
+	    environment, buildObject.definition->nameId,
+	    /*warnIfNoReferences=*/!buildObject.definition->environmentRequired, numErrorsOut);
+
+	// This definition had errors, don't consider it finished
+	if (numErrorsOut != numErrorsOutBefore)
+		return numReferencesResolved;
+
+	if (logging.buildProcess)
+		Logf("Resolved %d references\n", numReferencesResolved);
+
+	// Remove need to build
+	buildObject.definition->isLoaded = true;
+
+	buildObject.stage = BuildStage_Finished;
+
+	if (logging.buildProcess)
+		Logf("Successfully built, loaded, and executed %s\n", buildObject.definition->name.c_str());
+
+	// Once something has failed, let what is already building finish without adding to it
+	if (!numErrorsOut)
+		QueueReadyDependents(environment, buildQueue, *buildObject.definition);
+
+	return numReferencesResolved;
+}
+
 int BuildExecuteCompileTimeFunctions(EvaluatorEnvironment& environment,
-                                     std::vector<ComptimeBuildObject>& definitionsToBuild,
-                                     int& numErrorsOut)
+                                     ComptimeBuildQueue& buildQueue, int& numErrorsOut)
 {
 	int numReferencesResolved = 0;
+	std::deque<ComptimeBuildObject>& definitionsToBuild = buildQueue.objects;
 
 	if (environment.cakelispSrcDir.empty() && !definitionsToBuild.empty())
 	{
@@ -1050,6 +1509,11 @@ int BuildExecuteCompileTimeFunctions(EvaluatorEnvironment& environment,
 	                                        environment.comptimeHeadersPrepared &&
 	                                        !environment.comptimeCombinedHeaderFilename.empty();
 	const char* cakelispCombinedHeaderFilename = nullptr;
+	// Compilers don't report the headers inside the precompiled header, but it is rebuilt whenever
+	// they change, so it stands in for them
+	const char* precompiledHeaderDependency =
+	    comptimeCanUsePrecompiledHeaders ? environment.comptimePrecompiledHeaderFilename.c_str() :
+	                                       nullptr;
 	char usePrecompiledHeaderArgument[MAX_PATH_LENGTH] = {0};
 	std::vector<std::string> precompiledHeadersToIncludeStorage;
 	std::vector<const char*> precompiledHeadersToInclude;
@@ -1073,464 +1537,773 @@ int BuildExecuteCompileTimeFunctions(EvaluatorEnvironment& environment,
 	makeIncludeArgument(precompiledHeadersInclude, sizeof(precompiledHeadersInclude),
 	                    cakelispWorkingDir);
 
-	// Spin up as many compile processes as necessary
-	// TODO: Combine sure-thing builds into batches (ones where we know all references)
-	// TODO: Make pipeline able to start e.g. linker while other objects are still compiling
-	// NOTE: definitionsToBuild must not be resized from when runProcess() is called until
-	// waitForAllProcessesClosed(), else the status pointer could be invalidated
-	int currentNumProcessesSpawned = 0;
-	for (ComptimeBuildObject& buildObject : definitionsToBuild)
-	{
-		ObjectDefinition* definition = buildObject.definition;
-
-		if (logging.buildProcess)
-			Logf("Build %s\n", definition->name.c_str());
-
-		if (!definition->output)
-		{
-			ErrorAtToken(*buildObject.definition->definitionInvocation,
-			             "missing compile-time output. Internal code error?");
-			continue;
-		}
-
-		char convertedNameBuffer[MAX_NAME_LENGTH] = {0};
-		lispNameStyleToCNameStyle(NameStyleMode_Underscores, definition->name.c_str(),
-		                          convertedNameBuffer, sizeof(convertedNameBuffer),
-		                          *definition->definitionInvocation);
-		char artifactsName[MAX_PATH_LENGTH] = {0};
-		// Various stages will append the appropriate file extension
-		PrintfBuffer(artifactsName, "comptime_%s", convertedNameBuffer);
-		buildObject.artifactsName = artifactsName;
-		char fileOutputName[MAX_PATH_LENGTH] = {0};
-		// Writer will append the appropriate file extensions
-		PrintfBuffer(fileOutputName, "%s/%s", cakelispWorkingDir,
-		             buildObject.artifactsName.c_str());
-
-		// Output definition to a file our compiler will be happy with
-		// TODO: Make these come from the top
-		NameStyleSettings nameSettings;
-		WriterFormatSettings formatSettings;
-		WriterOutputSettings outputSettings = {};
-
-		GeneratorOutput header;
-		GeneratorOutput footer;
-		GeneratorOutput autoIncludes;
-
-		makeCompileTimeHeaderFooter(header, footer, cakelispCombinedHeaderFilename, &autoIncludes,
-		                            definition->definitionInvocation);
-		outputSettings.heading = &header;
-		outputSettings.footer = &footer;
-
-		// Add referenced compile-time function headers and import libraries
-		bool foundRequiredComptimeFunctions = true;
-		for (ObjectReferenceStatusPair& reference : definition->references)
+	std::vector<ComptimeBuildObject*> objectsToCompile;
+	std::vector<ComptimeBuildObject*> objectsToBatch;
+	// Objects which can use their cached library
+	std::vector<ComptimeBuildObject*> objectsToLoad;
+	std::vector<ComptimeBuildBatch> batches;
+	bool areBatchesPrepared = false;
+	size_t numObjectsPrepared = 0;
+
+	// Each object and batch moves on from compiling to linking to loading as soon as its own
+	// process finishes. Libraries are loaded and references resolved while other processes run.
+	// Loading may make other definitions ready, which then join the build
+	std::vector<int*> runningProcessStatuses;
+	size_t nextBatchToCompile = 0;
+	size_t nextObjectToCompile = 0;
+	while (true)
+	{
+		// Write out each definition added since last time, and find which ones can use their cached
+		// library
+		bool failedToPrepare = false;
+		for (; numObjectsPrepared < definitionsToBuild.size(); ++numObjectsPrepared)
 		{
-			ObjectReferenceStatus& referenceStatus = reference.second;
+			ComptimeBuildObject& buildObject = definitionsToBuild[numObjectsPrepared];
+			ObjectDefinition* definition = buildObject.definition;
 
-			ObjectDefinitionMap::iterator findIt =
-			    environment.definitions.find(referenceStatus.name->contents);
-			// Ignore unknown references, because we only care about already-loaded compile-time
-			// functions in this case
-			if (findIt == environment.definitions.end())
-				continue;
-
-			ObjectDefinition* requiredDefinition = &findIt->second;
-			// It's not really possible to invoke macros or generators because the evaluator will
-			// expand them on the spot (while evaluating this definition's body)
-			if (requiredDefinition->type != ObjectType_CompileTimeFunction)
-				continue;
+			if (logging.buildProcess)
+				Logf("Build %s\n", definition->name.c_str());
 
-			if (requiredDefinition->compileTimeHeaderName.empty())
+			if (!definition->output)
 			{
-				ErrorAtToken(*referenceStatus.name,
-				             "could not find generated header for referenced compile-time "
-				             "function. Internal code error?\n");
-				foundRequiredComptimeFunctions = false;
+				ErrorAtToken(*buildObject.definition->definitionInvocation,
+				             "missing compile-time output. Internal code error?");
 				continue;
 			}
 
-			addStringOutput(autoIncludes.source, "#include", StringOutMod_SpaceAfter,
-			                referenceStatus.name);
-			addStringOutput(autoIncludes.source, requiredDefinition->compileTimeHeaderName.c_str(),
-			                StringOutMod_SurroundWithQuotes, referenceStatus.name);
-			addLangTokenOutput(autoIncludes.source, StringOutMod_NewlineAfter,
-			                   referenceStatus.name);
-
-			if (environment.isMsvcCompiler)
+			char convertedNameBuffer[MAX_NAME_LENGTH] = {0};
+			lispNameStyleToCNameStyle(NameStyleMode_Underscores, definition->name.c_str(),
+			                          convertedNameBuffer, sizeof(convertedNameBuffer),
+			                          *definition->definitionInvocation);
+			char artifactsName[MAX_PATH_LENGTH] = {0};
+			// Various stages will append the appropriate file extension
+			PrintfBuffer(artifactsName, "comptime_%s", convertedNameBuffer);
+			buildObject.artifactsName = artifactsName;
+			char fileOutputName[MAX_PATH_LENGTH] = {0};
+			// Writer will append the appropriate file extensions
+			PrintfBuffer(fileOutputName, "%s/%s", cakelispWorkingDir,
+			             buildObject.artifactsName.c_str());
+
+			// Output definition to a file our compiler will be happy with
+			// TODO: Make these come from the top
+			NameStyleSettings nameSettings;
+			WriterFormatSettings formatSettings;
+			WriterOutputSettings outputSettings = {};
+
+			GeneratorOutput header;
+			GeneratorOutput footer;
+			GeneratorOutput autoIncludes;
+
+			makeCompileTimeHeaderFooter(header, footer, cakelispCombinedHeaderFilename,
+			                            &autoIncludes, definition->definitionInvocation);
+			outputSettings.heading = &header;
+			outputSettings.footer = &footer;
+
+			// Add referenced compile-time function headers and import libraries
+			bool foundRequiredComptimeFunctions = true;
+			for (ObjectReferenceStatusPair& reference : definition->references)
 			{
-				if (requiredDefinition->compileTimeImportLibraryName.empty())
+				ObjectReferenceStatus& referenceStatus = reference.second;
+
+				ObjectDefinition* requiredDefinition = referenceStatus.definition;
+				// Ignore unknown references, because we only care about already-loaded compile-time
+				// functions in this case
+				if (!requiredDefinition)
+					continue;
+
+				// It's not really possible to invoke macros or generators because the evaluator
+				// will expand them on the spot (while evaluating this definition's body)
+				if (requiredDefinition->type != ObjectType_CompileTimeFunction)
+					continue;
+
+				if (requiredDefinition->compileTimeHeaderName.empty())
 				{
 					ErrorAtToken(*referenceStatus.name,
-					             "could not find import library name for referenced compile-time "
+					             "could not find generated header for referenced compile-time "
 					             "function. Internal code error?\n");
 					foundRequiredComptimeFunctions = false;
 					continue;
 				}
 
-				buildObject.importLibraries.push_back(
-				    requiredDefinition->compileTimeImportLibraryName);
+				addStringOutput(autoIncludes.source, "#include", StringOutMod_SpaceAfter,
+				                referenceStatus.name);
+				addStringOutput(autoIncludes.source,
+				                requiredDefinition->compileTimeHeaderName.c_str(),
+				                StringOutMod_SurroundWithQuotes, referenceStatus.name);
+				addLangTokenOutput(autoIncludes.source, StringOutMod_NewlineAfter,
+				                   referenceStatus.name);
+
+				if (environment.isMsvcCompiler)
+				{
+					if (requiredDefinition->compileTimeImportLibraryName.empty())
+					{
+						ErrorAtToken(*referenceStatus.name,
+						             "could not find import library name for referenced "
+						             "compile-time function. Internal code error?\n");
+						foundRequiredComptimeFunctions = false;
+						continue;
+					}
+
+					buildObject.importLibraries.push_back(
+					    requiredDefinition->compileTimeImportLibraryName);
+				}
 			}
-		}
-		// Skip the object: Not all required definitions had headers (will error)
-		if (!foundRequiredComptimeFunctions)
-			continue;
+			// Skip the object: Not all required definitions had headers (will error)
+			if (!foundRequiredComptimeFunctions)
+				continue;
 
-		outputSettings.sourceCakelispFilename = fileOutputName;
-		{
-			char writerSourceOutputName[MAX_PATH_LENGTH] = {0};
-			PrintfBuffer(writerSourceOutputName, "%s.cpp", fileOutputName);
-			char writerHeaderOutputName[MAX_PATH_LENGTH] = {0};
-			PrintfBuffer(writerHeaderOutputName, "%s.hpp", fileOutputName);
-			outputSettings.sourceOutputName = writerSourceOutputName;
-			outputSettings.headerOutputName = writerHeaderOutputName;
-
-			// Facilitates this function being used later by other compile-time functions
-			char localHeaderOutputName[MAX_PATH_LENGTH] = {0};
-			PrintfBuffer(localHeaderOutputName, "%s.hpp", artifactsName);
-			definition->compileTimeHeaderName = localHeaderOutputName;
-		}
-		// Use the separate output prepared specifically for this compile-time object
-		if (!writeGeneratorOutput(*definition->output, nameSettings, formatSettings,
-		                          outputSettings))
-		{
-			ErrorAtToken(*definition->definitionInvocation,
-			             "Failed to write to compile-time source file");
-			continue;
-		}
+			outputSettings.sourceCakelispFilename = fileOutputName;
+			{
+				char writerSourceOutputName[MAX_PATH_LENGTH] = {0};
+				PrintfBuffer(writerSourceOutputName, "%s.cpp", fileOutputName);
+				char writerHeaderOutputName[MAX_PATH_LENGTH] = {0};
+				PrintfBuffer(writerHeaderOutputName, "%s.hpp", fileOutputName);
+				outputSettings.sourceOutputName = writerSourceOutputName;
+				outputSettings.headerOutputName = writerHeaderOutputName;
+
+				// Facilitates this function being used later by other compile-time functions
+				char localHeaderOutputName[MAX_PATH_LENGTH] = {0};
+				PrintfBuffer(localHeaderOutputName, "%s.hpp", artifactsName);
+				definition->compileTimeHeaderName = localHeaderOutputName;
+			}
+			// Use the separate output prepared specifically for this compile-time object
+			if (!writeGeneratorOutput(*definition->output, nameSettings, formatSettings,
+			                          outputSettings))
+			{
+				ErrorAtToken(*definition->definitionInvocation,
+				             "Failed to write to compile-time source file");
+				continue;
+			}
 
-		buildObject.stage = BuildStage_Compiling;
+			buildObject.stage = BuildStage_Compiling;
 
-		// The evaluator is written in C++, so all generators and macros need to support the C++
-		// features used (e.g. their signatures have std::vector<>)
-		char sourceOutputName[MAX_PATH_LENGTH] = {0};
-		PrintfBuffer(sourceOutputName, "%s/%s.cpp", cakelispWorkingDir,
-		             buildObject.artifactsName.c_str());
-		buildObject.sourceOutputName = sourceOutputName;
+			// The evaluator is written in C++, so all generators and macros need to support the C++
+			// features used (e.g. their signatures have std::vector<>)
+			char sourceOutputName[MAX_PATH_LENGTH] = {0};
+			PrintfBuffer(sourceOutputName, "%s/%s.cpp", cakelispWorkingDir,
+			             buildObject.artifactsName.c_str());
+			buildObject.sourceOutputName = sourceOutputName;
 
-		char buildObjectName[MAX_PATH_LENGTH] = {0};
-		PrintfBuffer(buildObjectName, "%s/%s.%s", cakelispWorkingDir,
-		             buildObject.artifactsName.c_str(), compilerObjectExtension);
-		buildObject.buildObjectName = buildObjectName;
+			char buildObjectName[MAX_PATH_LENGTH] = {0};
+			PrintfBuffer(buildObjectName, "%s/%s.%s", cakelispWorkingDir,
+			             buildObject.artifactsName.c_str(), compilerObjectExtension);
+			buildObject.buildObjectName = buildObjectName;
 
-		char dynamicLibraryOut[MAX_PATH_LENGTH] = {0};
-		PrintfBuffer(dynamicLibraryOut, "%s/%s%s.%s", cakelispWorkingDir,
-		             linkerDynamicLibraryPrefix, buildObject.artifactsName.c_str(),
-		             linkerDynamicLibraryExtension);
-		buildObject.dynamicLibraryPath = dynamicLibraryOut;
+			char dynamicLibraryOut[MAX_PATH_LENGTH] = {0};
+			PrintfBuffer(dynamicLibraryOut, "%s/%s%s.%s", cakelispWorkingDir,
+			             linkerDynamicLibraryPrefix, buildObject.artifactsName.c_str(),
+			             linkerDynamicLibraryExtension);
+			buildObject.dynamicLibraryPath = dynamicLibraryOut;
 
-		// Save our import library name for other functions to use
-		if (environment.isMsvcCompiler && definition->type == ObjectType_CompileTimeFunction)
-		{
-			char importLibraryName[MAX_PATH_LENGTH] = {0};
-			PrintfBuffer(importLibraryName, "%s.%s", buildObject.artifactsName.c_str(),
-			             compilerImportLibraryExtension);
-			definition->compileTimeImportLibraryName = importLibraryName;
-		}
+			// Save our import library name for other functions to use
+			if (environment.isMsvcCompiler && definition->type == ObjectType_CompileTimeFunction)
+			{
+				char importLibraryName[MAX_PATH_LENGTH] = {0};
+				PrintfBuffer(importLibraryName, "%s.%s", buildObject.artifactsName.c_str(),
+				             compilerImportLibraryExtension);
+				definition->compileTimeImportLibraryName = importLibraryName;
+			}
 
-		char headerInclude[MAX_PATH_LENGTH] = {0};
-		makeIncludeArgument(headerInclude, sizeof(headerInclude),
-		                    environment.cakelispSrcDir.c_str());
+			ComptimeCompileCommand compileCommand;
+			if (!MakeComptimeCompileCommand(environment, compileTimeBuildExecutable,
+			                                sourceOutputName, buildObject.buildObjectName.c_str(),
+			                                buildObject.artifactsName.c_str(),
+			                                precompiledHeadersInclude, precompiledHeadersToInclude,
+			                                compileCommand))
+			{
+				++numErrorsOut;
+				failedToPrepare = true;
+				break;
+			}
+
+			// Can we use the cached version?
+			{
+				std::vector<std::string> headerSearchDirectories;
+				{
+					// Need working dir to find cached file itself
+					headerSearchDirectories.push_back(".");
+					// Need Cakelisp src dir to find cakelisp headers. If these aren't checked for
+					// modification, comptime code can end up calling stale functions/initializing
+					// incorrect types
+					headerSearchDirectories.push_back(
+					    environment.cakelispSrcDir.empty() ? "src" : environment.cakelispSrcDir);
+				}
+
+				// A definition last built in a batch is checked against the batch's library and
+				// dependencies, but keeps its own command and source CRCs
+				char batchLibraryPath[MAX_PATH_LENGTH] = {0};
+				char batchDependencyFilename[MAX_PATH_LENGTH] = {0};
+				ComptimeBatchTable::iterator findBatch =
+				    environment.comptimeBatches.find(buildObject.dynamicLibraryPath);
+				if (findBatch != environment.comptimeBatches.end())
+				{
+					MakeComptimeLibraryPath(batchLibraryPath, sizeof(batchLibraryPath),
+					                        findBatch->second.c_str());
+					MakeComptimeDependencyFilename(batchDependencyFilename,
+					                               sizeof(batchDependencyFilename),
+					                               findBatch->second.c_str());
+				}
+
+				if (!cppFileNeedsBuild(
+				        environment, sourceOutputName, buildObject.dynamicLibraryPath.c_str(),
+				        batchLibraryPath[0] ? batchLibraryPath : nullptr, compileCommand.arguments,
+				        environment.comptimeCachedCommandCrcs, environment.comptimeNewCommandCrcs,
+				        environment.comptimeHeaderModifiedCache, headerSearchDirectories,
+				        batchDependencyFilename[0] ? batchDependencyFilename :
+				                                     compileCommand.dependencyFilename))
+				{
+					if (batchLibraryPath[0])
+						buildObject.batchLibraryPath = batchLibraryPath;
+					if (logging.buildProcess)
+						Logf("Skipping compiling %s (using cached library)\n", sourceOutputName);
+					// Skip straight to linking, which immediately becomes loading
+					buildObject.stage = BuildStage_Linking;
+					buildObject.status = 0;
+					objectsToLoad.push_back(&buildObject);
+					free(compileCommand.arguments);
+					continue;
+				}
+			}
 
-		char buildObjectArgument[MAX_PATH_LENGTH] = {0};
-		makeObjectOutputArgument(buildObjectArgument, sizeof(buildObjectArgument),
-		                         buildObject.buildObjectName.c_str());
-
-		char debugSymbolsName[MAX_PATH_LENGTH] = {0};
-		PrintfBuffer(debugSymbolsName, "%s/%s.%s", cakelispWorkingDir,
-		             buildObject.artifactsName.c_str(), compilerDebugSymbolsExtension);
-		char debugSymbolsArgument[MAX_PATH_LENGTH] = {0};
-		makeDebugSymbolsOutputArgument(debugSymbolsArgument, sizeof(debugSymbolsArgument),
-		                               debugSymbolsName);
-
-		ProcessCommandInput compileTimeInputs[] = {
-		    {ProcessCommandArgumentType_SourceInput, {sourceOutputName}},
-		    {ProcessCommandArgumentType_ObjectOutput, {buildObjectArgument}},
-		    {ProcessCommandArgumentType_DebugSymbolsOutput, {debugSymbolsArgument}},
-		    {ProcessCommandArgumentType_CakelispHeadersInclude,
-		     {headerInclude, precompiledHeadersInclude}},
-		    {ProcessCommandArgumentType_PrecompiledHeaderInclude, precompiledHeadersToInclude}};
-		const char** buildArguments = MakeProcessArgumentsFromCommand(
-		    compileTimeBuildExecutable, environment.compileTimeBuildCommand.arguments,
-		    compileTimeInputs, ArraySize(compileTimeInputs));
-		if (!buildArguments)
+			free(compileCommand.arguments);
+
+			// Macros and generators are only called through the symbol looked up in the library
+			// they were loaded from, so they can share one. Compile-time functions keep their own,
+			// because other compile-time code links to them by name: the libraries are loaded
+			// globally, so a batch with a stale build of a function could interpose the current
+			// one. Definitions which become ready later join one at a time, so they aren't batched
+			if (environment.comptimeBatchBuilds && !areBatchesPrepared &&
+			    (definition->type == ObjectType_CompileTimeMacro ||
+			     definition->type == ObjectType_CompileTimeGenerator))
+				objectsToBatch.push_back(&buildObject);
+			else
+				objectsToCompile.push_back(&buildObject);
+		}
+
+		if (failedToPrepare)
 		{
-			++numErrorsOut;
-			return 0;
+			// The processes write to objects which are about to go away
+			waitForAllProcessesClosed(OnCompileProcessOutput);
+			return numReferencesResolved;
 		}
 
-		// Can we use the cached version?
+		if (!areBatchesPrepared)
 		{
-			std::vector<std::string> headerSearchDirectories;
+			areBatchesPrepared = true;
+
+			// Batch the macros and generators which need building into a few translation units,
+			// one per core at most. Each definition still has its own source file and cached
+			// library, so editing one does not cause the others to rebuild
+			if (objectsToBatch.size() > 1)
 			{
-				// Need working dir to find cached file itself
-				headerSearchDirectories.push_back(".");
-				// Need Cakelisp src dir to find cakelisp headers. If these aren't checked for
-				// modification, comptime code can end up calling stale functions/initializing
-				// incorrect types
-				headerSearchDirectories.push_back(
-				    environment.cakelispSrcDir.empty() ? "src" : environment.cakelispSrcDir);
+				// Fewer definitions than this per batch would leave cores idle for no gain
+				const int minDefinitionsPerBatch = 4;
+				int numObjectsToBatch = (int)objectsToBatch.size();
+				int numBatches =
+				    (numObjectsToBatch + minDefinitionsPerBatch - 1) / minDefinitionsPerBatch;
+				if (numBatches > maxProcessesRecommendedSpawned)
+					numBatches = maxProcessesRecommendedSpawned;
+				if (numBatches < 1)
+					numBatches = 1;
+
+				batches.resize(numBatches);
+				for (int i = 0; i < numObjectsToBatch; ++i)
+				{
+					ComptimeBuildBatch& batch = batches[i * numBatches / numObjectsToBatch];
+					objectsToBatch[i]->isBatched = true;
+					batch.members.push_back(objectsToBatch[i]);
+					for (const std::string& importLibrary : objectsToBatch[i]->importLibraries)
+					{
+						if (std::find(batch.importLibraries.begin(), batch.importLibraries.end(),
+						              importLibrary) == batch.importLibraries.end())
+							batch.importLibraries.push_back(importLibrary);
+					}
+				}
 			}
+			else
+				PushBackAll(objectsToCompile, objectsToBatch);
 
-			if (!cppFileNeedsBuild(
-			        environment, sourceOutputName, buildObject.dynamicLibraryPath.c_str(),
-			        buildArguments, environment.comptimeCachedCommandCrcs,
-			        environment.comptimeNewCommandCrcs, environment.comptimeHeaderModifiedCache,
-			        headerSearchDirectories))
+			for (ComptimeBuildBatch& batch : batches)
 			{
+				// Loading a library path a second time returns the library already loaded, so
+				// batches are named after their members' code. The same definitions built
+				// again unchanged reuse the name, and any change gets a new one
+				uint32_t membersCrc = 0;
+				for (ComptimeBuildObject* member : batch.members)
+				{
+					uint32_t sourceCrc = getFileCrc32(member->sourceOutputName.c_str());
+					crc32(member->artifactsName.c_str(), member->artifactsName.size(),
+					      &membersCrc);
+					crc32(&sourceCrc, sizeof(sourceCrc), &membersCrc);
+				}
+
+				char artifactsName[MAX_PATH_LENGTH] = {0};
+				PrintfBuffer(artifactsName, "comptime_batch_%08x", membersCrc);
+				batch.artifactsName = artifactsName;
+
+				char sourceOutputName[MAX_PATH_LENGTH] = {0};
+				PrintfBuffer(sourceOutputName, "%s/%s.cpp", cakelispWorkingDir, artifactsName);
+				batch.sourceOutputName = sourceOutputName;
+
+				char buildObjectName[MAX_PATH_LENGTH] = {0};
+				PrintfBuffer(buildObjectName, "%s/%s.%s", cakelispWorkingDir, artifactsName,
+				             compilerObjectExtension);
+				batch.buildObjectName = buildObjectName;
+
+				char dynamicLibraryOut[MAX_PATH_LENGTH] = {0};
+				MakeComptimeLibraryPath(dynamicLibraryOut, sizeof(dynamicLibraryOut),
+				                        artifactsName);
+				batch.dynamicLibraryPath = dynamicLibraryOut;
+
+				std::vector<std::string> memberSourceNamesStorage;
+				std::vector<const char*> memberSourceNames;
+				memberSourceNamesStorage.reserve(batch.members.size());
+				memberSourceNames.reserve(batch.members.size());
+				for (ComptimeBuildObject* member : batch.members)
+				{
+					memberSourceNamesStorage.push_back(member->artifactsName + ".cpp");
+					memberSourceNames.push_back(memberSourceNamesStorage.back().c_str());
+				}
+
 				if (logging.buildProcess)
-					Logf("Skipping compiling %s (using cached library)\n", sourceOutputName);
-				// Skip straight to linking, which immediately becomes loading
-				buildObject.stage = BuildStage_Linking;
-				buildObject.status = 0;
-				free(buildArguments);
-				continue;
+					Logf("Batching %d definitions into %s\n", (int)batch.members.size(),
+					     sourceOutputName);
+
+				// The batch only #includes each definition's source file
+				if (!writeCombinedHeader(sourceOutputName, memberSourceNames))
+					batch.status = 1;
 			}
 		}
 
-		// Annoying Windows workaround: delete PDB to fix fatal error C1052
-		// Technically we only need to do this for /DEBUG:fastlink
-		if (debugSymbolsArgument[0] && fileExists(debugSymbolsName))
-			remove(debugSymbolsName);
+		// Fill any free process slots with compiles. Links start in the slot their compile left
+		while ((int)runningProcessStatuses.size() < maxProcessesRecommendedSpawned ||
+		       runningProcessStatuses.empty())
+		{
+			if (nextBatchToCompile < batches.size())
+			{
+				ComptimeBuildBatch& batch = batches[nextBatchToCompile++];
+				batch.stage = BuildStage_Compiling;
+
+				ComptimeCompileCommand compileCommand;
+				if (batch.status == -1 &&
+				    MakeComptimeCompileCommand(
+				        environment, compileTimeBuildExecutable, batch.sourceOutputName.c_str(),
+				        batch.buildObjectName.c_str(), batch.artifactsName.c_str(),
+				        precompiledHeadersInclude, precompiledHeadersToInclude, compileCommand) &&
+				    RunComptimeCompileCommand(compileTimeBuildExecutable, compileCommand,
+				                              &batch.status) == 0)
+				{
+					++g_buildCounts.numComptimeBatchCompiles;
+					runningProcessStatuses.push_back(&batch.status);
+					continue;
+				}
+
+				// Build the members on their own instead
+				for (ComptimeBuildObject* member : batch.members)
+					member->isBatched = false;
+				PushBackAll(objectsToCompile, batch.members);
+				batch.members.clear();
+			}
+			else if (nextObjectToCompile < objectsToCompile.size())
+			{
+				ComptimeBuildObject& buildObject = *objectsToCompile[nextObjectToCompile++];
+
+				ComptimeCompileCommand compileCommand;
+				if (!MakeComptimeCompileCommand(
+				        environment, compileTimeBuildExecutable,
+				        buildObject.sourceOutputName.c_str(), buildObject.buildObjectName.c_str(),
+				        buildObject.artifactsName.c_str(), precompiledHeadersInclude,
+				        precompiledHeadersToInclude, compileCommand))
+				{
+					++numErrorsOut;
+					break;
+				}
+
+				if (RunComptimeCompileCommand(compileTimeBuildExecutable, compileCommand,
+				                              &buildObject.status) != 0)
+				{
+					// TODO: Abort building if cannot invoke compiler?
+					environment.comptimeNewCommandCrcs.erase(
+					    buildObject.dynamicLibraryPath.c_str());
+					continue;
+				}
+
+				runningProcessStatuses.push_back(&buildObject.status);
+			}
+			else
+				break;
+		}
 
-		RunProcessArguments compileArguments = {};
-		compileArguments.fileToExecute = compileTimeBuildExecutable;
-		compileArguments.arguments = buildArguments;
-		if (runProcess(compileArguments, &buildObject.status) != 0)
+		// Cached objects can be loaded right away, while the first compiles run. The definitions
+		// this makes ready are prepared on the next time around
+		if (!objectsToLoad.empty())
 		{
-			// TODO: Abort building if cannot invoke compiler?
-			free(buildArguments);
-			environment.comptimeNewCommandCrcs.erase(buildObject.dynamicLibraryPath.c_str());
+			std::vector<ComptimeBuildObject*> loadingObjects;
+			loadingObjects.swap(objectsToLoad);
+			for (ComptimeBuildObject* buildObject : loadingObjects)
+				numReferencesResolved +=
+				    LoadComptimeBuildObject(environment, buildQueue, *buildObject, numErrorsOut);
 			continue;
 		}
 
-		free(buildArguments);
+		if (runningProcessStatuses.empty())
+		{
+			if (numObjectsPrepared < definitionsToBuild.size())
+				continue;
+			break;
+		}
 
-		// TODO: Move this to other processes as well
-		// TODO This could be made smarter by allowing more spawning right when a process closes,
-		// instead of starting in waves
-		++currentNumProcessesSpawned;
-		if (currentNumProcessesSpawned >= maxProcessesRecommendedSpawned)
+		std::vector<int*> closedProcessStatuses;
+		int* closedProcessStatus = waitForNextProcessClosed(OnCompileProcessOutput);
+		if (closedProcessStatus)
 		{
-			waitForAllProcessesClosed(OnCompileProcessOutput);
-			currentNumProcessesSpawned = 0;
+			closedProcessStatuses.push_back(closedProcessStatus);
+			std::vector<int*>::iterator findIt =
+			    std::find(runningProcessStatuses.begin(), runningProcessStatuses.end(),
+			              closedProcessStatus);
+			if (findIt != runningProcessStatuses.end())
+				runningProcessStatuses.erase(findIt);
+		}
+		else
+		{
+			// Something else waited on our processes while we were resolving references, so they
+			// have all finished
+			closedProcessStatuses.swap(runningProcessStatuses);
 		}
-	}
 
-	// The result of the builds will go straight to our definitionsToBuild
-	waitForAllProcessesClosed(OnCompileProcessOutput);
-	currentNumProcessesSpawned = 0;
+		for (int* processStatus : closedProcessStatuses)
+		{
+			ComptimeBuildObject* buildObject = nullptr;
+			for (ComptimeBuildObject& object : definitionsToBuild)
+			{
+				if (&object.status == processStatus)
+				{
+					buildObject = &object;
+					break;
+				}
+			}
 
-	// Linking
-	for (ComptimeBuildObject& buildObject : definitionsToBuild)
-	{
-		if (buildObject.stage != BuildStage_Compiling)
-			continue;
+			if (buildObject && buildObject->stage == BuildStage_Compiling)
+			{
+				if (buildObject->status != 0)
+				{
+					environment.comptimeNewCommandCrcs.erase(
+					    buildObject->dynamicLibraryPath.c_str());
 
-		if (buildObject.status != 0)
-		{
-			environment.comptimeNewCommandCrcs.erase(buildObject.dynamicLibraryPath.c_str());
+					ErrorAtTokenf(*buildObject->definition->definitionInvocation,
+					              "failed to compile definition '%s' with status %d",
+					              buildObject->definition->name.c_str(), buildObject->status);
 
-			ErrorAtTokenf(*buildObject.definition->definitionInvocation,
-			              "failed to compile definition '%s' with status %d",
-			              buildObject.definition->name.c_str(), buildObject.status);
+					// Special case: If the definition has no references, prevent it from ever
+					// having a chance to fail again, because there's nothing we can do if it fails
+					if (!buildObject->hasAnyRefs)
+					{
+						buildObject->definition->forbidBuild = true;
+						NoteAtToken(*buildObject->definition->definitionInvocation,
+						            "definition has no missing references. It must be a legitimate "
+						            "error Cakelisp cannot correct. It will not be rebuilt");
+					}
 
-			// Special case: If the definition has no references, prevent it from ever having a
-			// chance to fail again, because there's nothing we can do if it fails
-			if (!buildObject.hasAnyRefs)
-			{
-				buildObject.definition->forbidBuild = true;
-				NoteAtToken(*buildObject.definition->definitionInvocation,
-				            "definition has no missing references. It must be a legitimate error "
-				            "Cakelisp cannot correct. It will not be rebuilt");
-			}
+					continue;
+				}
 
-			continue;
-		}
+				buildObject->stage = BuildStage_Linking;
 
-		buildObject.stage = BuildStage_Linking;
+				if (logging.buildProcess)
+					Logf("Compiled %s successfully\n", buildObject->definition->name.c_str());
 
-		if (logging.buildProcess)
-			Logf("Compiled %s successfully\n", buildObject.definition->name.c_str());
-
-		std::vector<std::string> importLibraryPaths;
-		std::vector<std::string> importLibraries;
-		// Need to be able to find imported dll import libraries
-		importLibraryPaths.push_back(cakelispWorkingDir);
-		PushBackAll(importLibraries, buildObject.importLibraries);
-		if (environment.isMsvcCompiler)
-		{
-			if (environment.cakelispLibDir.empty())
+				if (environment.useCompilerDependencyFiles)
+				{
+					char dependencyFilename[MAX_PATH_LENGTH] = {0};
+					MakeComptimeDependencyFilename(dependencyFilename, sizeof(dependencyFilename),
+					                               buildObject->artifactsName.c_str());
+					buildRecordArtifactDependencies(
+					    environment, buildObject->dynamicLibraryPath.c_str(), dependencyFilename,
+					    precompiledHeaderDependency);
+				}
+
+				if (RunComptimeLinkCommand(environment, *buildObject->definition,
+				                           buildObject->buildObjectName.c_str(),
+				                           buildObject->dynamicLibraryPath.c_str(),
+				                           buildObject->importLibraries, &buildObject->status,
+				                           numErrorsOut))
+				{
+					runningProcessStatuses.push_back(&buildObject->status);
+					continue;
+				}
+
+				// Loading will report the failure
+				buildObject->status = 1;
+			}
+
+			if (buildObject)
 			{
-				ErrorAtTokenf(*buildObject.definition->definitionInvocation,
-				              "cannot link definition '%s' because cakelisp-lib-dir is not set. "
-				              "Set it with e.g.:\n"
-				              "\t(set-cakelisp-option cakelisp-lib-dir \"Dependencies/cakelisp/bin\")",
-				              buildObject.definition->name.c_str());
-				++numErrorsOut;
-				return 0;
+				numReferencesResolved +=
+				    LoadComptimeBuildObject(environment, buildQueue, *buildObject, numErrorsOut);
+				continue;
 			}
-			importLibraryPaths.push_back(environment.cakelispLibDir);
-			importLibraries.push_back("cakelisp.lib");
-		}
 
-		std::vector<const char*> importLibraryPathsArgs;
-		std::vector<const char*> importLibrariesArgs;
-		BuildArgumentConverter convertedArguments[] = {
-		    {&importLibraryPaths, {}, &importLibraryPathsArgs, makeImportLibraryPathArgument},
-		    {&importLibraries, {}, &importLibrariesArgs, nullptr}};
-		convertBuildArguments(convertedArguments, ArraySize(convertedArguments),
-		                      environment.compileTimeLinkCommand.fileToExecute.c_str());
-
-		char dynamicLibraryOutArgument[MAX_PATH_LENGTH] = {0};
-		makeDynamicLibraryOutputArgument(dynamicLibraryOutArgument,
-		                                 sizeof(dynamicLibraryOutArgument),
-		                                 buildObject.dynamicLibraryPath.c_str(),
-		                                 environment.compileTimeLinkCommand.fileToExecute.c_str());
-
-		char compileTimeLinkExecutable[MAX_PATH_LENGTH] = {0};
-		if (!resolveExecutablePath(environment.compileTimeLinkCommand.fileToExecute.c_str(),
-		                           compileTimeLinkExecutable, sizeof(compileTimeLinkExecutable)))
-			continue;
+			ComptimeBuildBatch* batch = nullptr;
+			for (ComptimeBuildBatch& candidateBatch : batches)
+			{
+				if (&candidateBatch.status == processStatus)
+				{
+					batch = &candidateBatch;
+					break;
+				}
+			}
+			// Not one of ours. A definition being resolved may have started it
+			if (!batch)
+				continue;
 
-		ProcessCommandInput linkTimeInputs[] = {
-		    {ProcessCommandArgumentType_DynamicLibraryOutput, {dynamicLibraryOutArgument}},
-		    {ProcessCommandArgumentType_ObjectInput, {buildObject.buildObjectName.c_str()}},
-		    {ProcessCommandArgumentType_ImportLibraryPaths, importLibraryPathsArgs},
-		    {ProcessCommandArgumentType_ImportLibraries, importLibrariesArgs}};
-		const char** linkArgumentList = MakeProcessArgumentsFromCommand(
-		    compileTimeLinkExecutable, environment.compileTimeLinkCommand.arguments, linkTimeInputs,
-		    ArraySize(linkTimeInputs));
-		if (!linkArgumentList)
-		{
-			// TODO: Abort building if cannot invoke compiler
-			continue;
-		}
-		RunProcessArguments linkArguments = {};
-		linkArguments.fileToExecute = compileTimeLinkExecutable;
-		linkArguments.arguments = linkArgumentList;
-		if (runProcess(linkArguments, &buildObject.status) != 0)
-		{
-			++numErrorsOut;
-			// TODO: Abort if linker failed?
-			// free(linkArgumentList);
-		}
-		free(linkArgumentList);
-	}
+			if (batch->stage == BuildStage_Compiling)
+			{
+				if (batch->status != 0)
+				{
+					++g_buildCounts.numFailedComptimeBatchCompiles;
+					// A batch which failed does not say which definition is at fault, and some
+					// may only fail because a reference was guessed wrong. Build those one at a
+					// time, so errors are handled per-definition as usual
+					Logf("note: batched build of %d compile-time definitions failed. Building them "
+					     "one at a time\n",
+					     (int)batch->members.size());
+					for (ComptimeBuildObject* member : batch->members)
+						member->isBatched = false;
+					PushBackAll(objectsToCompile, batch->members);
+					batch->members.clear();
+					continue;
+				}
 
-	// The result of the linking will go straight to our definitionsToBuild
-	waitForAllProcessesClosed(OnCompileProcessOutput);
-	currentNumProcessesSpawned = 0;
+				batch->stage = BuildStage_Linking;
 
-	for (ComptimeBuildObject& buildObject : definitionsToBuild)
-	{
-		if (buildObject.stage != BuildStage_Linking)
-			continue;
+				if (logging.buildProcess)
+					Logf("Compiled %s successfully\n", batch->sourceOutputName.c_str());
 
-		if (buildObject.status != 0)
-		{
-			ErrorAtToken(*buildObject.definition->definitionInvocation,
-			             "Failed to link definition");
-			++numErrorsOut;
-			continue;
+				if (RunComptimeLinkCommand(environment, *batch->members[0]->definition,
+				                           batch->buildObjectName.c_str(),
+				                           batch->dynamicLibraryPath.c_str(),
+				                           batch->importLibraries, &batch->status, numErrorsOut))
+				{
+					runningProcessStatuses.push_back(&batch->status);
+					continue;
+				}
+
+				batch->status = 1;
+			}
+
+			for (ComptimeBuildObject* member : batch->members)
+			{
+				member->stage = BuildStage_Linking;
+				member->status = batch->status;
+				if (batch->status == 0)
+				{
+					member->batchLibraryPath = batch->dynamicLibraryPath;
+					SetComptimeBatch(environment, member->dynamicLibraryPath,
+					                 batch->artifactsName);
+					// Otherwise, something which doesn't know about the batch could use it
+					if (fileExists(member->dynamicLibraryPath.c_str()))
+						remove(member->dynamicLibraryPath.c_str());
+
+					// The batch's dependencies are a superset of the member's, which is safe
+					if (environment.useCompilerDependencyFiles)
+					{
+						char batchDependencyFilename[MAX_PATH_LENGTH] = {0};
+						MakeComptimeDependencyFilename(batchDependencyFilename,
+						                               sizeof(batchDependencyFilename),
+						                               batch->artifactsName.c_str());
+						buildRecordArtifactDependencies(
+						    environment, member->dynamicLibraryPath.c_str(),
+						    batchDependencyFilename, precompiledHeaderDependency);
+					}
+				}
+
+				numReferencesResolved +=
+				    LoadComptimeBuildObject(environment, buildQueue, *member, numErrorsOut);
+			}
+			batch->stage = BuildStage_Finished;
 		}
+	}
 
-		buildObject.stage = BuildStage_Loading;
+	return numReferencesResolved;
+}
 
-		if (logging.buildProcess)
-			Logf("Linked %s successfully\n", buildObject.definition->name.c_str());
+// Check a required definition's references, guessing at unknown ones. Returns whether it is a
+// compile-time object which should be built now
+static bool CheckDefinitionReadyToBuild(EvaluatorEnvironment& environment,
+                                        ObjectDefinition& definition,
+                                        std::vector<ObjectReferenceStatus*>& referencesToCheck,
+                                        bool& hasAnyRefsOut, bool& requireDependencyPropagation)
+{
+	if (logging.compileTimeBuildReasons)
+		Logf("Checking to build %s\n", definition.name.c_str());
 
-		setSourceArtifactCrc(environment, buildObject.sourceOutputName.c_str(),
-		                     buildObject.dynamicLibraryPath.c_str());
+	// Can it be built in the current environment?
+	bool canBuild = true;
+	bool hasRelevantChangeOccurred = false;
+	bool hasGuessedRefs = false;
+	bool hasAnyRefs = false;
+	// If there were new guesses, we will do another pass over this definition's references in
+	// case new references turned up
+	bool guessMaybeDirtiedReferences = false;
+	do
+	{
+		guessMaybeDirtiedReferences = false;
 
-		DynamicLibHandle builtLib = loadDynamicLibrary(buildObject.dynamicLibraryPath.c_str());
-		if (!builtLib)
+		if (definition.references.empty())
 		{
-			ErrorAtToken(*buildObject.definition->definitionInvocation,
-			             "Failed to load compile-time library");
-			++numErrorsOut;
-			continue;
+			hasAnyRefs = false;
+			break;
 		}
 
-		// We need to do name conversion to be compatible with C naming
-		// TODO: Make these come from the top
-		NameStyleSettings nameSettings;
-		char symbolNameBuffer[MAX_NAME_LENGTH] = {0};
-		lispNameStyleToCNameStyle(
-		    nameSettings.functionNameMode, buildObject.definition->name.c_str(), symbolNameBuffer,
-		    sizeof(symbolNameBuffer), *buildObject.definition->definitionInvocation);
-		void* compileTimeFunction = getSymbolFromDynamicLibrary(builtLib, symbolNameBuffer);
-		if (!compileTimeFunction)
+		// Copy pointers to refs in case of iterator invalidation
+		referencesToCheck.clear();
+		referencesToCheck.reserve(definition.references.size());
+		for (ObjectReferenceStatusPair& referencePair : definition.references)
 		{
-			ErrorAtToken(*buildObject.definition->definitionInvocation,
-			             "Failed to find symbol in loaded library");
-			++numErrorsOut;
-			continue;
+			referencesToCheck.push_back(&referencePair.second);
 		}
-
-		// Add to environment
-		switch (buildObject.definition->type)
+		for (ObjectReferenceStatus* referencePointer : referencesToCheck)
 		{
-			case ObjectType_CompileTimeMacro:
-				if (findMacro(environment, buildObject.definition->name.c_str()))
-					NoteAtToken(*buildObject.definition->definitionInvocation, "redefined macro");
-				environment.macros[buildObject.definition->name] = (MacroFunc)compileTimeFunction;
-				break;
-			case ObjectType_CompileTimeGenerator:
-				if (findGenerator(environment, buildObject.definition->name.c_str()))
-					NoteAtToken(*buildObject.definition->definitionInvocation,
-					            "redefined generator");
-				environment.generators[buildObject.definition->name] =
-				    (GeneratorFunc)compileTimeFunction;
-				break;
-			case ObjectType_CompileTimeFunction:
-				if (findCompileTimeFunction(environment, buildObject.definition->name.c_str()))
-					NoteAtToken(*buildObject.definition->definitionInvocation,
-					            "redefined function");
-				environment.compileTimeFunctions[buildObject.definition->name] =
-				    (void*)compileTimeFunction;
-				break;
-			default:
-				ErrorAtToken(
-				    *buildObject.definition->definitionInvocation,
-				    "Tried to build definition which is not compile-time object. Code error?");
-				break;
-		}
+			ObjectReferenceStatus& referenceStatus = *referencePointer;
 
-		buildObject.stage = BuildStage_ResolvingReferences;
+			ObjectDefinition* referencedDefinition = referenceStatus.definition;
+			if (referencedDefinition)
+			{
+				if (isCompileTimeObject(referencedDefinition->type))
+				{
+					bool refCompileTimeCodeLoaded = referencedDefinition->isLoaded;
+					if (refCompileTimeCodeLoaded)
+					{
+						// The reference is ready to go. Built objects immediately resolve
+						// references. We will react to it if the last thing we did was guess
+						// incorrectly that this was a C call
+						if (referenceStatus.guessState != GuessState_Resolved)
+						{
+							if (logging.compileTimeBuildReasons)
+								Log("\tRequired code has been loaded\n");
 
-		// warnIfNoReferences is only enabled if the environment didn't require this definition for
-		// some other reason. environmentRequired is the catch-all for comptime functions that
-		// aren't necessarily referenced by the user's code (e.g. comptime var destructors)
-		int numErrorsOutBefore = numErrorsOut;
-		numReferencesResolved += ReevaluateResolveReferences(
-		    environment, buildObject.definition->name.c_str(),
-		    /*warnIfNoReferences=*/!buildObject.definition->environmentRequired, numErrorsOut);
+							hasRelevantChangeOccurred = true;
+						}
 
-		// This definition had errors, don't consider it finished
-		if (numErrorsOut != numErrorsOutBefore)
-			continue;
+						referenceStatus.guessState = GuessState_Resolved;
+					}
+					else
+					{
+						// If we know we are missing a compile time function, we won't try to
+						// guess
+						if (logging.compileTimeBuildReasons)
+							Logf("\tCannot build until %s is loaded\n",
+							     referenceStatus.name->contents.c_str());
 
-		if (logging.buildProcess)
-			Logf("Resolved %d references\n", numReferencesResolved);
+						referenceStatus.guessState = GuessState_WaitingForLoad;
+						canBuild = false;
+					}
+				}
+				else if (referencedDefinition->type == ObjectType_Function &&
+				         referenceStatus.guessState != GuessState_Resolved)
+				{
+					// A known Cakelisp function call
+					for (int i = 0; i < (int)referenceStatus.references.size(); ++i)
+					{
+						ObjectReference& reference = referenceStatus.references[i];
+						// In case a function has already guessed the invocation was a C/C++
+						// function, clear that invocation output
+						resetGeneratorOutput(*reference.spliceOutput);
+						// Run function invocation on it
+						// TODO: Make invocation generator know it is a Cakelisp function
+						bool result = FunctionInvocationGenerator(
+						    environment, reference.context, *reference.tokens,
+						    reference.startIndex, *reference.spliceOutput);
+						// Our guess didn't even evaluate
+						if (!result)
+							canBuild = false;
+					}
 
-		// Remove need to build
-		buildObject.definition->isLoaded = true;
+					referenceStatus.guessState = GuessState_Resolved;
+				}
+				// TODO: Building references to non-comptime functions at comptime
+			}
+			else
+			{
+				if (referenceStatus.guessState == GuessState_None)
+				{
+					if (logging.compileTimeBuildReasons)
+						Logf("\tCannot build until %s is guessed. Guessing now\n",
+						     referenceStatus.name->contents.c_str());
+
+					// Find all the times the definition makes this reference
+					// We must use indices because the call to FunctionInvocationGenerator can
+					// add new references to the list
+					// Note that if new references are added to other functions, they need to be
+					// handled in the next pass
+					for (int i = 0; i < (int)referenceStatus.references.size(); ++i)
+					{
+						ObjectReference& reference = referenceStatus.references[i];
+						// Run function invocation on it
+						bool result = FunctionInvocationGenerator(
+						    environment, reference.context, *reference.tokens,
+						    reference.startIndex, *reference.spliceOutput);
+						// Our guess didn't even evaluate
+						if (!result)
+							canBuild = false;
+					}
 
-		buildObject.stage = BuildStage_Finished;
+					referenceStatus.guessState = GuessState_Guessed;
+					hasRelevantChangeOccurred = true;
+					hasGuessedRefs = true;
+					guessMaybeDirtiedReferences = true;
+					requireDependencyPropagation = true;
+				}
+				else if (referenceStatus.guessState == GuessState_Guessed)
+				{
+					// It has been guessed, and still isn't in definitions
+					hasGuessedRefs = true;
+				}
+			}
+		}
+	} while (guessMaybeDirtiedReferences);
 
-		if (logging.buildProcess)
-			Logf("Successfully built, loaded, and executed %s\n",
-			     buildObject.definition->name.c_str());
-	}
+	hasAnyRefsOut = hasAnyRefs;
 
-	return numReferencesResolved;
+	// hasRelevantChangeOccurred being false suppresses rebuilding compile-time functions which
+	// still have the same missing references. Note that only compile time objects can be built.
+	// We put normal functions through the guessing system too because they need their functions
+	// resolved as well. It's a bit dirty but not too bad
+	return canBuild && (!hasGuessedRefs || hasRelevantChangeOccurred) &&
+	       isCompileTimeObject(definition.type);
+}
+
+static void AddComptimeBuildObject(EvaluatorEnvironment& environment, ObjectDefinition& definition,
+                                   bool hasAnyRefs,
+                                   std::deque<ComptimeBuildObject>& definitionsToBuild)
+{
+	ComptimeBuildObject objectToBuild = {};
+	objectToBuild.buildId = getNextFreeBuildId(environment);
+	objectToBuild.definition = &definition;
+	objectToBuild.hasAnyRefs = hasAnyRefs;
+	definitionsToBuild.push_back(objectToBuild);
+
+	// A build can only start once everything it references is loaded, so its place in the chain
+	// of builds comes after theirs
+	definition.comptimeBuildDepth = 1;
+	for (ObjectReferenceStatusPair& referencePair : definition.references)
+	{
+		const ObjectDefinition* referencedDefinition = referencePair.second.definition;
+		if (referencedDefinition && isCompileTimeObject(referencedDefinition->type) &&
+		    referencedDefinition->comptimeBuildDepth >= definition.comptimeBuildDepth)
+			definition.comptimeBuildDepth = referencedDefinition->comptimeBuildDepth + 1;
+	}
+	if (definition.comptimeBuildDepth > environment.comptimeCriticalPathLength)
+		environment.comptimeCriticalPathLength = definition.comptimeBuildDepth;
 }
 
 // Returns true if progress was made resolving references (or finding new references)
 bool BuildEvaluateReferences(EvaluatorEnvironment& environment, int& numErrorsOut)
 {
-	// We must copy references in case environment.definitions is modified, which would invalidate
-	// iterators, but not references
+	++environment.numResolvePasses;
+
+	// We must copy references in case environment.definitions is modified. FlatHashMap keeps
+	// values in place, but values added while iterating might not be visited
 	std::vector<ObjectDefinition*> definitionsToCheck;
 	definitionsToCheck.reserve(environment.definitions.size());
 	for (ObjectDefinitionPair& definitionPair : environment.definitions)
@@ -1550,184 +2323,41 @@ bool BuildEvaluateReferences(EvaluatorEnvironment& environment, int& numErrorsOu
 		definitionsToCheck.push_back(&definition);
 	}
 
-	std::vector<ComptimeBuildObject> definitionsToBuild;
-	// If it's possible a definition has new requirements, make sure we do another pass to add those
-	// requirements to the build
-	bool requireDependencyPropagation = false;
-
-	// Declared here to reduce memory allocations by re-using buffer for every definition
-	std::vector<ObjectReferenceStatus*> referencesToCheck;
-
+	// Loading each object queues the dependents which were only waiting on it, so this builds
+	// everything which can be built in one go
+	ComptimeBuildQueue buildQueue;
 	for (ObjectDefinition* definitionPointer : definitionsToCheck)
 	{
-		ObjectDefinition& definition = *definitionPointer;
-		const char* defName = definition.name.c_str();
-
-		if (logging.compileTimeBuildReasons)
-			Logf("Checking to build %s\n", defName);
-
-		// Can it be built in the current environment?
-		bool canBuild = true;
-		bool hasRelevantChangeOccurred = false;
-		bool hasGuessedRefs = false;
 		bool hasAnyRefs = false;
-		// If there were new guesses, we will do another pass over this definition's references in
-		// case new references turned up
-		bool guessMaybeDirtiedReferences = false;
-		do
-		{
-			guessMaybeDirtiedReferences = false;
-
-			if (definition.references.empty())
-			{
-				hasAnyRefs = false;
-				break;
-			}
-
-			// Copy pointers to refs in case of iterator invalidation
-			referencesToCheck.clear();
-			referencesToCheck.reserve(definition.references.size());
-			for (ObjectReferenceStatusPair& referencePair : definition.references)
-			{
-				referencesToCheck.push_back(&referencePair.second);
-			}
-			for (ObjectReferenceStatus* referencePointer : referencesToCheck)
-			{
-				ObjectReferenceStatus& referenceStatus = *referencePointer;
-
-				// TODO: (Performance) Add shortcut in reference
-				ObjectDefinitionMap::iterator findIt =
-				    environment.definitions.find(referenceStatus.name->contents);
-				if (findIt != environment.definitions.end())
-				{
-					if (isCompileTimeObject(findIt->second.type))
-					{
-						bool refCompileTimeCodeLoaded = findIt->second.isLoaded;
-						if (refCompileTimeCodeLoaded)
-						{
-							// The reference is ready to go. Built objects immediately resolve
-							// references. We will react to it if the last thing we did was guess
-							// incorrectly that this was a C call
-							if (referenceStatus.guessState != GuessState_Resolved)
-							{
-								if (logging.compileTimeBuildReasons)
-									Log("\tRequired code has been loaded\n");
-
-								hasRelevantChangeOccurred = true;
-							}
-
-							referenceStatus.guessState = GuessState_Resolved;
-						}
-						else
-						{
-							// If we know we are missing a compile time function, we won't try to
-							// guess
-							if (logging.compileTimeBuildReasons)
-								Logf("\tCannot build until %s is loaded\n",
-								     referenceStatus.name->contents.c_str());
-
-							referenceStatus.guessState = GuessState_WaitingForLoad;
-							canBuild = false;
-						}
-					}
-					else if (findIt->second.type == ObjectType_Function &&
-					         referenceStatus.guessState != GuessState_Resolved)
-					{
-						// A known Cakelisp function call
-						for (int i = 0; i < (int)referenceStatus.references.size(); ++i)
-						{
-							ObjectReference& reference = referenceStatus.references[i];
-							// In case a function has already guessed the invocation was a C/C++
-							// function, clear that invocation output
-							resetGeneratorOutput(*reference.spliceOutput);
-							// Run function invocation on it
-							// TODO: Make invocation generator know it is a Cakelisp function
-							bool result = FunctionInvocationGenerator(
-							    environment, reference.context, *reference.tokens,
-							    reference.startIndex, *reference.spliceOutput);
-							// Our guess didn't even evaluate
-							if (!result)
-								canBuild = false;
-						}
-
-						referenceStatus.guessState = GuessState_Resolved;
-					}
-					// TODO: Building references to non-comptime functions at comptime
-				}
-				else
-				{
-					if (referenceStatus.guessState == GuessState_None)
-					{
-						if (logging.compileTimeBuildReasons)
-							Logf("\tCannot build until %s is guessed. Guessing now\n",
-							     referenceStatus.name->contents.c_str());
-
-						// Find all the times the definition makes this reference
-						// We must use indices because the call to FunctionInvocationGenerator can
-						// add new references to the list
-						// Note that if new references are added to other functions, they need to be
-						// handled in the next pass
-						for (int i = 0; i < (int)referenceStatus.references.size(); ++i)
-						{
-							ObjectReference& reference = referenceStatus.references[i];
-							// Run function invocation on it
-							bool result = FunctionInvocationGenerator(
-							    environment, reference.context, *reference.tokens,
-							    reference.startIndex, *reference.spliceOutput);
-							// Our guess didn't even evaluate
-							if (!result)
-								canBuild = false;
-						}
-
-						referenceStatus.guessState = GuessState_Guessed;
-						hasRelevantChangeOccurred = true;
-						hasGuessedRefs = true;
-						guessMaybeDirtiedReferences = true;
-						requireDependencyPropagation = true;
-					}
-					else if (referenceStatus.guessState == GuessState_Guessed)
-					{
-						// It has been guessed, and still isn't in definitions
-						hasGuessedRefs = true;
-					}
-				}
-			}
-		} while (guessMaybeDirtiedReferences);
-
-		// hasRelevantChangeOccurred being false suppresses rebuilding compile-time functions which
-		// still have the same missing references. Note that only compile time objects can be built.
-		// We put normal functions through the guessing system too because they need their functions
-		// resolved as well. It's a bit dirty but not too bad
-		if (canBuild && (!hasGuessedRefs || hasRelevantChangeOccurred) &&
-		    isCompileTimeObject(definition.type))
-		{
-			ComptimeBuildObject objectToBuild = {};
-			objectToBuild.buildId = getNextFreeBuildId(environment);
-			objectToBuild.definition = &definition;
-			objectToBuild.hasAnyRefs = hasAnyRefs;
-			definitionsToBuild.push_back(objectToBuild);
-		}
+		if (CheckDefinitionReadyToBuild(environment, *definitionPointer,
+		                                buildQueue.referencesToCheck, hasAnyRefs,
+		                                buildQueue.requireDependencyPropagation))
+			AddComptimeBuildObject(environment, *definitionPointer, hasAnyRefs,
+			                       buildQueue.objects);
 	}
 
 	int numReferencesResolved = 0;
-	if (!definitionsToBuild.empty())
+	if (!buildQueue.objects.empty())
 	{
 		if (logging.compileTimeBuildObjects)
 		{
-			int numToBuild = (int)definitionsToBuild.size();
+			int numToBuild = (int)buildQueue.objects.size();
 			Logf("Building %d compile-time object%c\n", numToBuild, numToBuild > 1 ? 's' : ' ');
 
-			for (ComptimeBuildObject& buildObject : definitionsToBuild)
+			for (ComptimeBuildObject& buildObject : buildQueue.objects)
 			{
 				Logf("\t%s\n", buildObject.definition->name.c_str());
 			}
 		}
 
-		numReferencesResolved =
-		    BuildExecuteCompileTimeFunctions(environment, definitionsToBuild, numErrorsOut);
+		std::chrono::steady_clock::time_point buildStart = std::chrono::steady_clock::now();
+		numReferencesResolved +=
+		    BuildExecuteCompileTimeFunctions(environment, buildQueue, numErrorsOut);
+		g_nestedPhaseTimes.comptimeBuildSeconds +=
+		    std::chrono::duration<double>(std::chrono::steady_clock::now() - buildStart).count();
 	}
 
-	return numReferencesResolved > 0 || requireDependencyPropagation;
+	return numReferencesResolved > 0 || buildQueue.requireDependencyPropagation;
 }
 
 bool EvaluateResolveReferences(EvaluatorEnvironment& environment)
@@ -1735,8 +2365,9 @@ bool EvaluateResolveReferences(EvaluatorEnvironment& environment)
 	// We're about to start compiling comptime code; read the cache
 	// TODO: Multiple comptime configurations require different working dir
 	if (!buildReadCacheFile(cakelispWorkingDir, environment.comptimeCachedCommandCrcs,
-	                        environment.sourceArtifactFileCrcs,
-	                        environment.loadedHeaderCrcCache))
+	                        environment.sourceArtifactFileCrcs, environment.loadedHeaderCrcCache,
+	                        environment.headerScans, environment.artifactDependencies) ||
+	    !buildReadComptimeBatchesFile(cakelispWorkingDir, environment.comptimeBatches))
 		return false;
 
 	// Print state
@@ -1814,6 +2445,10 @@ bool EvaluateResolveReferences(EvaluatorEnvironment& environment)
 	if (numBuildResolveErrors)
 		Logf("Failed with %d errors.\n", numBuildResolveErrors);
 
+	if (logging.performance)
+		Logf("Resolved references in %d passes. Longest chain of compile-time builds: %d\n",
+		     environment.numResolvePasses, environment.comptimeCriticalPathLength);
+
 	int errors = 0;
 	for (const ObjectDefinitionPair& definitionPair : environment.definitions)
 	{
@@ -1845,15 +2480,13 @@ bool EvaluateResolveReferences(EvaluatorEnvironment& environment)
 				{
 					const ObjectReferenceStatus& referenceStatus = reference.second;
 
-					// TODO: (Performance) Add shortcut in reference
-					ObjectDefinitionMap::iterator findIt =
-					    environment.definitions.find(referenceStatus.name->contents);
-					if (findIt != environment.definitions.end())
+					ObjectDefinition* referencedDefinition = referenceStatus.definition;
+					if (referencedDefinition)
 					{
-						if (isCompileTimeObject(findIt->second.type) &&
-						    !isCompileTimeCodeLoaded(environment, findIt->second))
+						if (isCompileTimeObject(referencedDefinition->type) &&
+						    !isCompileTimeCodeLoaded(environment, *referencedDefinition))
 						{
-							missingDefinitions.push_back(findIt->second.definitionInvocation);
+							missingDefinitions.push_back(referencedDefinition->definitionInvocation);
 							++errors;
 						}
 					}
@@ -1890,11 +2523,17 @@ bool EvaluateResolveReferences(EvaluatorEnvironment& environment)
 	// Only write CRCs if we did some comptime compilation. Otherwise, the tokenizer will complain
 	// about loading a completely empty file
 	if (!environment.comptimeNewCommandCrcs.empty() ||
-	    !environment.sourceArtifactFileCrcs.empty() || !environment.changedHeaderCrcCache.empty())
+	    !environment.sourceArtifactFileCrcs.empty() || !environment.changedHeaderCrcCache.empty() ||
+	    !environment.changedHeaderScans.empty() || !environment.changedArtifactDependencies.empty())
 		buildReadMergeWriteCacheFile(cakelispWorkingDir, environment.comptimeCachedCommandCrcs,
 		                             environment.comptimeNewCommandCrcs,
 		                             environment.sourceArtifactFileCrcs,
-		                             environment.changedHeaderCrcCache);
+		                             environment.changedHeaderCrcCache,
+		                             environment.changedHeaderScans,
+		                             environment.changedArtifactDependencies);
+	if (!environment.changedComptimeBatches.empty())
+		buildReadMergeWriteComptimeBatchesFile(cakelispWorkingDir,
+		                                       environment.changedComptimeBatches);
 
 	return errors == 0 && numBuildResolveErrors == 0;
 }
@@ -1972,6 +2611,13 @@ void environmentDestroyInvalidateTokens(EvaluatorEnvironment& environment)
 	}
 	environment.compileTimeVariables.clear();
 
+	// The process is about to exit, so let the OS reclaim everything at once
+	if (environment.skipFreeOnDestroy)
+	{
+		environment.comptimeTokens.clear();
+		return;
+	}
+
 	for (ObjectReferencePoolPair& referencePoolPair : environment.referencePools)
 	{
 		for (ObjectReference& reference : referencePoolPair.second.references)
@@ -1981,6 +2627,7 @@ void environmentDestroyInvalidateTokens(EvaluatorEnvironment& environment)
 		referencePoolPair.second.references.clear();
 	}
 	environment.referencePools.clear();
+	environment.requiredPropagationQueue.clear();
 
 	for (ObjectDefinitionPair& definitionPair : environment.definitions)
 	{
@@ -2003,6 +2650,11 @@ void environmentDestroyInvalidateTokens(EvaluatorEnvironment& environment)
 	for (const std::vector<Token>* comptimeTokens : environment.comptimeTokens)
 		delete comptimeTokens;
 	environment.comptimeTokens.clear();
+	environment.macroExpansionTokens.clear();
+
+	for (std::vector<Token>* scratchTokens : environment.macroOutputScratch)
+		delete scratchTokens;
+	environment.macroOutputScratch.clear();
 }
 
 const char* evaluatorScopeToString(EvaluatorScope expectedScope)
@@ -2056,8 +2708,7 @@ uint32_t cacheUpdateFileCrc(EvaluatorEnvironment& environment, const char* filen
 	return sourceCrc;
 }
 
-uint32_t getSourceArtifactKey(const char* source,
-                                  const char* artifact)
+uint32_t getSourceArtifactKey(const char* source, const char* artifact)
 {
 	uint32_t artifactSourceNameCrc = 0;
 	crc32(artifact, strlen(artifact), &artifactSourceNameCrc);
@@ -2249,25 +2900,21 @@ bool registerEvaluateGenerator(EvaluatorEnvironment& environment, const char* ge
 
 		environment.generators[generatorName] = function;
 
+		InternedString generatorNameId = internString(generatorName);
+
 		if (!environment.referencePools.empty())
-			ReevaluateResolveReferences(environment, generatorName, /*warnIfNoReferences=*/false,
-			                            numErrors);
+			ReevaluateResolveReferences(environment, generatorNameId,
+			                            /*warnIfNoReferences=*/false, numErrors);
 
 		// Mark them as resolved
-		// TODO Slow HACK!
 		if (!numErrors)
 		{
-			for (ObjectDefinitionPair& definitionPair : environment.definitions)
+			ObjectReferencePoolMap::iterator findPool =
+			    environment.referencePools.find(generatorNameId);
+			if (findPool != environment.referencePools.end())
 			{
-				ObjectDefinition& definition = definitionPair.second;
-
-				for (ObjectReferenceStatusPair& reference : definition.references)
-				{
-					ObjectReferenceStatus& referenceStatus = reference.second;
-
-					if (referenceStatus.name->contents.compare(generatorName) == 0)
-						referenceStatus.guessState = GuessState_Resolved;
-				}
+				for (ObjectReferenceStatus* referenceStatus : findPool->second.statuses)
+					referenceStatus->guessState = GuessState_Resolved;
 			}
 		}
 	}
@@ -2337,7 +2984,7 @@ bool StringOutputHasAnyMeaningfulOutput(const std::vector<StringOutput>* stringO
 		}
 		else if (output.modifiers & (StringOutMod_NewlineAfter | StringOutMod_SpaceAfter |
 		                             StringOutMod_SpaceBefore | StringOutMod_None) &&
-		         output.output.empty())
+		         !output.outputLength)
 		{
 			// Not actually meaningful output
 		}
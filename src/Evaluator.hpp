@@ -1,15 +1,17 @@
 #pragma once
 
+#include <deque>
 #include <string>
-#include <vector>
-// TODO: Replace with fast hash table
 #include <unordered_map>
+#include <vector>
 
 #include "Build.hpp"
 #include "EvaluatorEnums.hpp"
 #include "Exporting.hpp"
 #include "FileTypes.hpp"
+#include "FlatHashMap.hpp"
 #include "RunProcess.hpp"
+#include "Utilities.hpp"
 
 struct GeneratorOutput;
 struct ModuleManager;
@@ -24,7 +26,10 @@ struct StringOutput
 	// TODO: Putting this in a union means we need to write a destructor which can detect when to
 	// destroy output
 	// union {
-	std::string output;
+	// Not owned: the text lives in output text blocks (see outputTextAdd()) or interned strings, so
+	// StringOutputs are cheap to copy and never free anything. Null if there is no text
+	const char* output;
+	unsigned int outputLength;
 	GeneratorOutput* spliceOutput;
 	// };
 
@@ -108,13 +113,12 @@ typedef bool (*MacroFunc)(EvaluatorEnvironment& environment, const EvaluatorCont
                           const std::vector<Token>& tokens, int startTokenIndex,
                           std::vector<Token>& output);
 
-// TODO: Replace with fast hash table implementation
-typedef std::unordered_map<std::string, MacroFunc> MacroTable;
-typedef std::unordered_map<std::string, GeneratorFunc> GeneratorTable;
+typedef FlatHashMap<std::string, MacroFunc> MacroTable;
+typedef FlatHashMap<std::string, GeneratorFunc> GeneratorTable;
 typedef MacroTable::iterator MacroIterator;
 typedef GeneratorTable::iterator GeneratorIterator;
 
-typedef std::unordered_map<std::string, const Token*> GeneratorLastReferenceTable;
+typedef FlatHashMap<std::string, const Token*> GeneratorLastReferenceTable;
 typedef GeneratorLastReferenceTable::iterator GeneratorLastReferenceTableIterator;
 
 struct ObjectReference
@@ -132,10 +136,17 @@ struct ObjectReference
 	bool isResolved;
 };
 
+struct ObjectDefinition;
+
 // TODO Need to add insertion points for later fixing
 struct ObjectReferenceStatus
 {
 	const Token* name;
+	// The definition which makes the reference
+	ObjectDefinition* owner;
+	// The referenced object's definition, or null if it hasn't been defined (yet). Kept up to date
+	// as definitions are added and replaced, so resolving doesn't need to look the name up
+	ObjectDefinition* definition;
 	// We need to guess and check because we don't know what C/C++ functions might be available. The
 	// guessState keeps track of how successful the guess was, so we don't keep recompiling until
 	// some relevant change to our references has occurred
@@ -146,8 +157,9 @@ struct ObjectReferenceStatus
 	std::vector<ObjectReference> references;
 };
 
-typedef std::unordered_map<std::string, ObjectReferenceStatus> ObjectReferenceStatusMap;
-typedef std::pair<const std::string, ObjectReferenceStatus> ObjectReferenceStatusPair;
+// Keyed by the interned name of the referenced object
+typedef FlatHashMap<InternedString, ObjectReferenceStatus> ObjectReferenceStatusMap;
+typedef std::pair<const InternedString, ObjectReferenceStatus> ObjectReferenceStatusPair;
 
 struct MacroExpansion
 {
@@ -155,8 +167,24 @@ struct MacroExpansion
 	const std::vector<Token>* tokens;
 };
 
-typedef std::unordered_map<uint32_t, const Token*> TokenizePushTokensMap;
-typedef std::pair<const uint32_t, const Token*> TokenizePushTokensPair;
+// tokenize-push output is a run of tokens to copy as-is, followed by splice arguments, repeated
+struct TokenizePushPlanStep
+{
+	const Token* literalTokens;
+	int numLiteralTokens;
+	int numSpliceArguments;
+};
+
+// Built when the tokenize-push is evaluated, so executing it at macro run-time doesn't need to scan
+// for splices
+struct TokenizePushPlan
+{
+	std::vector<TokenizePushPlanStep> steps;
+};
+
+// Keyed by the CRC of the tokens to output
+typedef FlatHashMap<uint32_t, TokenizePushPlan> TokenizePushPlanMap;
+typedef std::pair<const uint32_t, TokenizePushPlan> TokenizePushPlanPair;
 
 struct RequiredFeatureReason
 {
@@ -168,6 +196,8 @@ typedef std::vector<RequiredFeatureReason> RequiredFeatureReasonList;
 struct ObjectDefinition
 {
 	std::string name;
+	// Set by addObjectDefinition(). Use it to look up references to this definition
+	InternedString nameId;
 	// The generator invocation that actually triggered the definition of this object
 	const Token* definitionInvocation;
 	ObjectType type;
@@ -175,11 +205,17 @@ struct ObjectDefinition
 	// Objects can be referenced by other objects, but something in the chain must be required in
 	// order for the objects to be built. Required-ness spreads from the top level module scope
 	bool isRequired;
+	// Whether required-ness has been spread to this definition's references. New references are
+	// handled as they are added, so each definition only needs to be spread once
+	bool hasPropagatedRequired;
 	// The user's code might not require it, but the environment does, so don't error if this
 	// definition has no references
 	bool environmentRequired;
 	// If we learn this will always fail compilation, prevent it from continuously being recompiled
 	bool forbidBuild;
+	// How many compile-time builds had to finish, one after another, before this one could start
+	// (including itself). Zero if it hasn't been built
+	int comptimeBuildDepth;
 
 	// Unique references, for dependency checking
 	ObjectReferenceStatusMap references;
@@ -213,9 +249,9 @@ struct ObjectDefinition
 	// requested. This is only relevant for compile-time function bodies
 	int nextFreeUniqueSymbolNum;
 
-	// At evaluate time, the tokens are loaded to these lists. At macro run-time (comptime) these
-	// lists are used to copy tokens to the macro output
-	TokenizePushTokensMap tokenizePushTokens;
+	// At evaluate time, tokenize-push invocations are planned here. At macro run-time (comptime)
+	// these plans are used to copy tokens to the macro output
+	TokenizePushPlanMap tokenizePushPlans;
 
 	RequiredFeature requiredFeatures;
 	RequiredFeatureReasonList requiredFeaturesReasons;
@@ -224,16 +260,20 @@ struct ObjectDefinition
 struct ObjectReferencePool
 {
 	std::vector<ObjectReference> references;
+	// Every definition's status for this name, so they can be updated when it is (re)defined
+	std::vector<ObjectReferenceStatus*> statuses;
 };
 
 // NOTE: See comment in BuildEvaluateReferences() before changing this data structure. The current
-// implementation assumes references to values will not be invalidated if the hash map changes
-typedef std::unordered_map<std::string, ObjectDefinition> ObjectDefinitionMap;
+// implementation assumes references to values will not be invalidated if the hash map changes,
+// which FlatHashMap guarantees
+typedef FlatHashMap<std::string, ObjectDefinition> ObjectDefinitionMap;
 typedef std::pair<const std::string, ObjectDefinition> ObjectDefinitionPair;
-typedef std::unordered_map<std::string, ObjectReferencePool> ObjectReferencePoolMap;
-typedef std::pair<const std::string, ObjectReferencePool> ObjectReferencePoolPair;
+// Keyed by the interned name of the referenced object
+typedef FlatHashMap<InternedString, ObjectReferencePool> ObjectReferencePoolMap;
+typedef std::pair<const InternedString, ObjectReferencePool> ObjectReferencePoolPair;
 
-typedef std::unordered_map<std::string, void*> CompileTimeFunctionTable;
+typedef FlatHashMap<std::string, void*> CompileTimeFunctionTable;
 typedef CompileTimeFunctionTable::iterator CompileTimeFunctionTableIterator;
 
 struct CompileTimeFunctionMetadata
@@ -242,7 +282,7 @@ struct CompileTimeFunctionMetadata
 	const Token* startArgsToken;
 };
 
-typedef std::unordered_map<std::string, CompileTimeFunctionMetadata>
+typedef FlatHashMap<std::string, CompileTimeFunctionMetadata>
     CompileTimeFunctionMetadataTable;
 typedef CompileTimeFunctionMetadataTable::iterator CompileTimeFunctionMetadataTableIterator;
 
@@ -278,15 +318,15 @@ struct CompileTimeVariable
 	// pointer to the appropriate type to make sure destructor is called
 	std::string destroyCompileTimeFuncName;
 };
-typedef std::unordered_map<std::string, CompileTimeVariable> CompileTimeVariableTable;
+typedef FlatHashMap<std::string, CompileTimeVariable> CompileTimeVariableTable;
 typedef CompileTimeVariableTable::iterator CompileTimeVariableTableIterator;
 typedef std::pair<const std::string, CompileTimeVariable> CompileTimeVariableTablePair;
 
-typedef std::unordered_map<std::string, const char*> RequiredCompileTimeFunctionReasonsTable;
+typedef FlatHashMap<std::string, const char*> RequiredCompileTimeFunctionReasonsTable;
 typedef RequiredCompileTimeFunctionReasonsTable::iterator
     RequiredCompileTimeFunctionReasonsTableIterator;
 
-typedef std::unordered_map<std::string, bool> CompileTimeSymbolTable;
+typedef FlatHashMap<std::string, bool> CompileTimeSymbolTable;
 
 typedef std::unordered_map<std::string, FileModifyTime> HeaderModificationTimeTable;
 
@@ -297,7 +337,7 @@ struct SplicePoint
 	const Token* blameToken;
 };
 
-typedef std::unordered_map<std::string, SplicePoint> SplicePointTable;
+typedef FlatHashMap<std::string, SplicePoint> SplicePointTable;
 typedef std::pair<const std::string, SplicePoint> SplicePointTablePair;
 typedef SplicePointTable::iterator SplicePointTableIterator;
 
@@ -327,6 +367,13 @@ struct EvaluatorEnvironment
 	// Tokens will become invalid. The const here is to protect from that. You can change the token
 	// contents, however
 	std::vector<const std::vector<Token>*> comptimeTokens;
+	// Macros write into these, so their output grows in memory which has already been allocated.
+	// The result is then copied to an exactly-sized list in macroExpansionTokens. One per macro
+	// invocation which is currently running, in case a macro evaluates other macros
+	std::vector<std::vector<Token>*> macroOutputScratch;
+	// Every macro expansion's tokens. A deque allocates the lists in blocks and never moves them,
+	// so pointers to their Tokens stay valid, and they are all released at once
+	std::deque<std::vector<Token>> macroExpansionTokens;
 
 	// Shared across comptime build rounds
 	HeaderModificationTimeTable comptimeHeaderModifiedCache;
@@ -334,6 +381,18 @@ struct EvaluatorEnvironment
 	// Only headers which have CRCs that do not match the values in loadedHeaderCrcCache will end up
 	// here. This is then written out along with the loadedHeaderCrcCache.
 	ArtifactCrcTable changedHeaderCrcCache;
+	// What each header contained when it was last read, so unmodified headers aren't read again.
+	// Only new scans which are safe to trust on the next build end up in changedHeaderScans
+	HeaderScanTable headerScans;
+	HeaderScanTable changedHeaderScans;
+	// Only used when useCompilerDependencyFiles. Like the above, only newly recorded dependencies
+	// end up in changedArtifactDependencies
+	ArtifactDependenciesTable artifactDependencies;
+	ArtifactDependenciesTable changedArtifactDependencies;
+	// Which batch library each batched macro or generator was last built into. Definitions which
+	// got their own library again are in changedComptimeBatches with an empty batch name
+	ComptimeBatchTable comptimeBatches;
+	ComptimeBatchTable changedComptimeBatches;
 	// If an existing cached build was run, check the current build's commands against the previous
 	// commands via CRC comparison. This ensures changing commands will cause rebuilds
 	ArtifactCrcTable comptimeCachedCommandCrcs;
@@ -355,6 +414,9 @@ struct EvaluatorEnvironment
 
 	ObjectDefinitionMap definitions;
 	ObjectReferencePoolMap referencePools;
+	// Definitions which might have become required since the last propagation, because they are
+	// new, newly referenced, or newly required by the environment
+	std::vector<ObjectDefinition*> requiredPropagationQueue;
 
 	// Used to ensure unique filenames for compile-time artifacts
 	int nextFreeBuildId;
@@ -383,14 +445,33 @@ struct EvaluatorEnvironment
 	// the source file hasn't been modified more recently)
 	bool useCachedFiles;
 
+	// Have the compiler write which files each object depended on, and check those rather than
+	// scanning #includes. Only compile commands with 'dependency-file-output will do this
+	bool useCompilerDependencyFiles;
+
+	// Don't free generated outputs, macro tokens, etc. one by one on destroy. Only set this if the
+	// process will exit soon after, because it is faster to let the OS reclaim the memory
+	bool skipFreeOnDestroy;
+
 	// Heuristic to track whether additional resolve phases need to be executed
 	bool wasCodeEvaluatedThisPhase;
 
+	// For --verbose-performance. Passes over all definitions to find what to build, and the
+	// longest chain of compile-time builds which had to wait on each other
+	int numResolvePasses;
+	int comptimeCriticalPathLength;
+
 	// Save a huge amount of time by precompiling Cakelisp headers
 	bool comptimeUsePrecompiledHeaders;
 	bool comptimeHeadersPrepared;
+
+	// Compile the macros and generators which are ready to build at the start of a build pass as a
+	// few translation units, each linked into one library shared by its members, rather than one
+	// library each
+	bool comptimeBatchBuilds;
 	// Note that this is the header without the precompilation extension
 	std::string comptimeCombinedHeaderFilename;
+	std::string comptimePrecompiledHeaderFilename;
 
 	// Added as a search directory for compile time code execution
 	std::string cakelispSrcDir;
@@ -510,6 +591,8 @@ bool canUseCachedFile(EvaluatorEnvironment& environment, const char* filename,
 
 void setSourceArtifactCrc(EvaluatorEnvironment& environment, const char* source,
                           const char* artifact);
+// The key of source's CRC in sourceArtifactFileCrcs, as of when artifact was last built from it
+uint32_t getSourceArtifactKey(const char* source, const char* artifact);
 
 const char* objectTypeToString(ObjectType type);
 
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stddef.h> // size_t
 #include <stdint.h> // int64_t
 
 #ifdef WINDOWS
@@ -11,7 +11,9 @@
 #include <fcntl.h>
 #include <libgen.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 #elif WINDOWS
@@ -64,6 +66,58 @@ FileModifyTime fileGetLastModificationTime(const char* filename)
 #endif
 }
 
+bool fileGetModificationTimeAndSize(const char* filename, FileModifyTime* modificationTimeOut,
+                                    uint64_t* sizeOut)
+{
+#if defined(UNIX) || defined(MACOS)
+	struct stat fileStat;
+	if (stat(filename, &fileStat) == -1)
+	{
+		if (logging.fileSystem || errno != ENOENT)
+			perror("fileGetModificationTimeAndSize: ");
+		return false;
+	}
+
+	*modificationTimeOut = (FileModifyTime)fileStat.st_mtime;
+	*sizeOut = (uint64_t)fileStat.st_size;
+	return true;
+#elif WINDOWS
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	if (!GetFileAttributesEx(filename, GetFileExInfoStandard, &attributes))
+		return false;
+
+	ULARGE_INTEGER lv_Large;
+	lv_Large.LowPart = attributes.ftLastWriteTime.dwLowDateTime;
+	lv_Large.HighPart = attributes.ftLastWriteTime.dwHighDateTime;
+	FileModifyTime ftWriteTime = (FileModifyTime)lv_Large.QuadPart;
+	*modificationTimeOut = ftWriteTime < 0 ? 0 : ftWriteTime;
+
+	lv_Large.LowPart = attributes.nFileSizeLow;
+	lv_Large.HighPart = attributes.nFileSizeHigh;
+	*sizeOut = (uint64_t)lv_Large.QuadPart;
+	return true;
+#else
+	return false;
+#endif
+}
+
+FileModifyTime fileGetCurrentTime()
+{
+#if defined(UNIX) || defined(MACOS)
+	return (FileModifyTime)time(nullptr);
+#elif WINDOWS
+	FILETIME now;
+	GetSystemTimeAsFileTime(&now);
+
+	ULARGE_INTEGER lv_Large;
+	lv_Large.LowPart = now.dwLowDateTime;
+	lv_Large.HighPart = now.dwHighDateTime;
+	return (FileModifyTime)lv_Large.QuadPart;
+#else
+	return 0;
+#endif
+}
+
 bool fileIsMoreRecentlyModified(const char* filename, const char* reference)
 {
 #if defined(UNIX) || defined(MACOS)
@@ -558,3 +612,129 @@ uint32_t getFileCrc32(const char* filename)
 	fclose(file);
 	return crc;
 }
+
+bool fileMapReadOnly(const char* filename, MappedFile* mappedFileOut, const char** errorOut)
+{
+	mappedFileOut->contents = nullptr;
+	mappedFileOut->size = 0;
+	mappedFileOut->modificationTime = 0;
+	const char* error = nullptr;
+	if (!errorOut)
+		errorOut = &error;
+
+#if defined(UNIX) || defined(MACOS)
+	int fileDescriptor = open(filename, O_RDONLY);
+	if (fileDescriptor == -1)
+	{
+		*errorOut = "could not open file";
+		return false;
+	}
+
+	struct stat fileStat;
+	if (fstat(fileDescriptor, &fileStat) == -1)
+	{
+		*errorOut = "could not get file size";
+		close(fileDescriptor);
+		return false;
+	}
+	mappedFileOut->modificationTime = (FileModifyTime)fileStat.st_mtime;
+
+	// mmap() refuses zero-length mappings
+	if (fileStat.st_size == 0)
+	{
+		close(fileDescriptor);
+		return true;
+	}
+
+	void* mapped =
+	    mmap(/*addr=*/nullptr, fileStat.st_size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+	// The mapping keeps its own reference to the file
+	close(fileDescriptor);
+	if (mapped == MAP_FAILED)
+	{
+		*errorOut = "could not map file";
+		return false;
+	}
+
+	// Callers read front to back, so let the kernel read ahead aggressively
+	posix_madvise(mapped, fileStat.st_size, POSIX_MADV_SEQUENTIAL);
+
+	mappedFileOut->contents = (const char*)mapped;
+	mappedFileOut->size = (size_t)fileStat.st_size;
+#elif WINDOWS
+	HANDLE hFile =
+	    CreateFile(filename, GENERIC_READ, FILE_SHARE_READ, /*lpSecurityAttributes=*/nullptr,
+	               OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, /*hTemplateFile=*/nullptr);
+	if (hFile == INVALID_HANDLE_VALUE)
+	{
+		*errorOut = "could not open file";
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(hFile, &fileSize))
+	{
+		*errorOut = "could not get file size";
+		CloseHandle(hFile);
+		return false;
+	}
+
+	FILETIME ftCreate, ftAccess, ftWrite;
+	if (GetFileTime(hFile, &ftCreate, &ftAccess, &ftWrite))
+	{
+		ULARGE_INTEGER lv_Large;
+		lv_Large.LowPart = ftWrite.dwLowDateTime;
+		lv_Large.HighPart = ftWrite.dwHighDateTime;
+		FileModifyTime ftWriteTime = (FileModifyTime)lv_Large.QuadPart;
+		mappedFileOut->modificationTime = ftWriteTime < 0 ? 0 : ftWriteTime;
+	}
+
+	// CreateFileMapping() refuses zero-length mappings
+	if (fileSize.QuadPart == 0)
+	{
+		CloseHandle(hFile);
+		return true;
+	}
+
+	HANDLE hMapping = CreateFileMapping(hFile, /*lpFileMappingAttributes=*/nullptr, PAGE_READONLY,
+	                                    0, 0, /*lpName=*/nullptr);
+	CloseHandle(hFile);
+	if (!hMapping)
+	{
+		*errorOut = "could not map file";
+		return false;
+	}
+
+	// The view keeps its own reference to the mapping
+	void* mapped = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(hMapping);
+	if (!mapped)
+	{
+		*errorOut = "could not map file";
+		return false;
+	}
+
+	mappedFileOut->contents = (const char*)mapped;
+	mappedFileOut->size = (size_t)fileSize.QuadPart;
+#else
+	*errorOut = "file mapping is not supported on this platform";
+	return false;
+#endif
+
+	return true;
+}
+
+void fileUnmap(MappedFile* mappedFile)
+{
+	if (!mappedFile->contents)
+		return;
+
+#if defined(UNIX) || defined(MACOS)
+	munmap((void*)mappedFile->contents, mappedFile->size);
+#elif WINDOWS
+	UnmapViewOfFile(mappedFile->contents);
+#endif
+
+	mappedFile->contents = nullptr;
+	mappedFile->size = 0;
+}
@@ -5,6 +5,12 @@
 
 // Returns zero if the file doesn't exist, or there was some other error
 CAKELISP_API FileModifyTime fileGetLastModificationTime(const char* filename);
+// Returns false if the file doesn't exist, or there was some other error
+CAKELISP_API bool fileGetModificationTimeAndSize(const char* filename,
+                                                 FileModifyTime* modificationTimeOut,
+                                                 uint64_t* sizeOut);
+// The current time, comparable to file modification times
+CAKELISP_API FileModifyTime fileGetCurrentTime();
 
 // Returns true if the reference file doesn't exist. This is under the assumption that this function
 // is always used to check whether it is necessary to e.g. build something if the source is newer
@@ -48,3 +54,19 @@ CAKELISP_API void makeBackslashFilename(char* buffer, int bufferSize, const char
 CAKELISP_API bool changeExtension(char* buffer, const char* newExtension);
 
 CAKELISP_API uint32_t getFileCrc32(const char* filename);
+
+// Read-only view of an entire file's contents. Note that contents is NOT null-terminated
+struct MappedFile
+{
+	const char* contents;
+	size_t size;
+	// Of the file as it was mapped
+	FileModifyTime modificationTime;
+};
+
+// Returns false if the file could not be opened or mapped. Empty files succeed with null contents
+// and zero size. Use fileUnmap() when done with the contents. Nothing is logged, so it can be used
+// from any thread; errorOut may be null, or is set to why it failed
+CAKELISP_API bool fileMapReadOnly(const char* filename, MappedFile* mappedFileOut,
+                                  const char** errorOut);
+CAKELISP_API void fileUnmap(MappedFile* mappedFile);
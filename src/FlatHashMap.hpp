@@ -0,0 +1,512 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <functional>  // std::hash
+#include <iterator>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>  // _BitScanReverse
+#endif
+
+// Hash map with an open-addressing index and stable value storage. Mostly a drop-in replacement
+// for the std::unordered_map subset Cakelisp uses: values are std::pair<const Key, Value>, found
+// via find()/end(), and iterated with begin()/end().
+//
+// Values live in blocks which never move, so pointers and references to values stay valid until
+// that value is erased, even while the map grows. Each block is twice the size of the one before,
+// and the first is only as big as reserve() asked for, so small maps stay small. The index is a
+// flat array of (hash, entry) slots with linear probing; hashes are computed once on insert and
+// kept in the slot, so growing never rehashes keys and most probe misses never compare keys.
+//
+// Iteration visits values in insertion order (erased entries are reused by later inserts).
+// Values inserted while iterating may or may not be visited, but iteration stays valid
+template <typename Key, typename Value, typename Hash = std::hash<Key>>
+class FlatHashMap
+{
+public:
+	typedef Key key_type;
+	typedef Value mapped_type;
+	typedef std::pair<const Key, Value> value_type;
+	typedef size_t size_type;
+
+private:
+	struct Entry
+	{
+		typename std::aligned_storage<sizeof(value_type), alignof(value_type)>::type storage;
+		bool isAlive;
+
+		value_type* value()
+		{
+			return reinterpret_cast<value_type*>(&storage);
+		}
+	};
+
+	struct Slot
+	{
+		uint32_t hash;
+		// Entry index + 1, so zeroed slots are empty
+		uint32_t entry;
+	};
+
+	// The first block has 1 << firstBlockShift entries
+	static const uint32_t minFirstBlockShift = 2;
+	static const uint32_t maxFirstBlockShift = 10;
+	static const uint32_t emptySlot = 0;
+	static const uint32_t erasedSlot = 0xffffffff;
+	static const uint32_t minNumSlots = 8;
+
+	Slot* slots;
+	uint32_t numSlots;
+	// Both live and erased slots, which each make probing longer
+	uint32_t numUsedSlots;
+
+	std::vector<Entry*> blocks;
+	uint32_t firstBlockShift;
+	// Entries [0, numEntries) have been used at some point; erased ones are in freeEntries
+	uint32_t numEntries;
+	uint32_t numAlive;
+	std::vector<uint32_t> freeEntries;
+
+	static uint32_t floorLog2(uint32_t value)
+	{
+#ifdef _MSC_VER
+		unsigned long highestBit = 0;
+		_BitScanReverse(&highestBit, value);
+		return (uint32_t)highestBit;
+#else
+		return 31 - (uint32_t)__builtin_clz(value);
+#endif
+	}
+
+	// Block n starts at entry ((1 << n) - 1) << firstBlockShift
+	Entry& entryAt(uint32_t entryIndex) const
+	{
+		uint32_t blockIndex = floorLog2((entryIndex >> firstBlockShift) + 1);
+		uint32_t blockStart = ((1u << blockIndex) - 1) << firstBlockShift;
+		return blocks[blockIndex][entryIndex - blockStart];
+	}
+
+	static uint32_t hashKey(const Key& key)
+	{
+		uint64_t hash = (uint64_t)Hash()(key);
+		return (uint32_t)(hash ^ (hash >> 32));
+	}
+
+	// Fibonacci hashing spreads out keys whose hashes are sequential, like interned string ids
+	uint32_t firstSlotIndex(uint32_t hash) const
+	{
+		return (uint32_t)(((uint64_t)hash * 0x9e3779b97f4a7c15ull) >> 32) & (numSlots - 1);
+	}
+
+	// Returns the slot index of the key, or numSlots if it isn't in the map
+	uint32_t findSlot(const Key& key, uint32_t hash) const
+	{
+		if (!numSlots)
+			return numSlots;
+
+		uint32_t slotMask = numSlots - 1;
+		for (uint32_t slotIndex = firstSlotIndex(hash);; slotIndex = (slotIndex + 1) & slotMask)
+		{
+			const Slot& slot = slots[slotIndex];
+			if (slot.entry == emptySlot)
+				return numSlots;
+			if (slot.entry != erasedSlot && slot.hash == hash &&
+			    entryAt(slot.entry - 1).value()->first == key)
+				return slotIndex;
+		}
+	}
+
+	void resizeSlots(uint32_t newNumSlots)
+	{
+		Slot* oldSlots = slots;
+		uint32_t oldNumSlots = numSlots;
+
+		slots = (Slot*)calloc(newNumSlots, sizeof(Slot));
+		numSlots = newNumSlots;
+		numUsedSlots = 0;
+
+		for (uint32_t i = 0; i < oldNumSlots; ++i)
+		{
+			const Slot& oldSlot = oldSlots[i];
+			if (oldSlot.entry == emptySlot || oldSlot.entry == erasedSlot)
+				continue;
+
+			uint32_t slotIndex = firstSlotIndex(oldSlot.hash);
+			while (slots[slotIndex].entry != emptySlot)
+				slotIndex = (slotIndex + 1) & (numSlots - 1);
+			slots[slotIndex] = oldSlot;
+			++numUsedSlots;
+		}
+
+		free(oldSlots);
+	}
+
+	uint32_t allocateEntry()
+	{
+		if (!freeEntries.empty())
+		{
+			uint32_t entryIndex = freeEntries.back();
+			freeEntries.pop_back();
+			return entryIndex;
+		}
+
+		uint32_t numBlocks = (uint32_t)blocks.size();
+		if (numEntries == ((1u << numBlocks) - 1) << firstBlockShift)
+			blocks.push_back(new Entry[1u << (firstBlockShift + numBlocks)]());
+		return numEntries++;
+	}
+
+	template <typename KeyArg, typename... ValueArgs>
+	std::pair<uint32_t, bool> insertEntry(KeyArg&& key, ValueArgs&&... valueArgs)
+	{
+		uint32_t hash = hashKey(key);
+
+		// Keep at most 3/4 of slots used. Erased slots count, so mostly-erased tables get cleaned
+		// up instead of growing
+		if ((numUsedSlots + 1) * 4 > numSlots * 3)
+		{
+			uint32_t newNumSlots = numSlots ? numSlots : minNumSlots;
+			while ((numAlive + 1) * 2 > newNumSlots)
+				newNumSlots *= 2;
+			resizeSlots(newNumSlots);
+		}
+
+		uint32_t insertSlotIndex = numSlots;
+		uint32_t slotMask = numSlots - 1;
+		for (uint32_t slotIndex = firstSlotIndex(hash);; slotIndex = (slotIndex + 1) & slotMask)
+		{
+			const Slot& slot = slots[slotIndex];
+			if (slot.entry == emptySlot)
+			{
+				if (insertSlotIndex == numSlots)
+				{
+					insertSlotIndex = slotIndex;
+					++numUsedSlots;
+				}
+				break;
+			}
+
+			if (slot.entry == erasedSlot)
+			{
+				if (insertSlotIndex == numSlots)
+					insertSlotIndex = slotIndex;
+				continue;
+			}
+
+			if (slot.hash == hash && entryAt(slot.entry - 1).value()->first == key)
+				return std::make_pair(slot.entry - 1, false);
+		}
+
+		uint32_t entryIndex = allocateEntry();
+		Entry& entry = entryAt(entryIndex);
+		new (&entry.storage)
+		    value_type(std::piecewise_construct, std::forward_as_tuple(std::forward<KeyArg>(key)),
+		               std::forward_as_tuple(std::forward<ValueArgs>(valueArgs)...));
+		entry.isAlive = true;
+		++numAlive;
+
+		slots[insertSlotIndex].hash = hash;
+		slots[insertSlotIndex].entry = entryIndex + 1;
+		return std::make_pair(entryIndex, true);
+	}
+
+	void eraseSlot(uint32_t slotIndex)
+	{
+		uint32_t entryIndex = slots[slotIndex].entry - 1;
+		slots[slotIndex].entry = erasedSlot;
+
+		Entry& entry = entryAt(entryIndex);
+		entry.value()->~value_type();
+		entry.isAlive = false;
+		--numAlive;
+		freeEntries.push_back(entryIndex);
+	}
+
+	uint32_t nextAliveEntry(uint32_t entryIndex) const
+	{
+		while (entryIndex < numEntries && !entryAt(entryIndex).isAlive)
+			++entryIndex;
+		return entryIndex;
+	}
+
+public:
+	template <bool IsConst>
+	class Iterator
+	{
+	public:
+		typedef std::forward_iterator_tag iterator_category;
+		typedef typename FlatHashMap::value_type value_type;
+		typedef ptrdiff_t difference_type;
+		typedef typename std::conditional<IsConst, const value_type*, value_type*>::type pointer;
+		typedef typename std::conditional<IsConst, const value_type&, value_type&>::type reference;
+		typedef
+		    typename std::conditional<IsConst, const FlatHashMap*, FlatHashMap*>::type MapPointer;
+
+		Iterator() : map(nullptr), entryIndex(0)
+		{
+		}
+		Iterator(MapPointer inMap, uint32_t inEntryIndex) : map(inMap), entryIndex(inEntryIndex)
+		{
+		}
+		// Allow iterator to const_iterator
+		template <bool OtherIsConst,
+		          typename = typename std::enable_if<IsConst && !OtherIsConst>::type>
+		Iterator(const Iterator<OtherIsConst>& other) : map(other.map), entryIndex(other.entryIndex)
+		{
+		}
+
+		reference operator*() const
+		{
+			return *map->entryAt(entryIndex).value();
+		}
+		pointer operator->() const
+		{
+			return map->entryAt(entryIndex).value();
+		}
+
+		Iterator& operator++()
+		{
+			entryIndex = map->nextAliveEntry(entryIndex + 1);
+			return *this;
+		}
+		Iterator operator++(int)
+		{
+			Iterator previous = *this;
+			++(*this);
+			return previous;
+		}
+
+		template <bool OtherIsConst>
+		bool operator==(const Iterator<OtherIsConst>& other) const
+		{
+			return entryIndex == other.entryIndex && map == other.map;
+		}
+		template <bool OtherIsConst>
+		bool operator!=(const Iterator<OtherIsConst>& other) const
+		{
+			return !(*this == other);
+		}
+
+	private:
+		friend class FlatHashMap;
+		template <bool>
+		friend class Iterator;
+
+		MapPointer map;
+		uint32_t entryIndex;
+	};
+
+	typedef Iterator<false> iterator;
+	typedef Iterator<true> const_iterator;
+
+	FlatHashMap()
+	    : slots(nullptr),
+	      numSlots(0),
+	      numUsedSlots(0),
+	      firstBlockShift(minFirstBlockShift),
+	      numEntries(0),
+	      numAlive(0)
+	{
+	}
+
+	FlatHashMap(const FlatHashMap& other) : FlatHashMap()
+	{
+		reserve(other.size());
+		for (const value_type& value : other)
+			insertEntry(value.first, value.second);
+	}
+
+	FlatHashMap(FlatHashMap&& other) : FlatHashMap()
+	{
+		swap(other);
+	}
+
+	FlatHashMap& operator=(FlatHashMap other)
+	{
+		swap(other);
+		return *this;
+	}
+
+	~FlatHashMap()
+	{
+		clear();
+		for (Entry* block : blocks)
+			delete[] block;
+		free(slots);
+	}
+
+	void swap(FlatHashMap& other)
+	{
+		std::swap(slots, other.slots);
+		std::swap(numSlots, other.numSlots);
+		std::swap(numUsedSlots, other.numUsedSlots);
+		blocks.swap(other.blocks);
+		std::swap(firstBlockShift, other.firstBlockShift);
+		std::swap(numEntries, other.numEntries);
+		std::swap(numAlive, other.numAlive);
+		freeEntries.swap(other.freeEntries);
+	}
+
+	iterator begin()
+	{
+		return iterator(this, nextAliveEntry(0));
+	}
+	const_iterator begin() const
+	{
+		return const_iterator(this, nextAliveEntry(0));
+	}
+	iterator end()
+	{
+		return iterator(this, numEntries);
+	}
+	const_iterator end() const
+	{
+		return const_iterator(this, numEntries);
+	}
+
+	size_type size() const
+	{
+		return numAlive;
+	}
+	bool empty() const
+	{
+		return numAlive == 0;
+	}
+
+	void clear()
+	{
+		for (uint32_t i = 0; i < numEntries; ++i)
+		{
+			Entry& entry = entryAt(i);
+			if (entry.isAlive)
+			{
+				entry.value()->~value_type();
+				entry.isAlive = false;
+			}
+		}
+		numEntries = 0;
+		numAlive = 0;
+		freeEntries.clear();
+
+		if (slots)
+		{
+			for (uint32_t i = 0; i < numSlots; ++i)
+				slots[i].entry = emptySlot;
+		}
+		numUsedSlots = 0;
+	}
+
+	void reserve(size_type count)
+	{
+		// Later blocks keep doubling, so only the first one can be sized to fit
+		if (blocks.empty())
+		{
+			while (firstBlockShift < maxFirstBlockShift &&
+			       ((size_type)1 << firstBlockShift) < count)
+				++firstBlockShift;
+		}
+
+		uint32_t newNumSlots = numSlots ? numSlots : minNumSlots;
+		while (count * 4 > (size_type)newNumSlots * 3)
+			newNumSlots *= 2;
+		if (newNumSlots != numSlots)
+			resizeSlots(newNumSlots);
+	}
+
+	iterator find(const Key& key)
+	{
+		uint32_t slotIndex = findSlot(key, hashKey(key));
+		if (slotIndex == numSlots)
+			return end();
+		return iterator(this, slots[slotIndex].entry - 1);
+	}
+	const_iterator find(const Key& key) const
+	{
+		uint32_t slotIndex = findSlot(key, hashKey(key));
+		if (slotIndex == numSlots)
+			return end();
+		return const_iterator(this, slots[slotIndex].entry - 1);
+	}
+
+	size_type count(const Key& key) const
+	{
+		return findSlot(key, hashKey(key)) == numSlots ? 0 : 1;
+	}
+
+	Value& operator[](const Key& key)
+	{
+		return entryAt(insertEntry(key).first).value()->second;
+	}
+
+	Value& at(const Key& key)
+	{
+		iterator findIt = find(key);
+		if (findIt == end())
+			abort();
+		return findIt->second;
+	}
+	const Value& at(const Key& key) const
+	{
+		const_iterator findIt = find(key);
+		if (findIt == end())
+			abort();
+		return findIt->second;
+	}
+
+	template <typename KeyArg, typename ValueArg>
+	std::pair<iterator, bool> insert(const std::pair<KeyArg, ValueArg>& value)
+	{
+		std::pair<uint32_t, bool> result = insertEntry(value.first, value.second);
+		return std::make_pair(iterator(this, result.first), result.second);
+	}
+	template <typename KeyArg, typename ValueArg>
+	std::pair<iterator, bool> insert(std::pair<KeyArg, ValueArg>&& value)
+	{
+		std::pair<uint32_t, bool> result =
+		    insertEntry(std::forward<KeyArg>(value.first), std::forward<ValueArg>(value.second));
+		return std::make_pair(iterator(this, result.first), result.second);
+	}
+
+	template <typename Pair>
+	std::pair<iterator, bool> emplace(Pair&& value)
+	{
+		return insert(std::forward<Pair>(value));
+	}
+	template <typename KeyArg, typename ValueArg>
+	std::pair<iterator, bool> emplace(KeyArg&& key, ValueArg&& value)
+	{
+		std::pair<uint32_t, bool> result =
+		    insertEntry(std::forward<KeyArg>(key), std::forward<ValueArg>(value));
+		return std::make_pair(iterator(this, result.first), result.second);
+	}
+
+	// Returns the iterator following the erased value
+	iterator erase(const_iterator position)
+	{
+		uint32_t entryIndex = position.entryIndex;
+		const Key& key = entryAt(entryIndex).value()->first;
+		eraseSlot(findSlot(key, hashKey(key)));
+		return iterator(this, nextAliveEntry(entryIndex + 1));
+	}
+	iterator erase(iterator position)
+	{
+		return erase(const_iterator(position));
+	}
+
+	size_type erase(const Key& key)
+	{
+		uint32_t slotIndex = findSlot(key, hashKey(key));
+		if (slotIndex == numSlots)
+			return 0;
+		eraseSlot(slotIndex);
+		return 1;
+	}
+};
@@ -25,6 +25,10 @@ int FindCloseParenTokenIndex(const std::vector<Token>& tokens, int startTokenInd
 	if (tokens[startTokenIndex].type != TokenType_OpenParen)
 		Log("Warning: FindCloseParenTokenIndex() expects to start on the opening parenthesis\n");
 
+	int matchingParenIndex = findMatchingParenIndex(tokens, startTokenIndex);
+	if (matchingParenIndex != -1)
+		return matchingParenIndex;
+
 	int depth = 0;
 	int numTokens = tokens.size();
 	for (int i = startTokenIndex; i < numTokens; ++i)
@@ -248,6 +252,11 @@ const Token* FindTokenExpressionEnd(const Token* startToken)
 {
 	if (startToken->type != TokenType_OpenParen)
 		return startToken;
+
+	const Token* matchingParenToken = findMatchingParenToken(startToken);
+	if (matchingParenToken)
+		return matchingParenToken;
+
 	int depth = 0;
 	for (const Token* currentToken = startToken; depth >= 0; ++currentToken)
 	{
@@ -281,31 +290,25 @@ const Token* FindTokenBodyEnd(const Token* startToken)
 	return nullptr;
 }
 
+// Expansion tokens, keyed by the macro invocation they replace
+typedef FlatHashMap<const Token*, const std::vector<Token>*> MacroExpansionTable;
+
 static void CopyTokensWithMacrosExpanded_Recursive(const Token* startToken, const Token* endToken,
-                                                   const std::vector<MacroExpansion>& expansions,
+                                                   const MacroExpansionTable& expansions,
                                                    std::vector<Token>& tokensOut)
 {
 	for (const Token* currentToken = startToken; currentToken <= endToken;)
 	{
-		// TODO: Performance: O(nm)
-		bool macroFound = false;
-		for (const MacroExpansion& expansion : expansions)
+		MacroExpansionTable::const_iterator findIt = expansions.find(currentToken);
+		if (findIt != expansions.end())
 		{
-			if (currentToken == expansion.atToken)
-			{
-				unsigned int numTokensInExpansion = expansion.tokens->size();
-				tokensOut.reserve(tokensOut.size() + numTokensInExpansion);
-				CopyTokensWithMacrosExpanded_Recursive(
-				    &(*expansion.tokens)[0], &(*expansion.tokens)[numTokensInExpansion - 1],
-				    expansions, tokensOut);
-
-				macroFound = true;
-				break;
-			}
-		}
+			const std::vector<Token>& expansionTokens = *findIt->second;
+			unsigned int numTokensInExpansion = expansionTokens.size();
+			tokensOut.reserve(tokensOut.size() + numTokensInExpansion);
+			CopyTokensWithMacrosExpanded_Recursive(&expansionTokens[0],
+			                                       &expansionTokens[numTokensInExpansion - 1],
+			                                       expansions, tokensOut);
 
-		if (macroFound)
-		{
 			// Skip the macro invocation; we've already replaced it with the expansion
 			currentToken = FindTokenExpressionEnd(currentToken);
 			++currentToken;
@@ -347,8 +350,16 @@ bool CreateDefinitionCopyMacroExpanded(const ObjectDefinition& definition,
 		// It may be a bit larger or smaller depending on whether macros output more or less tokens
 		tokensOut.reserve((endToken - definition.definitionInvocation) + 1);
 
+		MacroExpansionTable expansions;
+		for (const MacroExpansion& expansion : definition.macroExpansions)
+		{
+			// A macro re-run at the same token (e.g. its definition was re-evaluated) has a later
+			// expansion. Keep the first, as the scan this replaced did
+			expansions.insert(std::make_pair(expansion.atToken, expansion.tokens));
+		}
+
 		CopyTokensWithMacrosExpanded_Recursive(definition.definitionInvocation, endToken,
-		                                       definition.macroExpansions, tokensOut);
+		                                       expansions, tokensOut);
 	}
 
 	return true;
@@ -417,16 +428,39 @@ void addModifierToStringOutput(StringOutput& operation, StringOutputModifierFlag
 	operation.modifiers = (StringOutputModifierFlags)((int)operation.modifiers | (int)flag);
 }
 
-void addStringOutput(std::vector<StringOutput>& output, const std::string& symbol,
-                     StringOutputModifierFlags modifiers, const Token* startToken)
+static void addStringOutputText(std::vector<StringOutput>& output, const char* text,
+                                size_t length, StringOutputModifierFlags modifiers,
+                                const Token* startToken)
 {
 	StringOutput newStringOutput = {};
 	newStringOutput.modifiers = modifiers;
 	newStringOutput.startToken = startToken;
 
-	newStringOutput.output = symbol;
+	newStringOutput.output = text;
+	newStringOutput.outputLength = length;
 
-	output.push_back(std::move(newStringOutput));
+	output.push_back(newStringOutput);
+}
+
+void addStringOutput(std::vector<StringOutput>& output, const std::string& symbol,
+                     StringOutputModifierFlags modifiers, const Token* startToken)
+{
+	addStringOutputText(output, outputTextAdd(symbol.data(), symbol.size()), symbol.size(),
+	                    modifiers, startToken);
+}
+
+void addStringOutput(std::vector<StringOutput>& output, const char* symbol,
+                     StringOutputModifierFlags modifiers, const Token* startToken)
+{
+	size_t length = strlen(symbol);
+	addStringOutputText(output, outputTextAdd(symbol, length), length, modifiers, startToken);
+}
+
+void addStringOutput(std::vector<StringOutput>& output, const TokenContents& symbol,
+                     StringOutputModifierFlags modifiers, const Token* startToken)
+{
+	// Interned strings are never freed, so there's no need to copy them
+	addStringOutputText(output, symbol.c_str(), symbol.size(), modifiers, startToken);
 }
 
 void addLangTokenOutput(std::vector<StringOutput>& output, StringOutputModifierFlags modifiers,
@@ -1041,7 +1075,9 @@ bool CStatementOutput(EvaluatorEnvironment& environment, const EvaluatorContext&
 				EvaluatorContext bodyContext = context;
 				bodyContext.scope = EvaluatorScope_ExpressionsOnly;
 				StringOutput spliceDelimiterTemplate = {};
-				spliceDelimiterTemplate.output = operation[i].keywordOrSymbol;
+				spliceDelimiterTemplate.outputLength = strlen(operation[i].keywordOrSymbol);
+				spliceDelimiterTemplate.output = outputTextAdd(operation[i].keywordOrSymbol,
+				                                               spliceDelimiterTemplate.outputLength);
 				if (operation[i].type != SpliceNoSpace)
 				{
 					addModifierToStringOutput(spliceDelimiterTemplate, StringOutMod_SpaceBefore);
@@ -1314,14 +1350,6 @@ void TokenizePushSpliceTokenExpression(TokenizePushContext* spliceContext, const
 	spliceContext->spliceArguments.push_back(newArgument);
 }
 
-static const Token* getNextExpression(const Token* token)
-{
-	if (token->type != TokenType_OpenParen)
-		return token + 1;
-
-	return FindTokenExpressionEnd(token) + 1;
-}
-
 bool TokenizePushExecute(EvaluatorEnvironment& environment, const char* definitionName,
                          uint32_t tokensCrc, TokenizePushContext* spliceContext,
                          std::vector<Token>& output)
@@ -1333,72 +1361,56 @@ bool TokenizePushExecute(EvaluatorEnvironment& environment, const char* definiti
 		return false;
 	}
 
-	TokenizePushTokensMap::iterator findIt = definition->tokenizePushTokens.find(tokensCrc);
-	if (findIt == definition->tokenizePushTokens.end())
+	TokenizePushPlanMap::iterator findIt = definition->tokenizePushPlans.find(tokensCrc);
+	if (findIt == definition->tokenizePushPlans.end())
 	{
 		Logf("error: could not find tokens with CRC %u in definition %s\n", tokensCrc,
 		     definitionName);
 		return false;
 	}
 
-	const Token* startToken = findIt->second;
-	const Token* endToken = FindTokenBodyEnd(startToken);
 	int currentSpliceArgument = 0;
 	int numSpliceArguments = (int)spliceContext->spliceArguments.size();
 
-	for (const Token* currentToken = startToken; currentToken != endToken; ++currentToken)
+	for (const TokenizePushPlanStep& step : findIt->second.steps)
 	{
-		const Token* nextToken = currentToken + 1;
-		if (currentToken->type == TokenType_OpenParen && nextToken->type == TokenType_Symbol &&
-		    (nextToken->contents.compare("token-splice") == 0 ||
-		     nextToken->contents.compare("token-splice-addr") == 0 ||
-		     nextToken->contents.compare("token-splice-array") == 0 ||
-		     nextToken->contents.compare("token-splice-rest") == 0))
+		output.insert(output.end(), step.literalTokens,
+		              step.literalTokens + step.numLiteralTokens);
+
+		for (int i = 0; i < step.numSpliceArguments; ++i)
 		{
-			const Token* endSpliceToken = FindTokenExpressionEnd(currentToken);
-			const Token* startSpliceToken = currentToken + 2;
-			for (const Token* currentSpliceToken = startSpliceToken;
-			     currentSpliceToken != endSpliceToken;
-			     currentSpliceToken = getNextExpression(currentSpliceToken))
+			if (currentSpliceArgument >= numSpliceArguments)
 			{
-				if (currentSpliceArgument >= numSpliceArguments)
-				{
-					Log("error: splice arguments are out of sync with context. Code error?\n");
-					return false;
-				}
-
-				const TokenizePushSpliceArgument& argument =
-				    spliceContext->spliceArguments[currentSpliceArgument];
-				++currentSpliceArgument;
+				Log("error: splice arguments are out of sync with context. Code error?\n");
+				return false;
+			}
 
-				// TODO Validate splice type matches!
-				// Perform the splice
-				bool shouldBreak = false;
-				switch (argument.type)
-				{
-					case TokenizePushSpliceArgument_Array:
-						PushBackAll(output, *argument.sourceTokens);
-						break;
-					case TokenizePushSpliceArgument_AllExpressions:
-						PushBackAllTokenExpressions(output, argument.startToken,
-						                            &argument.sourceTokens->back());
-						shouldBreak = true;
-						break;
-					case TokenizePushSpliceArgument_Expression:
-						PushBackTokenExpression(output, argument.startToken);
-						break;
-				}
+			const TokenizePushSpliceArgument& argument =
+			    spliceContext->spliceArguments[currentSpliceArgument];
+			++currentSpliceArgument;
 
-				// Some splices only accept one iteration
-				if (shouldBreak)
+			// TODO Validate splice type matches!
+			// Perform the splice
+			bool shouldBreak = false;
+			switch (argument.type)
+			{
+				case TokenizePushSpliceArgument_Array:
+					PushBackAll(output, *argument.sourceTokens);
+					break;
+				case TokenizePushSpliceArgument_AllExpressions:
+					PushBackAllTokenExpressions(output, argument.startToken,
+					                            &argument.sourceTokens->back());
+					shouldBreak = true;
+					break;
+				case TokenizePushSpliceArgument_Expression:
+					PushBackTokenExpression(output, argument.startToken);
 					break;
 			}
 
-			// Skip over the token-splice so it isn't output
-			currentToken = endSpliceToken;
+			// Some splices only accept one iteration
+			if (shouldBreak)
+				break;
 		}
-		else
-			output.push_back(*currentToken);
 	}
 
 	return true;
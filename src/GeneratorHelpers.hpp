@@ -14,6 +14,7 @@ struct EvaluatorEnvironment;
 struct GeneratorOutput;
 struct StringOutput;
 struct ObjectDefinition;
+class TokenContents;
 
 void StripInvocation(int& startTokenIndex, int& endTokenIndex);
 CAKELISP_API int FindCloseParenTokenIndex(const std::vector<Token>& tokens, int startTokenIndex);
@@ -94,6 +95,10 @@ void addModifierToStringOutput(StringOutput& operation, StringOutputModifierFlag
 
 CAKELISP_API void addStringOutput(std::vector<StringOutput>& output, const std::string& symbol,
                                   StringOutputModifierFlags modifiers, const Token* startToken);
+CAKELISP_API void addStringOutput(std::vector<StringOutput>& output, const char* symbol,
+                                  StringOutputModifierFlags modifiers, const Token* startToken);
+CAKELISP_API void addStringOutput(std::vector<StringOutput>& output, const TokenContents& symbol,
+                                  StringOutputModifierFlags modifiers, const Token* startToken);
 CAKELISP_API void addLangTokenOutput(std::vector<StringOutput>& output,
                                      StringOutputModifierFlags modifiers, const Token* startToken);
 // Splice marker must be pushed to both source and header to preserve ordering in case spliceOutput
@@ -74,6 +74,7 @@ bool SetProcessCommandArguments(EvaluatorEnvironment& environment, const std::ve
 			    {"'cakelisp-headers-include", ProcessCommandArgumentType_CakelispHeadersInclude},
 			    {"'include-search-dirs", ProcessCommandArgumentType_IncludeSearchDirs},
 			    {"'additional-options", ProcessCommandArgumentType_AdditionalOptions},
+			    {"'dependency-file-output", ProcessCommandArgumentType_DependencyFileOutput},
 			    {"'precompiled-header-output", ProcessCommandArgumentType_PrecompiledHeaderOutput},
 			    {"'precompiled-header-include",
 			     ProcessCommandArgumentType_PrecompiledHeaderInclude},
@@ -2421,9 +2422,17 @@ bool TokenizePushGenerator(EvaluatorEnvironment& environment, const EvaluatorCon
 	                &tokens[startTokenIndex]);
 	addLangTokenOutput(output.source, StringOutMod_EndStatement, &tokens[startTokenIndex]);
 
+	static const InternedString tokenSpliceId = internString("token-splice");
+	static const InternedString tokenSpliceAddrId = internString("token-splice-addr");
+	static const InternedString tokenSpliceArrayId = internString("token-splice-array");
+	static const InternedString tokenSpliceRestId = internString("token-splice-rest");
+
 	// Generate the CRC in order to retrieve the token list at macro runtime
 	uint32_t tokensCrc = 0;
 
+	TokenizePushPlan plan;
+	int startLiteralTokens = startOutputToken;
+
 	for (int i = startOutputToken; i < endInvocationIndex; ++i)
 	{
 		const Token& currentToken = tokens[i];
@@ -2453,16 +2462,16 @@ bool TokenizePushGenerator(EvaluatorEnvironment& environment, const EvaluatorCon
 
 		// We only need to generate code when splices are referenced. Otherwise, the tokens are
 		// pushed when executing the tokenize push
+		InternedString nextTokenId = nextToken.contents.internedId();
 		if (currentToken.type == TokenType_OpenParen && nextToken.type == TokenType_Symbol &&
-		    (nextToken.contents.compare("token-splice") == 0 ||
-		     nextToken.contents.compare("token-splice-addr") == 0 ||
-		     nextToken.contents.compare("token-splice-array") == 0 ||
-		     nextToken.contents.compare("token-splice-rest") == 0))
+		    (nextTokenId == tokenSpliceId || nextTokenId == tokenSpliceAddrId ||
+		     nextTokenId == tokenSpliceArrayId || nextTokenId == tokenSpliceRestId))
 		{
-			// TODO: Performance: remove extra string compares
-			bool isArray = nextToken.contents.compare("token-splice-array") == 0;
-			bool isRest = nextToken.contents.compare("token-splice-rest") == 0;
-			bool tokenMakePointer = isArray || nextToken.contents.compare("token-splice-addr") == 0;
+			bool isArray = nextTokenId == tokenSpliceArrayId;
+			bool isRest = nextTokenId == tokenSpliceRestId;
+			bool tokenMakePointer = isArray || nextTokenId == tokenSpliceAddrId;
+
+			TokenizePushPlanStep step = {&tokens[startLiteralTokens], i - startLiteralTokens, 0};
 
 			// Skip invocation
 			int startSpliceArgs = i + 2;
@@ -2470,6 +2479,8 @@ bool TokenizePushGenerator(EvaluatorEnvironment& environment, const EvaluatorCon
 			for (int spliceArg = startSpliceArgs; spliceArg < endSpliceIndex;
 			     spliceArg = getNextArgument(tokens, spliceArg, endSpliceIndex))
 			{
+				++step.numSpliceArguments;
+
 				if (isArray)
 					addStringOutput(output.source, "TokenizePushSpliceArray(", StringOutMod_None,
 					                &tokens[spliceArg]);
@@ -2532,17 +2543,27 @@ bool TokenizePushGenerator(EvaluatorEnvironment& environment, const EvaluatorCon
 					break;
 			}
 
+			plan.steps.push_back(step);
+
 			// Finished splice list
 			i = endSpliceIndex;
+			startLiteralTokens = endSpliceIndex + 1;
 		}
 	}
 
+	if (startLiteralTokens < endInvocationIndex)
+	{
+		TokenizePushPlanStep step = {&tokens[startLiteralTokens],
+		                             endInvocationIndex - startLiteralTokens, 0};
+		plan.steps.push_back(step);
+	}
+
 	// Add the tokens for later retrieval
 	{
 		// TODO: Detect collisions via comparing tokens if pointer is different and tokens are
-		// different TokenizePushTokensMap::iterator findIt =
-		// definition.tokenizePushTokens.find(tokensCrc);
-		// if (findIt != definition.tokenizePushTokens.end())
+		// different TokenizePushPlanMap::iterator findIt =
+		// definition.tokenizePushPlans.find(tokensCrc);
+		// if (findIt != definition.tokenizePushPlans.end())
 		// {
 		// if (findIt.second != &tokens[startOutputToken])
 		// {
@@ -2559,7 +2580,7 @@ bool TokenizePushGenerator(EvaluatorEnvironment& environment, const EvaluatorCon
 			              context.definitionName->contents.c_str());
 			return false;
 		}
-		definition->tokenizePushTokens[tokensCrc] = &tokens[startOutputToken];
+		definition->tokenizePushPlans[tokensCrc] = std::move(plan);
 	}
 
 	addStringOutput(output.source, "if (!TokenizePushExecute(", StringOutMod_None,
@@ -57,6 +57,8 @@ int main(int numArguments, char* arguments[])
 	bool ignoreCachedFiles = false;
 	bool executeOutput = false;
 	bool skipBuild = false;
+	bool disableComptimeBatching = false;
+	bool useCompilerDependencyFiles = false;
 	bool listBuiltInGeneratorsThenQuit = false;
 	bool listBuiltInGeneratorMetadataThenQuit = false;
 	bool waitForDebugger = false;
@@ -70,6 +72,15 @@ int main(int numArguments, char* arguments[])
 	     "source file hasn't been modified more recently). This is a good way to test a 'clean' "
 	     "build without having to delete the Cakelisp cache directory"},
 	    {"--skip-build", &skipBuild, "Only output generate files. Do not compile or link them."},
+	    {"--no-comptime-batching", &disableComptimeBatching,
+	     "Compile and link each compile-time macro and generator on its own, rather than batching "
+	     "those built at the same time into a few translation units. This makes compile errors "
+	     "and debugging of compile-time code easier to follow"},
+	    {"--compiler-dependency-files", &useCompilerDependencyFiles,
+	     "Have the compiler write the files each object depends on (e.g. -MMD on GCC and Clang), "
+	     "then check only those files on the next build, instead of scanning #includes. This is "
+	     "exact, and avoids reading headers every build. Compilers without Makefile-style "
+	     "dependency output (e.g. cl.exe) still have their #includes scanned"},
 	    {"--execute", &executeOutput,
 	     "If building completes successfully, run the output executable. Its working directory "
 	     "will be the final location of the executable. This allows Cakelisp code to be run as if "
@@ -270,11 +281,20 @@ int main(int numArguments, char* arguments[])
 		return 1;
 	}
 
+	// These also apply to managers created at compile-time, e.g. by runtime/Cakelisp.cake
+	if (disableComptimeBatching)
+		g_moduleManagerDefaults.comptimeBatchBuilds = false;
+	if (useCompilerDependencyFiles)
+		g_moduleManagerDefaults.useCompilerDependencyFiles = true;
+
 	ModuleManager moduleManager = {};
 	moduleManagerInitialize(moduleManager);
 
 	// Set options after initialization
 	{
+		// Every path destroys the manager right before exiting
+		moduleManager.environment.skipFreeOnDestroy = true;
+
 		if (ignoreCachedFiles)
 		{
 			Log("cache will be used for output, but files from previous runs will be ignored "
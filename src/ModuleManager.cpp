@@ -2,7 +2,11 @@
 
 #include <string.h>
 
+#include <chrono>
+#include <condition_variable>
 #include <cstring>
+#include <mutex>
+#include <thread>
 
 #include "Build.hpp"
 #include "Converters.hpp"
@@ -28,6 +32,9 @@
 const char* g_modulePreBuildHookSignature =
     "('manager (& ModuleManager) 'module (* Module) &return bool)";
 
+ModuleManagerDefaults g_moduleManagerDefaults = {/*comptimeBatchBuilds=*/true,
+                                                 /*useCompilerDependencyFiles=*/false};
+
 void listBuiltInGenerators()
 {
 	EvaluatorEnvironment environment;
@@ -40,8 +47,228 @@ void listBuiltInGenerators()
 	environmentDestroyInvalidateTokens(environment);
 }
 
+//
+// Token cache
+//
+
+// Unchanged files (runtime helpers, Cache.cake from no-op builds, etc.) are loaded from a binary
+// copy of their validated tokens instead of being tokenized again. Each source file has one cache
+// file, which is only used if the CRC of the entire source still matches.
+// Increment the version whenever the layout below or the tokenizer's output changes
+static const uint32_t g_tokenCacheMagic = 0x6b6f7443;  // "Ctok"
+static const uint32_t g_tokenCacheVersion = 1;
+static const char* g_tokenCacheDirName = "tokens";
+
+int g_numTokenCacheHits = 0;
+
+// Layout: TokenCacheHeader, TokenCacheEntry[numTokens], uint32_t stringOffsets[numStrings + 1],
+// uint8_t types[numTokens], char strings[stringsSize]
+// Each distinct contents string is only stored once. String 0 is always empty
+struct TokenCacheHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t sourceCrc;
+	uint32_t sourceSize;
+	uint32_t numTokens;
+	uint32_t numStrings;
+	uint32_t stringsSize;
+};
+
+struct TokenCacheEntry
+{
+	uint32_t contentsIndex;
+	uint32_t lineNumber;
+	uint32_t columnStart;
+	uint32_t columnEnd;
+};
+
+static void getTokenCacheFilename(const char* filename, char* bufferOut, int bufferSize)
+{
+	char sourceName[MAX_NAME_LENGTH] = {0};
+	getFilenameFromPath(filename, sourceName, sizeof(sourceName));
+
+	// Files with the same name in different directories need separate caches
+	uint32_t pathCrc = 0;
+	crc32(filename, strlen(filename), &pathCrc);
+
+	SafeSnprintf(bufferOut, bufferSize, "%s/%s/%s_%08x.tokens", cakelispWorkingDir,
+	             g_tokenCacheDirName, sourceName, pathCrc);
+}
+
+// Returns false if the cache is out of date. This is not an error; the file should be tokenized
+// Parens are paired up as the tokens are read, so cached tokens don't need validating again
+// Nothing is logged, so this can be run on a prefetch thread
+static bool tokenCacheRead(const char* cacheFilename, const char* source, uint32_t sourceCrc,
+                           uint32_t sourceSize, std::vector<Token>& tokensOut,
+                           TokenBalanceCheck& checkOut)
+{
+	MappedFile cacheFile;
+	if (!fileMapReadOnly(cacheFilename, &cacheFile, /*errorOut=*/nullptr))
+		return false;
+
+	bool isValid = false;
+	const TokenCacheHeader* header = (const TokenCacheHeader*)cacheFile.contents;
+	if (cacheFile.size >= sizeof(TokenCacheHeader) && header->magic == g_tokenCacheMagic &&
+	    header->version == g_tokenCacheVersion && header->sourceCrc == sourceCrc &&
+	    header->sourceSize == sourceSize && header->numStrings)
+	{
+		size_t expectedSize = sizeof(TokenCacheHeader) +
+		                      (header->numTokens * sizeof(TokenCacheEntry)) +
+		                      ((header->numStrings + 1) * sizeof(uint32_t)) + header->numTokens +
+		                      header->stringsSize;
+		isValid = cacheFile.size == expectedSize;
+	}
+
+	if (isValid)
+	{
+		const TokenCacheEntry* entries = (const TokenCacheEntry*)(header + 1);
+		const uint32_t* stringOffsets = (const uint32_t*)(entries + header->numTokens);
+		const uint8_t* types = (const uint8_t*)(stringOffsets + header->numStrings + 1);
+		const char* strings = (const char*)(types + header->numTokens);
+
+		// Each distinct string only needs to be interned once
+		std::vector<InternedString> internedStrings(header->numStrings, 0);
+		for (uint32_t stringIndex = 0; stringIndex < header->numStrings; ++stringIndex)
+		{
+			uint32_t stringStart = stringOffsets[stringIndex];
+			uint32_t stringEnd = stringOffsets[stringIndex + 1];
+			if (stringStart > stringEnd || stringEnd > header->stringsSize)
+			{
+				isValid = false;
+				break;
+			}
+			internedStrings[stringIndex] =
+			    internString(strings + stringStart, stringEnd - stringStart);
+		}
+
+		if (isValid)
+			tokensOut.reserve(header->numTokens);
+		tokenBalanceCheckBegin(checkOut);
+		for (uint32_t i = 0; isValid && i < header->numTokens; ++i)
+		{
+			const TokenCacheEntry& entry = entries[i];
+			if (entry.contentsIndex >= header->numStrings || types[i] > TokenType_HereString)
+			{
+				isValid = false;
+				break;
+			}
+
+			Token token;
+			token.type = (TokenType)types[i];
+			token.contents = TokenContents::fromInterned(internedStrings[entry.contentsIndex]);
+			token.source = source;
+			token.lineNumber = entry.lineNumber;
+			token.columnStart = (int)entry.columnStart;
+			token.columnEnd = (int)entry.columnEnd;
+			if (token.type == TokenType_OpenParen || token.type == TokenType_CloseParen)
+				tokenBalanceCheckParen(checkOut, token.type, (int)tokensOut.size());
+			tokensOut.push_back(token);
+		}
+
+		// Only valid tokens are written, so anything else means the cache was tampered with
+		if (isValid)
+		{
+			tokenBalanceCheckFinish(checkOut, tokensOut);
+			isValid = checkOut.unmatchedParens.empty() && checkOut.unterminatedStringIndex == -1;
+		}
+	}
+
+	fileUnmap(&cacheFile);
+
+	if (!isValid)
+		tokensOut.clear();
+
+	return isValid;
+}
+
+// Failing to write the cache is not an error, the file will just be tokenized again next time
+static void tokenCacheWrite(const char* cacheFilename, uint32_t sourceCrc, uint32_t sourceSize,
+                            const std::vector<Token>& tokens)
+{
+	std::vector<TokenCacheEntry> entries;
+	entries.reserve(tokens.size());
+	std::vector<uint8_t> types;
+	types.reserve(tokens.size());
+	// String N is [stringOffsets[N], stringOffsets[N + 1])
+	std::vector<uint32_t> stringOffsets = {0, 0};
+	std::string strings;
+	std::unordered_map<InternedString, uint32_t> stringIndices;
+
+	for (const Token& token : tokens)
+	{
+		uint32_t contentsIndex = 0;
+		if (!token.contents.empty())
+		{
+			std::unordered_map<InternedString, uint32_t>::iterator findIt =
+			    stringIndices.find(token.contents.internedId());
+			if (findIt != stringIndices.end())
+			{
+				contentsIndex = findIt->second;
+			}
+			else
+			{
+				contentsIndex = (uint32_t)stringOffsets.size() - 1;
+				strings.append(token.contents.str());
+				stringOffsets.push_back((uint32_t)strings.size());
+				stringIndices[token.contents.internedId()] = contentsIndex;
+			}
+		}
+
+		entries.push_back({contentsIndex, token.lineNumber, (uint32_t)token.columnStart,
+		                   (uint32_t)token.columnEnd});
+		types.push_back((uint8_t)token.type);
+	}
+
+	TokenCacheHeader header;
+	header.magic = g_tokenCacheMagic;
+	header.version = g_tokenCacheVersion;
+	header.sourceCrc = sourceCrc;
+	header.sourceSize = sourceSize;
+	header.numTokens = (uint32_t)entries.size();
+	header.numStrings = (uint32_t)stringOffsets.size() - 1;
+	header.stringsSize = (uint32_t)strings.size();
+
+	// Write then rename so that a reader never sees a partially written cache
+	char tempFilename[MAX_PATH_LENGTH] = {0};
+	PrintfBuffer(tempFilename, "%s.temp", cacheFilename);
+	FILE* file = fopen(tempFilename, "wb");
+	if (!file)
+	{
+		if (logging.fileSystem)
+			Logf("Could not write token cache %s\n", tempFilename);
+		return;
+	}
+
+	bool writeSucceeded =
+	    fwrite(&header, sizeof(header), 1, file) == 1 &&
+	    fwrite(entries.data(), sizeof(TokenCacheEntry), entries.size(), file) == entries.size() &&
+	    fwrite(stringOffsets.data(), sizeof(uint32_t), stringOffsets.size(), file) ==
+	        stringOffsets.size() &&
+	    fwrite(types.data(), sizeof(uint8_t), types.size(), file) == types.size() &&
+	    fwrite(strings.data(), sizeof(char), strings.size(), file) == strings.size();
+	fclose(file);
+
+#ifdef WINDOWS
+	// rename() will not replace an existing file on Windows
+	if (writeSucceeded)
+		remove(cacheFilename);
+#endif
+	if (!writeSucceeded || rename(tempFilename, cacheFilename) != 0)
+	{
+		if (logging.fileSystem)
+			Logf("Could not write token cache %s\n", cacheFilename);
+		remove(tempFilename);
+		return;
+	}
+
+	if (logging.fileSystem)
+		Logf("Wrote token cache %s\n", cacheFilename);
+}
+
 void moduleManagerInitialize(ModuleManager& manager)
 {
+	outputTextAcquire();
 	importFundamentalGenerators(manager.environment);
 
 	// Create module definition for top-level references to attach to
@@ -229,6 +456,7 @@ void moduleManagerInitialize(ModuleManager& manager)
 		    {ProcessCommandArgumentType_SourceInput, EmptyString},
 		    {ProcessCommandArgumentType_String, "-o"},
 		    {ProcessCommandArgumentType_ObjectOutput, EmptyString},
+		    {ProcessCommandArgumentType_DependencyFileOutput, EmptyString},
 		    {ProcessCommandArgumentType_CakelispHeadersInclude, EmptyString},
 		    {ProcessCommandArgumentType_PrecompiledHeaderInclude, EmptyString},
 		    {ProcessCommandArgumentType_String, "-fPIC"},
@@ -266,6 +494,7 @@ void moduleManagerInitialize(ModuleManager& manager)
 		    {ProcessCommandArgumentType_SourceInput, EmptyString},
 		    {ProcessCommandArgumentType_String, "-o"},
 		    {ProcessCommandArgumentType_ObjectOutput, EmptyString},
+		    {ProcessCommandArgumentType_DependencyFileOutput, EmptyString},
 		    // Probably unnecessary to make the user's code position-independent, but it does make
 		    // hotreloading a bit easier to try out
 		    {ProcessCommandArgumentType_String, "-fPIC"},
@@ -302,6 +531,7 @@ void moduleManagerInitialize(ModuleManager& manager)
 		    {ProcessCommandArgumentType_SourceInput, EmptyString},
 		    {ProcessCommandArgumentType_String, "-o"},
 		    {ProcessCommandArgumentType_ObjectOutput, EmptyString},
+		    {ProcessCommandArgumentType_DependencyFileOutput, EmptyString},
 		    {ProcessCommandArgumentType_CakelispHeadersInclude, EmptyString},
 		    {ProcessCommandArgumentType_PrecompiledHeaderInclude, EmptyString},
 		    {ProcessCommandArgumentType_String, "-fPIC"}};
@@ -334,6 +564,7 @@ void moduleManagerInitialize(ModuleManager& manager)
 		    {ProcessCommandArgumentType_SourceInput, EmptyString},
 		    {ProcessCommandArgumentType_String, "-o"},
 		    {ProcessCommandArgumentType_ObjectOutput, EmptyString},
+		    {ProcessCommandArgumentType_DependencyFileOutput, EmptyString},
 		    // Probably unnecessary to make the user's code position-independent, but it does make
 		    // hotreloading a bit easier to try out
 		    {ProcessCommandArgumentType_String, "-fPIC"},
@@ -354,18 +585,35 @@ void moduleManagerInitialize(ModuleManager& manager)
 	}
 
 	manager.environment.useCachedFiles = true;
+	manager.environment.comptimeBatchBuilds = g_moduleManagerDefaults.comptimeBatchBuilds;
+	manager.environment.useCompilerDependencyFiles =
+	    g_moduleManagerDefaults.useCompilerDependencyFiles;
 	makeDirectory(cakelispWorkingDir);
 	if (logging.fileSystem || logging.phases)
 		Logf("Using cache at %s\n", cakelispWorkingDir);
+	{
+		char tokenCacheDir[MAX_PATH_LENGTH] = {0};
+		PrintfBuffer(tokenCacheDir, "%s/%s", cakelispWorkingDir, g_tokenCacheDirName);
+		makeDirectory(tokenCacheDir);
+	}
 
 	// By always searching relative to CWD, any subsequent imports with the module filename will
 	// resolve correctly
 	manager.environment.searchPaths.push_back(".");
 }
 
+static void tokenPrefetcherDestroy(ModuleManager& manager);
+
 void moduleManagerDestroyKeepDynLibs(ModuleManager& manager)
 {
+	tokenPrefetcherDestroy(manager);
 	environmentDestroyInvalidateTokens(manager.environment);
+	if (manager.environment.skipFreeOnDestroy)
+	{
+		manager.modules.clear();
+		return;
+	}
+
 	for (Module* module : manager.modules)
 	{
 		delete module->tokens;
@@ -378,6 +626,8 @@ void moduleManagerDestroyKeepDynLibs(ModuleManager& manager)
 		delete module;
 	}
 	manager.modules.clear();
+
+	outputTextRelease();
 }
 
 void moduleManagerDestroy(ModuleManager& manager)
@@ -405,61 +655,154 @@ void makeSafeFilename(char* buffer, int bufferSize, const char* filename)
 	}
 }
 
-bool moduleLoadTokenizeValidate(const char* filename, const std::vector<Token>** tokensOut)
+// Everything about loading a module's tokens which only needs the file. This does not print
+// errors or touch any globals, so it can be run on a prefetch thread
+struct ModuleTokensLoad
 {
-	*tokensOut = nullptr;
-
-	FILE* file = fileOpen(filename, "rb");
-	if (!file)
-		return false;
+	// Null if the file could not be read or tokenized
+	std::vector<Token>* tokens;
+	const char* error;
+	// Zero if the file could not be read, and the rest of the fields are not set
+	unsigned int errorLineNumber;
+
+	// Filled in as the tokens are output. Errors are printed once back on the main thread
+	TokenBalanceCheck balanceCheck;
+
+	uint32_t fileCrc;
+	uint32_t fileSize;
+	// Zero if the file was modified in the same tick it was read, in which case it could be
+	// modified again without the time changing
+	FileModifyTime fileModificationTime;
+	bool loadedFromCache;
+	bool isCacheOutOfDate;
+	int numLinesTokenized;
+};
 
-	char lineBuffer[2048] = {0};
-	int lineNumber = 1;
-	// We need to be very careful about when we delete this so as to not invalidate pointers
-	// It is immutable to also disallow any pointer invalidation if we were to resize it
-	const std::vector<Token>* tokens = nullptr;
+// cacheFilename may be null to skip the token cache. Tokenization logging wants to see the file
+// actually tokenized, so it should be skipped then
+static void moduleLoadTokens(const char* filename, const char* cacheFilename,
+                             bool logTokenization, ModuleTokensLoad& loadOut)
+{
+	loadOut.tokens = nullptr;
+	loadOut.error = nullptr;
+	loadOut.errorLineNumber = 0;
+	loadOut.loadedFromCache = false;
+	loadOut.isCacheOutOfDate = false;
+	loadOut.numLinesTokenized = 0;
+
+	// Sample the time before reading, like header scans
+	FileModifyTime readTime = fileGetCurrentTime();
+	MappedFile file;
+	if (!fileMapReadOnly(filename, &file, &loadOut.error))
+		return;
+
+	loadOut.fileSize = (uint32_t)file.size;
+	loadOut.fileModificationTime = file.modificationTime < readTime ? file.modificationTime : 0;
+	loadOut.fileCrc = 0;
+	crc32(file.contents, file.size, &loadOut.fileCrc);
+
+	if (cacheFilename && fileExists(cacheFilename))
 	{
-		std::vector<Token>* tokens_CREATIONONLY = new std::vector<Token>;
-		bool isFirstLine = true;
-		while (fgets(lineBuffer, sizeof(lineBuffer), file))
+		std::vector<Token>* cachedTokens = new std::vector<Token>;
+		if (tokenCacheRead(cacheFilename, filename, loadOut.fileCrc, loadOut.fileSize,
+		                   *cachedTokens, loadOut.balanceCheck))
 		{
-			if (logging.tokenization)
-				Logf("%s", lineBuffer);
+			fileUnmap(&file);
+			loadOut.tokens = cachedTokens;
+			loadOut.loadedFromCache = true;
+			return;
+		}
+		delete cachedTokens;
+		loadOut.isCacheOutOfDate = true;
+	}
 
-			// Check for shebang and ignore this line if found. This allows users to execute their
-			// scripts via e.g. ./MyScript.cake, given #!/usr/bin/cakelisp --execute
-			if (isFirstLine)
-			{
-				isFirstLine = false;
-				if (lineBuffer[0] == '#' && lineBuffer[1] == '!')
-				{
-					if (logging.tokenization)
-						Log("Skipping shebang\n");
+	const char* fileStart = file.contents;
+	const char* fileEnd = file.contents + file.size;
+	unsigned int lineNumber = 1;
 
-					++lineNumber;
-					continue;
-				}
-			}
+	if (logTokenization)
+		Logf("%.*s\n", (int)file.size, file.contents);
 
-			const char* error =
-			    tokenizeLine(lineBuffer, filename, lineNumber, *tokens_CREATIONONLY);
-			if (error != nullptr)
-			{
-				Logf("%s:%d: error: %s\n", filename, lineNumber, error);
+	// Check for shebang and ignore this line if found. This allows users to execute their
+	// scripts via e.g. ./MyScript.cake, given #!/usr/bin/cakelisp --execute
+	if (file.size >= 2 && fileStart[0] == '#' && fileStart[1] == '!')
+	{
+		if (logTokenization)
+			Log("Skipping shebang\n");
 
-				delete tokens_CREATIONONLY;
-				return false;
-			}
+		const char* endOfLine = (const char*)memchr(fileStart, '\n', file.size);
+		fileStart = endOfLine ? endOfLine + 1 : fileEnd;
+		++lineNumber;
+	}
 
-			++lineNumber;
-		}
+	unsigned int startLineNumber = lineNumber;
+	std::vector<Token>* tokens = new std::vector<Token>;
+	const char* error = tokenizeBufferCheckBalance(fileStart, fileEnd, filename, &lineNumber,
+	                                               *tokens, loadOut.balanceCheck);
+
+	// For performance estimation only. The last line may not have a trailing newline
+	loadOut.numLinesTokenized = (int)(lineNumber - startLineNumber);
+	if (fileStart != fileEnd && *(fileEnd - 1) != '\n')
+		++loadOut.numLinesTokenized;
+
+	fileUnmap(&file);
+
+	if (error)
+	{
+		delete tokens;
+		loadOut.error = error;
+		loadOut.errorLineNumber = lineNumber;
+		return;
+	}
+
+	loadOut.tokens = tokens;
+}
+
+// Load on the calling thread, which must be the main thread
+static void moduleLoadTokensNow(const char* filename, ModuleTokensLoad& loadOut)
+{
+	char cacheFilename[MAX_PATH_LENGTH] = {0};
+	getTokenCacheFilename(filename, cacheFilename, sizeof(cacheFilename));
+	moduleLoadTokens(filename, logging.tokenization ? nullptr : cacheFilename,
+	                 logging.tokenization, loadOut);
+}
+
+// The rest of loading, which must happen on the main thread. Takes ownership of load.tokens
+// If addParenTable, the tokens get a matching paren table (see addTokensParenTable())
+static bool moduleFinishLoadTokens(const char* filename, ModuleTokensLoad& load,
+                                   bool addParenTable, const std::vector<Token>** tokensOut)
+{
+	*tokensOut = nullptr;
+
+	g_totalLinesTokenized += load.numLinesTokenized;
+
+	if (logging.fileSystem && load.isCacheOutOfDate)
+		Logf("Token cache for %s is out of date\n", filename);
+
+	if (!load.tokens)
+	{
+		if (load.errorLineNumber)
+			Logf("%s:%d: error: %s\n", filename, load.errorLineNumber, load.error);
+		else
+			Logf("%s: error: %s\n", filename, load.error);
+		return false;
+	}
+
+	if (load.loadedFromCache)
+	{
+		if (addParenTable)
+			addTokensParenTable(*load.tokens, load.balanceCheck.matchingParens);
 
-		// Make it const to avoid pointer invalidation due to resize
-		tokens = tokens_CREATIONONLY;
+		*tokensOut = load.tokens;
+		return true;
 	}
 
+	// We need to be very careful about when we delete this so as to not invalidate pointers
+	// It is immutable to also disallow any pointer invalidation if we were to resize it
+	const std::vector<Token>* tokens = load.tokens;
+
 	if (logging.tokenization)
-		Logf("Tokenized %d lines\n", lineNumber - 1);
+		Logf("Tokenized %s\n", filename);
 
 	if (tokens->empty())
 	{
@@ -471,12 +814,16 @@ bool moduleLoadTokenizeValidate(const char* filename, const std::vector<Token>**
 		return false;
 	}
 
-	if (!validateTokens(*tokens))
+	// The tokens were already checked while they were output; only the reporting is left
+	if (!printTokenBalanceErrors(*tokens, load.balanceCheck))
 	{
 		delete tokens;
 		return false;
 	}
 
+	if (addParenTable)
+		addTokensParenTable(*load.tokens, load.balanceCheck.matchingParens);
+
 	if (logging.tokenization)
 	{
 		Log("\nResult:\n");
@@ -513,13 +860,290 @@ bool moduleLoadTokenizeValidate(const char* filename, const std::vector<Token>**
 		}
 	}
 
-	fclose(file);
+	char cacheFilename[MAX_PATH_LENGTH] = {0};
+	getTokenCacheFilename(filename, cacheFilename, sizeof(cacheFilename));
+	tokenCacheWrite(cacheFilename, load.fileCrc, load.fileSize, *tokens);
 
 	*tokensOut = tokens;
 
 	return true;
 }
 
+bool moduleLoadTokenizeValidate(const char* filename, const std::vector<Token>** tokensOut)
+{
+	ModuleTokensLoad load;
+	moduleLoadTokensNow(filename, load);
+	return moduleFinishLoadTokens(filename, load, /*addParenTable=*/false, tokensOut);
+}
+
+//
+// Import prefetching
+//
+
+// When a module is loaded, the files its top-level (import) forms refer to are read and tokenized
+// on worker threads while the module is evaluated. Evaluation stays single-threaded; importing
+// then only has to wait for files which aren't ready yet. Guesses which turn out wrong (e.g.
+// because of an import search path set by a macro) only cost the wasted work
+static const unsigned int g_maxTokenPrefetchThreads = 4;
+
+struct TokenPrefetchJob
+{
+	// Normalized the same way as Module::filename. The module which takes the tokens takes
+	// ownership of this, because the tokens point to it
+	const char* filename;
+	// Worked out when queued, so the workers don't need to read any globals
+	char cacheFilename[MAX_PATH_LENGTH];
+	bool started;
+	bool finished;
+	ModuleTokensLoad load;
+};
+
+struct ModuleTokenPrefetcher
+{
+	std::mutex mutex;
+	std::condition_variable jobAdded;
+	std::condition_variable jobFinished;
+	// Jobs which haven't been taken by moduleManagerAddEvaluateFile()
+	std::vector<TokenPrefetchJob*> jobs;
+	std::vector<std::thread> workers;
+	bool shuttingDown;
+};
+
+static void tokenPrefetchWorker(ModuleTokenPrefetcher* prefetcher)
+{
+	std::unique_lock<std::mutex> lock(prefetcher->mutex);
+	while (true)
+	{
+		TokenPrefetchJob* job = nullptr;
+		for (TokenPrefetchJob* prospectiveJob : prefetcher->jobs)
+		{
+			if (!prospectiveJob->started)
+			{
+				job = prospectiveJob;
+				break;
+			}
+		}
+
+		if (prefetcher->shuttingDown)
+			return;
+
+		if (!job)
+		{
+			prefetcher->jobAdded.wait(lock);
+			continue;
+		}
+
+		job->started = true;
+		lock.unlock();
+		moduleLoadTokens(job->filename, job->cacheFilename, /*logTokenization=*/false, job->load);
+		lock.lock();
+		job->finished = true;
+		prefetcher->jobFinished.notify_all();
+	}
+}
+
+static void tokenPrefetchQueue(ModuleManager& manager, const char* normalizedFilename)
+{
+	for (Module* module : manager.modules)
+	{
+		if (strcmp(module->filename, normalizedFilename) == 0)
+			return;
+	}
+
+	if (!manager.tokenPrefetcher)
+	{
+		manager.tokenPrefetcher = new ModuleTokenPrefetcher;
+		manager.tokenPrefetcher->shuttingDown = false;
+	}
+	ModuleTokenPrefetcher* prefetcher = manager.tokenPrefetcher;
+
+	std::unique_lock<std::mutex> lock(prefetcher->mutex);
+	int numWaitingJobs = 0;
+	for (TokenPrefetchJob* job : prefetcher->jobs)
+	{
+		if (strcmp(job->filename, normalizedFilename) == 0)
+			return;
+		if (!job->started)
+			++numWaitingJobs;
+	}
+
+	TokenPrefetchJob* newJob = new TokenPrefetchJob;
+	newJob->filename = StrDuplicate(normalizedFilename);
+	getTokenCacheFilename(normalizedFilename, newJob->cacheFilename, sizeof(newJob->cacheFilename));
+	newJob->started = false;
+	newJob->finished = false;
+	prefetcher->jobs.push_back(newJob);
+
+	if (logging.imports)
+		Logf("Prefetching %s\n", normalizedFilename);
+
+	unsigned int maxThreads = std::thread::hardware_concurrency();
+	if (!maxThreads || maxThreads > g_maxTokenPrefetchThreads)
+		maxThreads = g_maxTokenPrefetchThreads;
+	if (numWaitingJobs >= (int)prefetcher->workers.size() &&
+	    prefetcher->workers.size() < maxThreads)
+		prefetcher->workers.push_back(std::thread(tokenPrefetchWorker, prefetcher));
+	else
+		prefetcher->jobAdded.notify_one();
+}
+
+// Find top-level imports in the module's tokens and queue their files for prefetching
+static void tokenPrefetchModuleImports(ModuleManager& manager, Module* module)
+{
+	// Tokenization logging would get interleaved between threads
+	if (logging.tokenization)
+		return;
+
+	const std::vector<Token>& tokens = *module->tokens;
+	// Search directories added earlier in the file will be used by the imports after them
+	std::vector<std::string> searchPaths = manager.environment.searchPaths;
+	int numTokens = (int)tokens.size();
+	for (int i = 0; i < numTokens; ++i)
+	{
+		if (tokens[i].type != TokenType_OpenParen)
+			continue;
+
+		int endInvocationIndex = FindCloseParenTokenIndex(tokens, i);
+		const Token& invocationToken = tokens[i + 1];
+		bool isImport = invocationToken.type == TokenType_Symbol &&
+		                invocationToken.contents.compare("import") == 0;
+		bool isSearchDirectory = invocationToken.type == TokenType_Symbol &&
+		                         invocationToken.contents.compare("add-cakelisp-search-directory") == 0;
+
+		for (int argumentIndex = i + 2; (isImport || isSearchDirectory) &&
+		                                argumentIndex < endInvocationIndex;
+		     ++argumentIndex)
+		{
+			const Token& argument = tokens[argumentIndex];
+			if (argument.type != TokenType_String || argument.contents.empty())
+				continue;
+
+			if (isSearchDirectory)
+			{
+				searchPaths.push_back(argument.contents);
+				continue;
+			}
+
+			char foundPath[MAX_PATH_LENGTH] = {0};
+			if (!searchForFileInPaths(argument.contents.c_str(), module->filename, searchPaths,
+			                          foundPath, sizeof(foundPath)))
+				continue;
+
+			char resolvedPath[MAX_PATH_LENGTH] = {0};
+			makeAbsoluteOrRelativeToWorkingDir(foundPath, resolvedPath, sizeof(resolvedPath));
+			char safePathBuffer[MAX_PATH_LENGTH] = {0};
+			makeSafeFilename(safePathBuffer, sizeof(safePathBuffer), resolvedPath);
+			tokenPrefetchQueue(manager, safePathBuffer);
+		}
+
+		// Skip to the next top-level form
+		i = endInvocationIndex;
+	}
+}
+
+// The file may have been modified since it was prefetched, e.g. by a macro generating it
+static bool tokenPrefetchIsCurrent(const char* filename, const ModuleTokensLoad& load)
+{
+	// It couldn't be read at all. Let the main thread try again
+	if (!load.tokens && !load.errorLineNumber)
+		return false;
+
+	FileModifyTime modificationTime = 0;
+	uint64_t size = 0;
+	if (!fileGetModificationTimeAndSize(filename, &modificationTime, &size) ||
+	    size != load.fileSize)
+		return false;
+
+	if (load.fileModificationTime && modificationTime == load.fileModificationTime)
+		return true;
+
+	// Touched since, or modified in the same tick it was read
+	return getFileCrc32(filename) == load.fileCrc;
+}
+
+// Returns false if the file was never queued, or its prefetch is out of date. Otherwise, waits for
+// it to be finished if necessary, then returns the results along with the filename the tokens
+// refer to
+static bool tokenPrefetchTake(ModuleManager& manager, const char* normalizedFilename,
+                              ModuleTokensLoad& loadOut, const char** filenameOut)
+{
+	ModuleTokenPrefetcher* prefetcher = manager.tokenPrefetcher;
+	if (!prefetcher)
+		return false;
+
+	TokenPrefetchJob* job = nullptr;
+	{
+		std::unique_lock<std::mutex> lock(prefetcher->mutex);
+		for (std::vector<TokenPrefetchJob*>::iterator it = prefetcher->jobs.begin();
+		     it != prefetcher->jobs.end(); ++it)
+		{
+			if (strcmp((*it)->filename, normalizedFilename) != 0)
+				continue;
+
+			job = *it;
+			prefetcher->jobs.erase(it);
+			break;
+		}
+
+		if (!job)
+			return false;
+
+		// Not worth waiting for a worker to get to it
+		if (!job->started)
+		{
+			free((void*)job->filename);
+			delete job;
+			return false;
+		}
+
+		while (!job->finished)
+			prefetcher->jobFinished.wait(lock);
+	}
+
+	if (!tokenPrefetchIsCurrent(job->filename, job->load))
+	{
+		if (logging.imports)
+			Logf("Prefetched %s is out of date\n", job->filename);
+		delete job->load.tokens;
+		free((void*)job->filename);
+		delete job;
+		return false;
+	}
+
+	loadOut = std::move(job->load);
+	*filenameOut = job->filename;
+	delete job;
+	return true;
+}
+
+static void tokenPrefetcherDestroy(ModuleManager& manager)
+{
+	ModuleTokenPrefetcher* prefetcher = manager.tokenPrefetcher;
+	if (!prefetcher)
+		return;
+
+	{
+		std::unique_lock<std::mutex> lock(prefetcher->mutex);
+		prefetcher->shuttingDown = true;
+		prefetcher->jobAdded.notify_all();
+	}
+
+	for (std::thread& worker : prefetcher->workers)
+		worker.join();
+
+	// Prefetched files which were never imported
+	for (TokenPrefetchJob* job : prefetcher->jobs)
+	{
+		if (job->finished)
+			delete job->load.tokens;
+		free((void*)job->filename);
+		delete job;
+	}
+
+	delete prefetcher;
+	manager.tokenPrefetcher = nullptr;
+}
+
 bool moduleManagerAddEvaluateFile(ModuleManager& manager, const char* filename, Module** moduleOut)
 {
 	if (moduleOut)
@@ -588,19 +1212,40 @@ bool moduleManagerAddEvaluateFile(ModuleManager& manager, const char* filename,
 	Module* newModule = new Module();
 	// We need to keep this memory around for the lifetime of the token, regardless of relocation
 	newModule->filename = normalizedFilename;
+	std::chrono::steady_clock::time_point loadStart = std::chrono::steady_clock::now();
+	ModuleTokensLoad load;
+	const char* prefetchedFilename = nullptr;
+	if (tokenPrefetchTake(manager, normalizedFilename, load, &prefetchedFilename))
+	{
+		// The tokens point to the prefetch's copy of the name
+		free((void*)normalizedFilename);
+		normalizedFilename = prefetchedFilename;
+		newModule->filename = normalizedFilename;
+	}
+	else
+	{
+		moduleLoadTokensNow(newModule->filename, load);
+	}
 	// This stage cleans up after itself if it fails
-	if (!moduleLoadTokenizeValidate(newModule->filename, &newModule->tokens))
+	if (!moduleFinishLoadTokens(newModule->filename, load, /*addParenTable=*/true,
+	                            &newModule->tokens))
 	{
 		Logf("error: failed to tokenize %s\n", newModule->filename);
 		delete newModule;
 		free((void*)normalizedFilename);
 		return false;
 	}
+	if (load.loadedFromCache)
+		++g_numTokenCacheHits;
+	g_nestedPhaseTimes.loadTokensSeconds +=
+	    std::chrono::duration<double>(std::chrono::steady_clock::now() - loadStart).count();
 
 	newModule->generatedOutput = new GeneratorOutput;
 
 	manager.modules.push_back(newModule);
 
+	tokenPrefetchModuleImports(manager, newModule);
+
 	EvaluatorContext moduleContext = {};
 	moduleContext.module = newModule;
 	moduleContext.scope = EvaluatorScope_Module;
@@ -695,6 +1340,54 @@ static bool createBuildOutputDirectory(EvaluatorEnvironment& environment, std::s
 	return true;
 }
 
+// Compare against what the tokens would take if each Token had its own std::string
+static void printTokenMemoryUsage(ModuleManager& manager)
+{
+	struct StringContentsToken
+	{
+		TokenType type;
+		std::string contents;
+		const char* source;
+		unsigned int lineNumber;
+		int columnStart;
+		int columnEnd;
+	};
+
+	std::vector<const std::vector<Token>*> tokenVectors;
+	for (Module* module : manager.modules)
+		tokenVectors.push_back(module->tokens);
+	for (const std::vector<Token>* macroTokens : manager.environment.comptimeTokens)
+		tokenVectors.push_back(macroTokens);
+	for (const std::vector<Token>& macroTokens : manager.environment.macroExpansionTokens)
+		tokenVectors.push_back(&macroTokens);
+
+	size_t numTokens = 0;
+	size_t stringContentsBytes = 0;
+	for (const std::vector<Token>* tokens : tokenVectors)
+	{
+		numTokens += tokens->size();
+		for (const Token& token : *tokens)
+		{
+			// Short strings fit inside std::string itself
+			if (token.contents.size() > sizeof(std::string) - 1)
+				stringContentsBytes += token.contents.size() + 1;
+		}
+	}
+
+	InternedString numInternedStrings = 0;
+	size_t internedBytes = internedStringsMemoryUsage(&numInternedStrings);
+	size_t tokenBytes = numTokens * sizeof(Token);
+	size_t stringContentsTokenBytes = numTokens * sizeof(StringContentsToken) + stringContentsBytes;
+
+	Logf("Tokens: %lu in %lu vectors, %lu bytes each\n", (unsigned long)numTokens,
+	     (unsigned long)tokenVectors.size(), (unsigned long)sizeof(Token));
+	Logf("Token memory: %.1f KB, plus %.1f KB for %u interned strings (%.1f KB if each token had "
+	     "its own string)\n",
+	     tokenBytes / 1024.f, internedBytes / 1024.f, numInternedStrings,
+	     stringContentsTokenBytes / 1024.f);
+	Logf("Generated output text: %.1f KB\n", outputTextMemoryUsage() / 1024.f);
+}
+
 bool moduleManagerWriteGeneratedOutput(ModuleManager& manager)
 {
 	createBuildOutputDirectory(manager.environment, manager.buildOutputDir);
@@ -810,7 +1503,17 @@ bool moduleManagerWriteGeneratedOutput(ModuleManager& manager)
 	}
 
 	if (logging.phases || logging.performance)
+	{
 		Logf("Processed %d lines\n", g_totalLinesTokenized);
+		Logf("Loaded %d modules from token cache\n", g_numTokenCacheHits);
+	}
+
+	if (logging.performance)
+		Logf("Spent %.3f seconds loading tokens, %.3f seconds building compile-time code\n",
+		     g_nestedPhaseTimes.loadTokensSeconds, g_nestedPhaseTimes.comptimeBuildSeconds);
+
+	if (logging.performance)
+		printTokenMemoryUsage(manager);
 
 	return true;
 }
@@ -823,6 +1526,8 @@ static void OnCompileProcessOutput(const char* output)
 struct BuildObject
 {
 	int buildStatus;
+	// False if the cached object was used
+	bool wasCompiled = false;
 	std::string sourceFilename;
 	std::string filename;
 
@@ -1148,12 +1853,79 @@ static bool moduleManagerGetObjectsToBuild(ModuleManager& manager,
 	return true;
 }
 
+// Storage for everything a build object's command arguments point to
+struct BuildObjectCommand
+{
+	std::string objectOutputOverride;
+	char debugSymbolsName[MAX_PATH_LENGTH] = {0};
+	char debugSymbolsArgument[MAX_PATH_LENGTH] = {0};
+	char dependencyFilename[MAX_PATH_LENGTH] = {0};
+	char buildExecutable[MAX_PATH_LENGTH] = {0};
+	std::vector<std::string> globalSearchDirArgs;
+	// Only used for include scanning
+	std::vector<std::string> headerSearchDirectories;
+	const char** arguments = nullptr;
+};
+
+static void buildObjectCommandsFree(std::vector<BuildObjectCommand>& commands)
+{
+	for (BuildObjectCommand& command : commands)
+	{
+		if (command.arguments)
+			free(command.arguments);
+		command.arguments = nullptr;
+	}
+}
+
+struct BuildObjectCheckQueue
+{
+	ModuleManager* manager;
+	std::vector<BuildObject*>* buildObjects;
+	std::vector<BuildObjectCommand>* commands;
+
+	std::mutex mutex;
+	std::condition_variable objectChecked;
+	int nextObjectToCheck;
+	int numObjectsChecked;
+	// Indices of objects which were found to need building, in the order they were checked
+	std::vector<int> objectsToCompile;
+	int numFilesTested;
+	std::vector<std::thread> workers;
+};
+
+static void buildObjectCheckWorker(BuildObjectCheckQueue* queue)
+{
+	// Each thread keeps its own table. See cppFileNeedsBuild()
+	HeaderModificationTimeTable headerModifiedCache;
+
+	std::unique_lock<std::mutex> lock(queue->mutex);
+	while (queue->nextObjectToCheck < (int)queue->buildObjects->size())
+	{
+		int objectIndex = queue->nextObjectToCheck++;
+		lock.unlock();
+
+		BuildObject* object = (*queue->buildObjects)[objectIndex];
+		BuildObjectCommand& command = (*queue->commands)[objectIndex];
+		bool needsBuild = cppFileNeedsBuild(
+		    queue->manager->environment, object->sourceFilename.c_str(), object->filename.c_str(),
+		    /*builtFilename=*/nullptr, command.arguments, queue->manager->cachedCommandCrcs,
+		    queue->manager->newCommandCrcs,
+		    headerModifiedCache, command.headerSearchDirectories, command.dependencyFilename);
+
+		lock.lock();
+		if (needsBuild)
+			queue->objectsToCompile.push_back(objectIndex);
+		++queue->numObjectsChecked;
+		queue->objectChecked.notify_one();
+	}
+
+	queue->numFilesTested += (int)headerModifiedCache.size();
+}
+
 // On successful build (true return value), you need to free buildObjects once you're done with them
 bool moduleManagerBuild(ModuleManager& manager, std::vector<BuildObject*>& buildObjects,
                         SharedBuildOptions& buildOptions)
 {
-	int currentNumProcessesSpawned = 0;
-
 	if (buildObjects.empty())
 	{
 		Log("Nothing to build. This may break the various hooks which expect something to be "
@@ -1162,10 +1934,13 @@ bool moduleManagerBuild(ModuleManager& manager, std::vector<BuildObject*>& build
 		return false;
 	}
 
-	HeaderModificationTimeTable headerModifiedCache;
-
-	for (BuildObject* object : buildObjects)
+	// Prepare every command up front so the cache checks can run on other threads
+	std::vector<BuildObjectCommand> commands(buildObjects.size());
+	for (int objectIndex = 0; objectIndex < (int)buildObjects.size(); ++objectIndex)
 	{
+		BuildObject* object = buildObjects[objectIndex];
+		BuildObjectCommand& command = commands[objectIndex];
+
 		std::vector<const char*> searchDirArgs;
 		searchDirArgs.reserve(object->includesSearchDirs.size() +
 		                      buildOptions.cSearchDirectories->size());
@@ -1175,15 +1950,14 @@ bool moduleManagerBuild(ModuleManager& manager, std::vector<BuildObject*>& build
 		}
 
 		// This code sucks
-		std::vector<std::string> globalSearchDirArgs;
-		globalSearchDirArgs.reserve(buildOptions.cSearchDirectories->size());
+		command.globalSearchDirArgs.reserve(buildOptions.cSearchDirectories->size());
 		for (const std::string& searchDir : *buildOptions.cSearchDirectories)
 		{
 			char searchDirToArgument[MAX_PATH_LENGTH + 2];
 			makeIncludeArgument(searchDirToArgument, sizeof(searchDirToArgument),
 			                    searchDir.c_str());
-			globalSearchDirArgs.push_back(searchDirToArgument);
-			searchDirArgs.push_back(globalSearchDirArgs.back().c_str());
+			command.globalSearchDirArgs.push_back(searchDirToArgument);
+			searchDirArgs.push_back(command.globalSearchDirArgs.back().c_str());
 		}
 
 		std::vector<const char*> additionalOptions;
@@ -1205,27 +1979,31 @@ bool moduleManagerBuild(ModuleManager& manager, std::vector<BuildObject*>& build
 
 		// Annoying exception for MSVC not having spaces between some arguments
 		std::string* objectOutput = &object->filename;
-		std::string objectOutputOverride;
 		if (StrCompareIgnoreCase(buildCommand.fileToExecute.c_str(), "CL.exe") == 0)
 		{
 			char msvcObjectOutput[MAX_PATH_LENGTH] = {0};
 			makeObjectOutputArgument(msvcObjectOutput, sizeof(msvcObjectOutput),
 			                         object->filename.c_str());
-			objectOutputOverride = msvcObjectOutput;
-			objectOutput = &objectOutputOverride;
+			command.objectOutputOverride = msvcObjectOutput;
+			objectOutput = &command.objectOutputOverride;
 		}
 
-		char debugSymbolsName[MAX_PATH_LENGTH] = {0};
-		PrintfBuffer(debugSymbolsName, "%s.%s", object->filename.c_str(),
+		PrintfBuffer(command.debugSymbolsName, "%s.%s", object->filename.c_str(),
 		             compilerDebugSymbolsExtension);
-		char debugSymbolsArgument[MAX_PATH_LENGTH] = {0};
-		makeDebugSymbolsOutputArgument(debugSymbolsArgument, sizeof(debugSymbolsArgument),
-		                               debugSymbolsName);
-
-		char buildTimeBuildExecutable[MAX_PATH_LENGTH] = {0};
-		if (!resolveExecutablePath(buildCommand.fileToExecute.c_str(), buildTimeBuildExecutable,
-		                           sizeof(buildTimeBuildExecutable)))
+		makeDebugSymbolsOutputArgument(command.debugSymbolsArgument,
+		                               sizeof(command.debugSymbolsArgument),
+		                               command.debugSymbolsName);
+
+		PrintfBuffer(command.dependencyFilename, "%s.d", object->filename.c_str());
+		std::vector<const char*> dependencyFileArguments;
+		if (manager.environment.useCompilerDependencyFiles)
+			makeDependencyFileArguments(buildCommand.fileToExecute.c_str(),
+			                            command.dependencyFilename, dependencyFileArguments);
+
+		if (!resolveExecutablePath(buildCommand.fileToExecute.c_str(), command.buildExecutable,
+		                           sizeof(command.buildExecutable)))
 		{
+			buildObjectCommandsFree(commands);
 			buildObjectsFree(buildObjects);
 			return false;
 		}
@@ -1233,77 +2011,128 @@ bool moduleManagerBuild(ModuleManager& manager, std::vector<BuildObject*>& build
 		ProcessCommandInput buildTimeInputs[] = {
 		    {ProcessCommandArgumentType_SourceInput, {object->sourceFilename.c_str()}},
 		    {ProcessCommandArgumentType_ObjectOutput, {objectOutput->c_str()}},
-		    {ProcessCommandArgumentType_DebugSymbolsOutput, {debugSymbolsArgument}},
+		    {ProcessCommandArgumentType_DebugSymbolsOutput, {command.debugSymbolsArgument}},
+		    {ProcessCommandArgumentType_DependencyFileOutput, std::move(dependencyFileArguments)},
 		    {ProcessCommandArgumentType_IncludeSearchDirs, std::move(searchDirArgs)},
 		    {ProcessCommandArgumentType_AdditionalOptions, std::move(additionalOptions)}};
-		const char** buildArguments =
-		    MakeProcessArgumentsFromCommand(buildTimeBuildExecutable, buildCommand.arguments,
+		command.arguments =
+		    MakeProcessArgumentsFromCommand(command.buildExecutable, buildCommand.arguments,
 		                                    buildTimeInputs, ArraySize(buildTimeInputs));
-		if (!buildArguments)
+		if (!command.arguments)
 		{
 			Log("error: failed to construct build arguments\n");
+			buildObjectCommandsFree(commands);
 			buildObjectsFree(buildObjects);
 			return false;
 		}
 
-		// Can we use the cached version?
+		command.headerSearchDirectories.reserve(object->headerSearchDirectories.size() +
+		                                        buildOptions.cSearchDirectories->size() + 1);
+		// Must include CWD to find generated cakelisp files
+		command.headerSearchDirectories.push_back(".");
+		PushBackAll(command.headerSearchDirectories, object->headerSearchDirectories);
+		PushBackAll(command.headerSearchDirectories, *buildOptions.cSearchDirectories);
+	}
+
+	// Can we use the cached versions? Checking means reading every included header, so spread the
+	// objects across threads. Compiles are started as soon as an object is known to need one
+	BuildObjectCheckQueue checkQueue;
+	checkQueue.manager = &manager;
+	checkQueue.buildObjects = &buildObjects;
+	checkQueue.commands = &commands;
+	checkQueue.nextObjectToCheck = 0;
+	checkQueue.numObjectsChecked = 0;
+	checkQueue.numFilesTested = 0;
+	{
+		unsigned int numWorkers = std::thread::hardware_concurrency();
+		// Include scanning and build reasons logging would get interleaved between threads
+		if (!numWorkers || logging.includeScanning || logging.buildReasons)
+			numWorkers = 1;
+		if (numWorkers > buildObjects.size())
+			numWorkers = (unsigned int)buildObjects.size();
+		for (unsigned int i = 0; i < numWorkers; ++i)
+			checkQueue.workers.push_back(std::thread(buildObjectCheckWorker, &checkQueue));
+	}
+
+	bool failedToInvokeCompiler = false;
+	{
+		std::unique_lock<std::mutex> lock(checkQueue.mutex);
+		while (true)
 		{
-			std::vector<std::string> headerSearchDirectories;
+			if (checkQueue.objectsToCompile.empty())
 			{
-				headerSearchDirectories.reserve(object->headerSearchDirectories.size() +
-				                                buildOptions.cSearchDirectories->size() + 1);
-				// Must include CWD to find generated cakelisp files
-				headerSearchDirectories.push_back(".");
-				PushBackAll(headerSearchDirectories, object->headerSearchDirectories);
-				PushBackAll(headerSearchDirectories, *buildOptions.cSearchDirectories);
+				if (checkQueue.numObjectsChecked == (int)buildObjects.size())
+					break;
+				checkQueue.objectChecked.wait(lock);
+				continue;
 			}
 
-			if (!cppFileNeedsBuild(manager.environment, object->sourceFilename.c_str(),
-			                       object->filename.c_str(), buildArguments,
-			                       manager.cachedCommandCrcs, manager.newCommandCrcs,
-			                       headerModifiedCache, headerSearchDirectories))
+			int objectIndex = checkQueue.objectsToCompile.front();
+			checkQueue.objectsToCompile.erase(checkQueue.objectsToCompile.begin());
+			lock.unlock();
+
+			BuildObject* object = buildObjects[objectIndex];
+			BuildObjectCommand& command = commands[objectIndex];
+
+			// Keep checking, but don't start anything new
+			if (failedToInvokeCompiler)
 			{
-				free(buildArguments);
+				lock.lock();
 				continue;
 			}
-		}
 
-		// Annoying Windows workaround: delete PDB to fix fatal error C1052
-		// Technically we only need to do this for /DEBUG:fastlink
-		if (debugSymbolsArgument[0] && fileExists(debugSymbolsName))
-			remove(debugSymbolsName);
+			// Annoying Windows workaround: delete PDB to fix fatal error C1052
+			// Technically we only need to do this for /DEBUG:fastlink
+			if (command.debugSymbolsArgument[0] && fileExists(command.debugSymbolsName))
+				remove(command.debugSymbolsName);
 
-		// Go through with the build
-		RunProcessArguments compileArguments = {};
-		compileArguments.fileToExecute = buildTimeBuildExecutable;
-		compileArguments.arguments = buildArguments;
-		// PrintProcessArguments(buildArguments);
+			// A dependency file left over from an earlier compile must not be mistaken for this
+			// one's
+			if (fileExists(command.dependencyFilename))
+				remove(command.dependencyFilename);
 
-		if (runProcess(compileArguments, &object->buildStatus) != 0)
-		{
-			Log("error: failed to invoke compiler\n");
-			free(buildArguments);
-			buildObjectsFree(buildObjects);
-			return false;
-		}
+			// Go through with the build. Objects are still being checked while earlier ones
+			// compile, so only wait when there is no room for another process
+			waitForProcessSlot(OnCompileProcessOutput);
 
-		free(buildArguments);
+			RunProcessArguments compileArguments = {};
+			compileArguments.fileToExecute = command.buildExecutable;
+			compileArguments.arguments = command.arguments;
+			// PrintProcessArguments(command.arguments);
 
-		// TODO This could be made smarter by allowing more spawning right when a process
-		// closes, instead of starting in waves
-		++currentNumProcessesSpawned;
-		if (currentNumProcessesSpawned >= maxProcessesRecommendedSpawned)
-		{
-			waitForAllProcessesClosed(OnCompileProcessOutput);
-			currentNumProcessesSpawned = 0;
+			if (runProcess(compileArguments, &object->buildStatus) != 0)
+			{
+				Log("error: failed to invoke compiler\n");
+				failedToInvokeCompiler = true;
+			}
+			else
+			{
+				object->wasCompiled = true;
+				++g_buildCounts.numCompiles;
+			}
+
+			lock.lock();
 		}
 	}
 
-	if (logging.includeScanning || logging.performance)
-		Logf(FORMAT_SIZE_T " files tested for modification times\n", headerModifiedCache.size());
+	for (std::thread& worker : checkQueue.workers)
+		worker.join();
 
+	buildObjectCommandsFree(commands);
+
+	if (failedToInvokeCompiler)
+	{
+		waitForAllProcessesClosed(OnCompileProcessOutput);
+		buildObjectsFree(buildObjects);
+		return false;
+	}
+
+	if (logging.includeScanning || logging.performance)
+		Logf("%d files tested for modification times\n", checkQueue.numFilesTested);
+	if (logging.performance)
+		Logf("Compiled %d compile-time objects and %d objects in total\n",
+		     g_buildCounts.numComptimeCompiles, g_buildCounts.numCompiles);
 	waitForAllProcessesClosed(OnCompileProcessOutput);
-	currentNumProcessesSpawned = 0;
 
 	bool succeededBuild = true;
 	for (BuildObject* object : buildObjects)
@@ -1320,6 +2149,15 @@ bool moduleManagerBuild(ModuleManager& manager, std::vector<BuildObject*>& build
 		{
 			setSourceArtifactCrc(manager.environment, object->sourceFilename.c_str(),
 			                     object->filename.c_str());
+
+			if (manager.environment.useCompilerDependencyFiles && object->wasCompiled)
+			{
+				char dependencyFilename[MAX_PATH_LENGTH] = {0};
+				PrintfBuffer(dependencyFilename, "%s.d", object->filename.c_str());
+				buildRecordArtifactDependencies(manager.environment, object->filename.c_str(),
+				                                dependencyFilename,
+				                                /*additionalDependency=*/nullptr);
+			}
 		}
 	}
 
@@ -1567,7 +2405,9 @@ bool moduleManagerLink(ModuleManager& manager, std::vector<BuildObject*>& buildO
 bool moduleManagerBuildAndLink(ModuleManager& manager, std::vector<std::string>& builtOutputs)
 {
 	if (!buildReadCacheFile(manager.buildOutputDir.c_str(), manager.cachedCommandCrcs,
-	                        manager.environment.sourceArtifactFileCrcs, manager.environment.loadedHeaderCrcCache))
+	                        manager.environment.sourceArtifactFileCrcs,
+	                        manager.environment.loadedHeaderCrcCache, manager.environment.headerScans,
+	                        manager.environment.artifactDependencies))
 		return false;
 
 	// Pointer because the objects can't move, status codes are pointed to
@@ -1582,7 +2422,9 @@ bool moduleManagerBuildAndLink(ModuleManager& manager, std::vector<std::string>&
 		// some others failed
 		buildReadMergeWriteCacheFile(
 		    manager.buildOutputDir.c_str(), manager.cachedCommandCrcs, manager.newCommandCrcs,
-		    manager.environment.sourceArtifactFileCrcs, manager.environment.changedHeaderCrcCache);
+		    manager.environment.sourceArtifactFileCrcs, manager.environment.changedHeaderCrcCache,
+		    manager.environment.changedHeaderScans,
+		    manager.environment.changedArtifactDependencies);
 		return false;
 	}
 
@@ -1592,13 +2434,17 @@ bool moduleManagerBuildAndLink(ModuleManager& manager, std::vector<std::string>&
 		// some others failed
 		buildReadMergeWriteCacheFile(
 		    manager.buildOutputDir.c_str(), manager.cachedCommandCrcs, manager.newCommandCrcs,
-		    manager.environment.sourceArtifactFileCrcs, manager.environment.changedHeaderCrcCache);
+		    manager.environment.sourceArtifactFileCrcs, manager.environment.changedHeaderCrcCache,
+		    manager.environment.changedHeaderScans,
+		    manager.environment.changedArtifactDependencies);
 		return false;
 	}
 
 	buildReadMergeWriteCacheFile(manager.buildOutputDir.c_str(), manager.cachedCommandCrcs,
 	                             manager.newCommandCrcs, manager.environment.sourceArtifactFileCrcs,
-	                             manager.environment.changedHeaderCrcCache);
+	                             manager.environment.changedHeaderCrcCache,
+	                             manager.environment.changedHeaderScans,
+	                             manager.environment.changedArtifactDependencies);
 
 	return true;
 }
@@ -21,6 +21,21 @@ struct ModuleDependency
 extern const char* g_modulePreBuildHookSignature;
 typedef bool (*ModulePreBuildHook)(ModuleManager& manager, Module* module);
 
+// Options every ModuleManager is initialized with, including those created by compile-time code
+// (e.g. runtime/Cakelisp.cake). Command-line options which change how compile-time code is built
+// go here, else nested managers would build the same code with different commands, and each would
+// rebuild what the other built
+struct ModuleManagerDefaults
+{
+	bool comptimeBatchBuilds;
+	bool useCompilerDependencyFiles;
+};
+extern CAKELISP_API ModuleManagerDefaults g_moduleManagerDefaults;
+
+// Modules loaded from the token cache rather than tokenized, by every manager in this process. Lets
+// tests check that an unchanged module hits the cache
+extern CAKELISP_API int g_numTokenCacheHits;
+
 struct ModuleExportScope
 {
 	const std::vector<Token>* tokens;
@@ -91,6 +106,9 @@ struct Module
 	std::vector<CompileTimeHook> preBuildHooks;
 };
 
+// Reads and tokenizes imported files on other threads before they are evaluated
+struct ModuleTokenPrefetcher;
+
 struct ModuleManager
 {
 	// Shared environment across all modules
@@ -109,6 +127,8 @@ struct ModuleManager
 	// If any artifact no longer matches its crc in cachedCommandCrcs, the change will appear here
 	ArtifactCrcTable newCommandCrcs;
 
+	ModuleTokenPrefetcher* tokenPrefetcher;
+
 	CAKELISP_API ~ModuleManager() = default;
 };
 
@@ -5,11 +5,21 @@
 #include <vector>
 
 #if defined(UNIX) || defined(MACOS)
+#include <errno.h>
+#include <poll.h>   // poll
+#include <spawn.h>  // posix_spawn
 #include <string.h>
 #include <sys/types.h>  // pid
 #include <sys/wait.h>   // waitpid
 #include <unistd.h>     // exec, fork
 
+#ifdef MACOS
+#include <crt_externs.h>
+#define environ (*_NSGetEnviron())
+#else
+extern char** environ;
+#endif
+
 #elif WINDOWS
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
@@ -42,60 +52,33 @@ struct Subprocess
 	HANDLE hChildStd_OUT_Rd;
 #endif
 	std::string command;
+	// Held while other processes are running, so it can be output in one piece
+	std::string output;
 };
 
 static std::vector<Subprocess> s_subprocesses;
 
+#if defined(UNIX) || defined(MACOS)
 // Never returns, if success
 void systemExecute(const char* fileToExecute, char** arguments)
 {
-#if defined(UNIX) || defined(MACOS)
-	// pid_t pid;
 	execvp(fileToExecute, arguments);
 	perror("RunProcess execvp() error: ");
 	Logf("Failed to execute %s\n", fileToExecute);
-#endif
 }
 
-void subprocessReceiveStdOut(const char* processOutputBuffer)
+// Fork copies the page tables of the whole Cakelisp process, which gets slower as it loads more
+// compile-time code and tokens. It is only used when the child needs a different working directory
+static pid_t forkProcess(const RunProcessArguments& arguments, const int pipeFileDescriptors[2])
 {
-	Logf("%s", processOutputBuffer);
-}
-
-int runProcess(const RunProcessArguments& arguments, int* statusOut)
-{
-	if (!arguments.arguments)
-	{
-		Log("error: runProcess() called with empty arguments. At a minimum, first argument must be "
-		    "executable name\n");
-		return 1;
-	}
-
-	if (logging.processes)
-	{
-		Log("RunProcess command: ");
-		for (const char** arg = arguments.arguments; *arg != nullptr; ++arg)
-		{
-			Logf("%s ", *arg);
-		}
-		Log("\n");
-	}
-
-#if defined(UNIX) || defined(MACOS)
-	int pipeFileDescriptors[2] = {0};
 	const int PipeRead = 0;
 	const int PipeWrite = 1;
-	if (pipe(pipeFileDescriptors) == -1)
-	{
-		perror("RunProcess: ");
-		return 1;
-	}
 
 	pid_t pid = fork();
 	if (pid == -1)
 	{
 		perror("RunProcess fork() error: cannot create child: ");
-		return 1;
+		return -1;
 	}
 	// Child
 	else if (pid == 0)
@@ -105,30 +88,11 @@ int runProcess(const RunProcessArguments& arguments, int* statusOut)
 		    dup2(pipeFileDescriptors[PipeWrite], STDERR_FILENO) == -1)
 		{
 			perror("RunProcess: ");
-			return 1;
+			_exit(EXIT_FAILURE);
 		}
 		// Only write
 		close(pipeFileDescriptors[PipeRead]);
 
-		char** nonConstArguments = nullptr;
-		{
-			int numArgs = 0;
-			for (const char** arg = arguments.arguments; *arg != nullptr; ++arg)
-				++numArgs;
-
-			// Add one for null sentinel
-			nonConstArguments = new char*[numArgs + 1];
-			int i = 0;
-			for (const char** arg = arguments.arguments; *arg != nullptr; ++arg)
-			{
-				nonConstArguments[i] = StrDuplicate(*arg);
-				++i;
-			}
-
-			// Null sentinel
-			nonConstArguments[numArgs] = nullptr;
-		}
-
 		if (arguments.workingDirectory)
 		{
 			if (chdir(arguments.workingDirectory) != 0)
@@ -136,43 +100,130 @@ int runProcess(const RunProcessArguments& arguments, int* statusOut)
 				Logf("error: RunProcess failed to change directory to '%s'\n",
 				     arguments.workingDirectory);
 				perror("RunProcess chdir");
-				goto childProcessFailed;
+				_exit(EXIT_FAILURE);
 			}
 
 			if (logging.processes)
 				Logf("Set working directory to %s\n", arguments.workingDirectory);
 		}
 
-		systemExecute(arguments.fileToExecute, nonConstArguments);
-
-	childProcessFailed:
-		// This shouldn't happen unless the execution failed or soemthing
-		for (char** arg = nonConstArguments; *arg != nullptr; ++arg)
-			delete *arg;
-		delete[] nonConstArguments;
+		// The child has its own copy of the arguments, and exec only reads them
+		systemExecute(arguments.fileToExecute, const_cast<char**>(arguments.arguments));
 
 		// A failed child should not flush parent files
-		_exit(EXIT_FAILURE); /*  */
+		_exit(EXIT_FAILURE);
 	}
-	// Parent
-	else
+
+	return pid;
+}
+
+#ifndef CAKELISP_RUN_PROCESS_FORK
+// Starts the child without copying the parent's address space
+static pid_t spawnProcess(const RunProcessArguments& arguments, const int pipeFileDescriptors[2])
+{
+	const int PipeRead = 0;
+	const int PipeWrite = 1;
+
+	posix_spawn_file_actions_t fileActions;
+	if (posix_spawn_file_actions_init(&fileActions) != 0)
 	{
-		// Only read
-		close(pipeFileDescriptors[PipeWrite]);
+		perror("RunProcess posix_spawn_file_actions_init() error: ");
+		return -1;
+	}
+	// Redirect std out and err to the pipes instead
+	posix_spawn_file_actions_adddup2(&fileActions, pipeFileDescriptors[PipeWrite], STDOUT_FILENO);
+	posix_spawn_file_actions_adddup2(&fileActions, pipeFileDescriptors[PipeWrite], STDERR_FILENO);
+	posix_spawn_file_actions_addclose(&fileActions, pipeFileDescriptors[PipeRead]);
+	posix_spawn_file_actions_addclose(&fileActions, pipeFileDescriptors[PipeWrite]);
+
+	pid_t pid = -1;
+	// The arguments are only read, despite the signature
+	int result =
+	    posix_spawnp(&pid, arguments.fileToExecute, &fileActions, /*attributes=*/nullptr,
+	                 const_cast<char* const*>(arguments.arguments), environ);
+	posix_spawn_file_actions_destroy(&fileActions);
+	if (result != 0)
+	{
+		Logf("RunProcess posix_spawnp() error: failed to execute %s: %s\n",
+		     arguments.fileToExecute, strerror(result));
+		return -1;
+	}
+
+	return pid;
+}
+#endif
+#endif
+
+void subprocessReceiveStdOut(const char* processOutputBuffer)
+{
+	Logf("%s", processOutputBuffer);
+}
 
-		if (logging.processes)
-			Logf("Created child process %d\n", pid);
+int runProcess(const RunProcessArguments& arguments, int* statusOut)
+{
+	if (!arguments.arguments)
+	{
+		Log("error: runProcess() called with empty arguments. At a minimum, first argument must be "
+		    "executable name\n");
+		return 1;
+	}
 
-		std::string command = "";
+	if (logging.processes)
+	{
+		Log("RunProcess command: ");
 		for (const char** arg = arguments.arguments; *arg != nullptr; ++arg)
 		{
-			command.append(*arg);
-			command.append(" ");
+			Logf("%s ", *arg);
 		}
+		Log("\n");
+	}
+
+#if defined(UNIX) || defined(MACOS)
+	int pipeFileDescriptors[2] = {0};
+	const int PipeRead = 0;
+	const int PipeWrite = 1;
+	if (pipe(pipeFileDescriptors) == -1)
+	{
+		perror("RunProcess: ");
+		return 1;
+	}
 
-		s_subprocesses.push_back({statusOut, pid, pipeFileDescriptors[PipeRead], command});
+	pid_t pid = -1;
+#ifndef CAKELISP_RUN_PROCESS_FORK
+	// posix_spawn cannot portably change the working directory of the child
+	if (!arguments.workingDirectory)
+		pid = spawnProcess(arguments, pipeFileDescriptors);
+	else
+#endif
+		pid = forkProcess(arguments, pipeFileDescriptors);
+
+	if (pid == -1)
+	{
+		close(pipeFileDescriptors[PipeRead]);
+		close(pipeFileDescriptors[PipeWrite]);
+		return 1;
+	}
+
+	// Only read
+	close(pipeFileDescriptors[PipeWrite]);
+
+	if (logging.processes)
+		Logf("Created child process %d\n", pid);
+
+	std::string command = "";
+	for (const char** arg = arguments.arguments; *arg != nullptr; ++arg)
+	{
+		command.append(*arg);
+		command.append(" ");
 	}
 
+	Subprocess newProcess = {};
+	newProcess.statusOut = statusOut;
+	newProcess.processId = pid;
+	newProcess.pipeReadFileDescriptor = pipeFileDescriptors[PipeRead];
+	newProcess.command = command;
+	s_subprocesses.push_back(std::move(newProcess));
+
 	return 0;
 #elif WINDOWS
 	const char* fileToExecute = arguments.fileToExecute;
@@ -357,7 +408,7 @@ int runProcess(const RunProcessArguments& arguments, int* statusOut)
 	CloseHandle(hChildStd_IN_Rd);
 	CloseHandle(hChildStd_IN_Wr);
 
-	Subprocess newProcess = {0};
+	Subprocess newProcess = {};
 	newProcess.statusOut = statusOut;
 	newProcess.processInfo = processInfo;
 	newProcess.hChildStd_OUT_Rd = hChildStd_OUT_Rd;
@@ -371,112 +422,200 @@ int runProcess(const RunProcessArguments& arguments, int* statusOut)
 	return 1;
 }
 
-#ifdef WINDOWS
-void readProcessPipe(Subprocess& process, SubprocessOnOutputFunc onOutput)
+static void flushProcessOutput(Subprocess& process, SubprocessOnOutputFunc onOutput)
 {
+	if (process.output.empty())
+		return;
+
+#if defined(UNIX) || defined(MACOS)
+	subprocessReceiveStdOut(process.output.c_str());
+#elif WINDOWS
 	HANDLE hParentStdOut = GetStdHandle(STD_OUTPUT_HANDLE);
+	DWORD bytesWritten = 0;
+	WriteFile(hParentStdOut, process.output.c_str(), (DWORD)process.output.size(), &bytesWritten,
+	          NULL);
+#endif
+	if (onOutput)
+		onOutput(process.output.c_str());
 
+	process.output.clear();
+}
+
+// Output is printed as soon as it is read while only one process is running, e.g. when executing
+// the built program. While several are running, each process's output is held until it closes and
+// printed in one contiguous block, so that outputs between processes aren't mangled together
+static void receiveProcessOutput(Subprocess& process, const char* buffer, size_t size,
+                                 SubprocessOnOutputFunc onOutput)
+{
+	process.output.append(buffer, size);
+	if (s_subprocesses.size() == 1)
+		flushProcessOutput(process, onOutput);
+}
+
+static void onProcessClosed(Subprocess& process, SubprocessOnOutputFunc onOutput)
+{
+	flushProcessOutput(process, onOutput);
+
+	// It's pretty useful to see the command which resulted in failure
+	if (*process.statusOut != 0)
+		Logf("%s\n", process.command.c_str());
+}
+
+#ifdef WINDOWS
+// Read whatever output the process has ready, without waiting for more. Reads until the pipe is
+// closed if untilClosed is set
+static void readProcessPipe(Subprocess& process, bool untilClosed, SubprocessOnOutputFunc onOutput)
+{
 	char buffer[4096] = {0};
-	bool encounteredError = false;
 	while (true)
 	{
-		DWORD bytesRead = 0;
-		DWORD bytesWritten = 0;
-		bool success = ReadFile(process.hChildStd_OUT_Rd, buffer, sizeof(buffer) - 1, &bytesRead, NULL);
-		if (!success || bytesRead == 0)
+		if (!untilClosed)
 		{
-			encounteredError = !success;
-			break;
+			DWORD bytesAvailable = 0;
+			if (!PeekNamedPipe(process.hChildStd_OUT_Rd, nullptr, 0, nullptr, &bytesAvailable,
+			                   nullptr) ||
+			    bytesAvailable == 0)
+				break;
 		}
 
-		success = WriteFile(hParentStdOut, buffer, bytesRead, &bytesWritten, NULL);
-		if (!success)
-		{
-			encounteredError = true;
+		DWORD bytesRead = 0;
+		bool success =
+		    ReadFile(process.hChildStd_OUT_Rd, buffer, sizeof(buffer) - 1, &bytesRead, NULL);
+		// Errors here seem to give a lot of false-positives, so they are treated as the end
+		if (!success || bytesRead == 0)
 			break;
-		}
 
-		if (onOutput)
-		{
-			buffer[bytesRead] = 0;
-			onOutput(buffer);
-		}
+		receiveProcessOutput(process, buffer, bytesRead, onOutput);
 	}
-
-	// This seems to give a lot of false-positives
-	// if (encounteredError)
-	// 	Log("warning: encountered read or write error while receiving sub-process "
-	// 	    "output\n");
 }
 #endif
 
-// This function prints all the output for each process in one contiguous block, so that outputs
-// between two processes aren't mangled together terribly
-void waitForAllProcessesClosed(SubprocessOnOutputFunc onOutput)
+// Any process may be the next to finish, so output is read from all of them as it comes. Otherwise,
+// a process could stall on a full pipe while we wait on another
+int* waitForNextProcessClosed(SubprocessOnOutputFunc onOutput)
 {
 	if (s_subprocesses.empty())
-		return;
+		return nullptr;
 
-	for (size_t i = 0; i < s_subprocesses.size(); ++i)
-	{
-		Subprocess* process = &s_subprocesses[i];
+	int closedProcessIndex = -1;
 #if defined(UNIX) || defined(MACOS)
-		char processOutputBuffer[1024] = {0};
-		int numBytesRead =
-		    read(process->pipeReadFileDescriptor, processOutputBuffer, sizeof(processOutputBuffer));
-		while (numBytesRead > 0)
+	// A process closing its end of the pipe means it is exiting
+	std::vector<struct pollfd> pollFileDescriptors(s_subprocesses.size());
+	while (closedProcessIndex == -1)
+	{
+		for (size_t i = 0; i < s_subprocesses.size(); ++i)
 		{
-			processOutputBuffer[numBytesRead] = '\0';
-			subprocessReceiveStdOut(processOutputBuffer);
-			if (onOutput)
-				onOutput(processOutputBuffer);
-			numBytesRead = read(process->pipeReadFileDescriptor, processOutputBuffer,
-			                    sizeof(processOutputBuffer));
+			pollFileDescriptors[i].fd = s_subprocesses[i].pipeReadFileDescriptor;
+			pollFileDescriptors[i].events = POLLIN;
+			pollFileDescriptors[i].revents = 0;
 		}
 
-		close(process->pipeReadFileDescriptor);
-
-		waitpid(process->processId, process->statusOut, 0);
-
-		// It's pretty useful to see the command which resulted in failure
-		if (*process->statusOut != 0)
-			Logf("%s\n", process->command.c_str());
-#elif WINDOWS
+		if (poll(pollFileDescriptors.data(), pollFileDescriptors.size(), /*timeout=*/-1) == -1)
+		{
+			if (errno == EINTR)
+				continue;
+
+			perror("RunProcess poll() error: ");
+			// Fall back to reading the oldest process until it closes
+			closedProcessIndex = 0;
+			Subprocess& process = s_subprocesses[0];
+			char processOutputBuffer[4096];
+			int numBytesRead = 0;
+			while ((numBytesRead = read(process.pipeReadFileDescriptor, processOutputBuffer,
+			                            sizeof(processOutputBuffer))) > 0)
+				receiveProcessOutput(process, processOutputBuffer, numBytesRead, onOutput);
+			break;
+		}
 
-		// We cannot wait indefinitely because the process eventually waits for us to read from the
-		// output pipe (e.g. its buffer gets full). pollProcessTimeMilliseconds may need to be
-		// tweaked for better performance; if the buffer is full, the subprocess will wait for as
-		// long as pollProcessTimeMilliseconds - time taken to fill buffer. Very low wait times will
-		// mean Cakelisp unnecessarily taking up cycles, so it's a tradeoff.
-		const int pollProcessTimeMilliseconds = 50;
-		while (WAIT_TIMEOUT ==
-		       WaitForSingleObject(process->processInfo->hProcess, pollProcessTimeMilliseconds))
-			readProcessPipe(*process, onOutput);
-
-		// If the wait was ended but wasn't a timeout, we still need to read out
-		readProcessPipe(*process, onOutput);
-
-		DWORD exitCode = 0;
-		if (!GetExitCodeProcess(process->processInfo->hProcess, &exitCode))
+		for (size_t i = 0; i < s_subprocesses.size(); ++i)
 		{
-			Log("error: failed to get exit code for process\n");
-			exitCode = 1;
+			if (!pollFileDescriptors[i].revents)
+				continue;
+
+			Subprocess& process = s_subprocesses[i];
+			char processOutputBuffer[4096];
+			int numBytesRead = read(process.pipeReadFileDescriptor, processOutputBuffer,
+			                        sizeof(processOutputBuffer));
+			if (numBytesRead > 0)
+				receiveProcessOutput(process, processOutputBuffer, numBytesRead, onOutput);
+			else if (numBytesRead == 0 || errno != EINTR)
+			{
+				closedProcessIndex = (int)i;
+				break;
+			}
 		}
-		else if (exitCode != 0)
+	}
+
+	Subprocess& process = s_subprocesses[closedProcessIndex];
+	close(process.pipeReadFileDescriptor);
+	waitpid(process.processId, process.statusOut, 0);
+#elif WINDOWS
+	// We cannot wait on the pipes and processes together. pollProcessTimeMilliseconds may need to
+	// be tweaked for better performance; if a pipe's buffer is full, its process will wait for as
+	// long as pollProcessTimeMilliseconds - time taken to fill buffer. Very low wait times will
+	// mean Cakelisp unnecessarily taking up cycles, so it's a tradeoff.
+	const int pollProcessTimeMilliseconds = 50;
+	while (closedProcessIndex == -1)
+	{
+		for (size_t i = 0; i < s_subprocesses.size(); ++i)
 		{
-			Logf("%s\n", process->command.c_str());
+			readProcessPipe(s_subprocesses[i], /*untilClosed=*/false, onOutput);
+			if (WaitForSingleObject(s_subprocesses[i].processInfo->hProcess, 0) == WAIT_OBJECT_0)
+			{
+				closedProcessIndex = (int)i;
+				break;
+			}
 		}
 
-		*(process->statusOut) = exitCode;
+		if (closedProcessIndex != -1)
+			break;
 
-		// Close process, thread, and stdout handles.
-		CloseHandle(process->processInfo->hProcess);
-		CloseHandle(process->processInfo->hThread);
-		CloseHandle(process->hChildStd_OUT_Rd);
-#endif
+		HANDLE processHandles[MAXIMUM_WAIT_OBJECTS];
+		DWORD numProcessHandles = 0;
+		for (size_t i = 0; i < s_subprocesses.size() && numProcessHandles < MAXIMUM_WAIT_OBJECTS;
+		     ++i)
+			processHandles[numProcessHandles++] = s_subprocesses[i].processInfo->hProcess;
+		WaitForMultipleObjects(numProcessHandles, processHandles, /*bWaitAll=*/FALSE,
+		                       pollProcessTimeMilliseconds);
+	}
+
+	Subprocess& process = s_subprocesses[closedProcessIndex];
+	// The process has exited, but its output may not all be read yet
+	readProcessPipe(process, /*untilClosed=*/true, onOutput);
+
+	DWORD exitCode = 0;
+	if (!GetExitCodeProcess(process.processInfo->hProcess, &exitCode))
+	{
+		Log("error: failed to get exit code for process\n");
+		exitCode = 1;
 	}
+	*(process.statusOut) = exitCode;
 
-	s_subprocesses.clear();
+	// Close process, thread, and stdout handles.
+	CloseHandle(process.processInfo->hProcess);
+	CloseHandle(process.processInfo->hThread);
+	CloseHandle(process.hChildStd_OUT_Rd);
+	delete process.processInfo;
+#endif
+
+	onProcessClosed(process, onOutput);
+
+	int* statusOut = process.statusOut;
+	s_subprocesses.erase(s_subprocesses.begin() + closedProcessIndex);
+	return statusOut;
+}
+
+void waitForAllProcessesClosed(SubprocessOnOutputFunc onOutput)
+{
+	while (waitForNextProcessClosed(onOutput))
+		;
+}
+
+void waitForProcessSlot(SubprocessOnOutputFunc onOutput)
+{
+	while ((int)s_subprocesses.size() >= maxProcessesRecommendedSpawned &&
+	       waitForNextProcessClosed(onOutput))
+		;
 }
 
 void PrintProcessArguments(const char** processArguments)
@@ -510,6 +649,8 @@ static const char* ProcessCommandArgumentTypeToString(ProcessCommandArgumentType
 			return "IncludeSearchDirs";
 		case ProcessCommandArgumentType_AdditionalOptions:
 			return "AdditionalOptions";
+		case ProcessCommandArgumentType_DependencyFileOutput:
+			return "DependencyFileOutput";
 		case ProcessCommandArgumentType_PrecompiledHeaderOutput:
 			return "PrecompiledHeaderOutput";
 		case ProcessCommandArgumentType_PrecompiledHeaderInclude:
@@ -20,6 +20,14 @@ typedef void (*SubprocessOnOutputFunc)(const char* subprocessOutput);
 
 CAKELISP_API void waitForAllProcessesClosed(SubprocessOnOutputFunc onOutput);
 
+// Wait for whichever process closes first, and return the statusOut it was started with. This lets
+// callers act on each process as it finishes. Returns nullptr if no processes are running
+CAKELISP_API int* waitForNextProcessClosed(SubprocessOnOutputFunc onOutput);
+
+// Wait until fewer than maxProcessesRecommendedSpawned processes are running, so another can be
+// started right away
+CAKELISP_API void waitForProcessSlot(SubprocessOnOutputFunc onOutput);
+
 //
 // Helpers for programmatically constructing arguments
 //
@@ -15,6 +15,8 @@ enum ProcessCommandArgumentType
 	ProcessCommandArgumentType_CakelispHeadersInclude,
 	ProcessCommandArgumentType_IncludeSearchDirs,
 	ProcessCommandArgumentType_AdditionalOptions,
+	// Only filled in when the compiler is asked to write the files each object depended on
+	ProcessCommandArgumentType_DependencyFileOutput,
 
 	ProcessCommandArgumentType_PrecompiledHeaderOutput,
 	ProcessCommandArgumentType_PrecompiledHeaderInclude,
@@ -1,6 +1,9 @@
 #include "Tokenizer.hpp"
 
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
+
 #include <cctype>
 
 #include "Logging.hpp"
@@ -11,7 +14,6 @@ static const char commentCharacter = ';';
 enum TokenizeState
 {
 	TokenizeState_Normal,
-	TokenizeState_Symbol,
 	TokenizeState_InString,
 	TokenizeState_StringMerge,
 	TokenizeState_StringContinue,
@@ -21,13 +23,199 @@ enum TokenizeState
 
 int g_totalLinesTokenized = 0;
 
-// Returns nullptr if no errors, else the error text
-const char* tokenizeLine(const char* inputLine, const char* source, unsigned int lineNumber,
-                         std::vector<Token>& tokensOut)
+//
+// Character run scanning
+//
+
+// Whitespace and symbol characters make up most of a file, so these runs are scanned 16 (SSE2) or
+// 32 (AVX2) bytes at a time when the compiler targets those instruction sets. The scalar versions
+// must classify characters exactly like std::isspace() in the "C" locale.
+// Define CAKELISP_TOKENIZER_NO_SIMD to force the scalar versions (e.g. for benchmarking)
+#if !defined(CAKELISP_TOKENIZER_NO_SIMD) && defined(__AVX2__)
+#define TOKENIZER_SCAN_AVX2
+#include <immintrin.h>
+#elif !defined(CAKELISP_TOKENIZER_NO_SIMD) && \
+    (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define TOKENIZER_SCAN_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(TOKENIZER_SCAN_AVX2) || defined(TOKENIZER_SCAN_SSE2)
+#ifdef _MSC_VER
+#include <intrin.h>
+static inline int countTrailingZeros(uint32_t mask)
 {
-	// For performance estimation only
-	++g_totalLinesTokenized;
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return (int)index;
+}
+static inline int highestBitIndex(uint32_t mask)
+{
+	unsigned long index;
+	_BitScanReverse(&index, mask);
+	return (int)index;
+}
+static inline int countBits(uint32_t mask)
+{
+	return (int)__popcnt(mask);
+}
+#else
+static inline int countTrailingZeros(uint32_t mask)
+{
+	return __builtin_ctz(mask);
+}
+static inline int highestBitIndex(uint32_t mask)
+{
+	return 31 - __builtin_clz(mask);
+}
+static inline int countBits(uint32_t mask)
+{
+	return __builtin_popcount(mask);
+}
+#endif
+
+// Only the lowest numBytes bits of the masks are valid
+static inline void countNewlinesInMask(uint32_t newlineMask, const char* maskStart,
+                                       unsigned int* lineNumberInOut, const char** lineStartInOut)
+{
+	if (!newlineMask)
+		return;
+	*lineNumberInOut += countBits(newlineMask);
+	*lineStartInOut = maskStart + highestBitIndex(newlineMask) + 1;
+}
+#endif
 
+#if defined(TOKENIZER_SCAN_AVX2)
+static const int scanChunkSize = 32;
+typedef __m256i ScanChunk;
+#define ScanLoad(at) _mm256_loadu_si256((const __m256i*)(at))
+#define ScanSplat(c) _mm256_set1_epi8(c)
+#define ScanEquals(a, b) _mm256_cmpeq_epi8((a), (b))
+#define ScanGreater(a, b) _mm256_cmpgt_epi8((a), (b))
+#define ScanOr(a, b) _mm256_or_si256((a), (b))
+#define ScanAnd(a, b) _mm256_and_si256((a), (b))
+#define ScanMask(a) (uint32_t) _mm256_movemask_epi8(a)
+static const uint32_t scanAllMatch = 0xFFFFFFFF;
+#elif defined(TOKENIZER_SCAN_SSE2)
+static const int scanChunkSize = 16;
+typedef __m128i ScanChunk;
+#define ScanLoad(at) _mm_loadu_si128((const __m128i*)(at))
+#define ScanSplat(c) _mm_set1_epi8(c)
+#define ScanEquals(a, b) _mm_cmpeq_epi8((a), (b))
+#define ScanGreater(a, b) _mm_cmpgt_epi8((a), (b))
+#define ScanOr(a, b) _mm_or_si128((a), (b))
+#define ScanAnd(a, b) _mm_and_si128((a), (b))
+#define ScanMask(a) (uint32_t) _mm_movemask_epi8(a)
+static const uint32_t scanAllMatch = 0xFFFF;
+#endif
+
+#if defined(TOKENIZER_SCAN_AVX2) || defined(TOKENIZER_SCAN_SSE2)
+// ' ', or '\t' through '\r'. The signed compares keep bytes >= 0x80 out of the range
+static inline ScanChunk scanIsSpace(ScanChunk chunk)
+{
+	ScanChunk isControlSpace =
+	    ScanAnd(ScanGreater(chunk, ScanSplat('\t' - 1)), ScanGreater(ScanSplat('\r' + 1), chunk));
+	return ScanOr(ScanEquals(chunk, ScanSplat(' ')), isControlSpace);
+}
+#endif
+
+static inline bool isSpaceChar(char c)
+{
+	return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+// Returns the first character in [at, end) which isn't whitespace, or end. Newlines passed over
+// increment lineNumberInOut and move lineStartInOut to the start of the next line
+static const char* skipWhitespace(const char* at, const char* end, unsigned int* lineNumberInOut,
+                                  const char** lineStartInOut)
+{
+#if defined(TOKENIZER_SCAN_AVX2) || defined(TOKENIZER_SCAN_SSE2)
+	// Most runs are a single space or a newline plus indentation. Check the first few characters
+	// directly rather than paying for a chunk load which will immediately find the end
+	for (int i = 0; i < 4 && at < end; ++i, ++at)
+	{
+		if (!isSpaceChar(*at))
+			return at;
+		if (*at == '\n')
+		{
+			++(*lineNumberInOut);
+			*lineStartInOut = at + 1;
+		}
+	}
+
+	for (; end - at >= scanChunkSize; at += scanChunkSize)
+	{
+		ScanChunk chunk = ScanLoad(at);
+		uint32_t spaceMask = ScanMask(scanIsSpace(chunk));
+		uint32_t newlineMask = ScanMask(ScanEquals(chunk, ScanSplat('\n')));
+		if (spaceMask != scanAllMatch)
+		{
+			int firstNonSpace = countTrailingZeros(~spaceMask);
+			// Only count newlines before the end of the run
+			newlineMask &= (1u << firstNonSpace) - 1;
+			countNewlinesInMask(newlineMask, at, lineNumberInOut, lineStartInOut);
+			return at + firstNonSpace;
+		}
+		countNewlinesInMask(newlineMask, at, lineNumberInOut, lineStartInOut);
+	}
+#endif
+
+	for (; at < end; ++at)
+	{
+		if (!isSpaceChar(*at))
+			return at;
+		if (*at == '\n')
+		{
+			++(*lineNumberInOut);
+			*lineStartInOut = at + 1;
+		}
+	}
+	return end;
+}
+
+// Returns the first character in [at, end) which would end a symbol, i.e. whitespace or a
+// parenthesis, or end
+static const char* findSymbolEnd(const char* at, const char* end)
+{
+#if defined(TOKENIZER_SCAN_AVX2) || defined(TOKENIZER_SCAN_SSE2)
+	for (; end - at >= scanChunkSize; at += scanChunkSize)
+	{
+		ScanChunk chunk = ScanLoad(at);
+		ScanChunk isParen =
+		    ScanOr(ScanEquals(chunk, ScanSplat('(')), ScanEquals(chunk, ScanSplat(')')));
+		uint32_t endMask = ScanMask(ScanOr(scanIsSpace(chunk), isParen));
+		if (endMask)
+			return at + countTrailingZeros(endMask);
+	}
+#endif
+
+	for (; at < end; ++at)
+	{
+		if (isSpaceChar(*at) || *at == '(' || *at == ')')
+			return at;
+	}
+	return end;
+}
+
+#undef ScanLoad
+#undef ScanSplat
+#undef ScanEquals
+#undef ScanGreater
+#undef ScanOr
+#undef ScanAnd
+#undef ScanMask
+
+// Shared by tokenizeLine() and tokenizeBuffer(). Newlines are handled natively, so strings which
+// span multiple lines within [begin, end) are finished in a single pass. Strings still open at the
+// end of the range are output as continuation tokens, which the next tokenizeLine() will resume
+// (or validateTokens() will report).
+// lineNumberInOut is the line number of begin, and is set to the line reached (or the line of the
+// error) on return. If balanceCheck is set, parens are checked as they are output
+// Returns nullptr if no errors, else the error text
+static const char* tokenizeRange(const char* begin, const char* end, const char* source,
+                                 unsigned int* lineNumberInOut, std::vector<Token>& tokensOut,
+                                 TokenBalanceCheck* balanceCheck)
+{
 	const char* A_OK = nullptr;
 
 	TokenizeState tokenizeState = TokenizeState_Normal;
@@ -44,39 +232,50 @@ const char* tokenizeLine(const char* inputLine, const char* source, unsigned int
 
 	char previousChar = 0;
 
-	char contentsBuffer[1024] = {0};
-	char* contentsBufferWrite = contentsBuffer;
-#define WriteContents(character)                                                 \
-	{                                                                            \
-		if (contentsBufferWrite - contentsBuffer < (long)sizeof(contentsBuffer)) \
-		{                                                                        \
-			*contentsBufferWrite = *currentChar;                                 \
-			++contentsBufferWrite;                                               \
-			*contentsBufferWrite = '\0';                                         \
-		}                                                                        \
-		else                                                                     \
-		{                                                                        \
-			return "String too long!";                                           \
-		}                                                                        \
+	std::string contents;
+#define WriteContents(character) contents.push_back(character)
+#define CopyContentsAndReset(outputString) \
+	{                                      \
+		outputString = contents;           \
+		contents.clear();                  \
 	}
-#define CopyContentsAndReset(outputString)    \
-	{                                         \
-		outputString = contentsBuffer;        \
-		contentsBufferWrite = contentsBuffer; \
-		*contentsBufferWrite = '\0';          \
+// The range isn't necessarily null-terminated, so all look-ahead must go through this
+#define PeekChar(offset) (currentChar + (offset) < end ? *(currentChar + (offset)) : '\0')
+
+	// The text of the last token while other strings are being merged into it. It is only interned
+	// once the merge is finished, so that the partial strings don't stay in the interner
+	std::string mergedString;
+	bool isMergedStringPending = false;
+#define FinishMergedString()                          \
+	if (isMergedStringPending)                        \
+	{                                                 \
+		tokensOut.back().contents = mergedString;     \
+		mergedString.clear();                         \
+		isMergedStringPending = false;                \
 	}
 
+	unsigned int& lineNumber = *lineNumberInOut;
+	const char* lineStart = begin;
 	int columnStart = 0;
+	// Strings can start on an earlier line than they end on
+	unsigned int lineNumberStart = lineNumber;
 
-	for (const char* currentChar = inputLine; *currentChar != '\0'; ++currentChar)
+	for (const char* currentChar = begin; currentChar < end; ++currentChar)
 	{
 		// printf("'%c' %d\n", *currentChar, (int)tokenizeState);
 
-		int currentColumn = currentChar - inputLine;
+		int currentColumn = currentChar - lineStart;
 		bool isCommented = false;
 		switch (tokenizeState)
 		{
 			case TokenizeState_Normal:
+				// Anything but another merge means the merged string is done
+				if (isMergedStringPending && *currentChar != commentCharacter &&
+				    *currentChar != '\\' && !std::isspace(*currentChar))
+				{
+					FinishMergedString();
+				}
+
 				// The whole rest of the line is ignored
 				if (*currentChar == commentCharacter)
 				{
@@ -87,18 +286,25 @@ const char* tokenizeLine(const char* inputLine, const char* source, unsigned int
 				{
 					Token openParen = {TokenType_OpenParen, EmptyString,   source,
 					                   lineNumber,          currentColumn, currentColumn + 1};
+					if (balanceCheck)
+						tokenBalanceCheckParen(*balanceCheck, TokenType_OpenParen,
+						                       (int)tokensOut.size());
 					tokensOut.push_back(openParen);
 				}
 				else if (*currentChar == ')')
 				{
 					Token closeParen = {TokenType_CloseParen, EmptyString,   source,
 					                    lineNumber,           currentColumn, currentColumn + 1};
+					if (balanceCheck)
+						tokenBalanceCheckParen(*balanceCheck, TokenType_CloseParen,
+						                       (int)tokensOut.size());
 					tokensOut.push_back(closeParen);
 				}
 				else if (*currentChar == '"')
 				{
 					tokenizeState = TokenizeState_InString;
 					columnStart = currentColumn;
+					lineNumberStart = lineNumber;
 				}
 				else if (*currentChar == '\'')
 				{
@@ -110,17 +316,26 @@ const char* tokenizeLine(const char* inputLine, const char* source, unsigned int
 				{
 					// We could error here if the last symbol was a open paren, but we'll just
 					// ignore it for now and be extra permissive
+					// Skip the whole run at once. Newlines within it are counted by the scan
+					const char* runEnd = skipWhitespace(currentChar, end, &lineNumber, &lineStart);
+					previousChar = *(runEnd - 1);
+					currentChar = runEnd - 1;
+					continue;
 				}
 				else if (*currentChar == '\\' && !tokensOut.empty() &&
 				         (tokensOut.back().type == TokenType_String ||
 				          tokensOut.back().type == TokenType_StringMerge))
 				{
+					if (!isMergedStringPending)
+					{
+						mergedString = tokensOut.back().contents.str();
+						isMergedStringPending = true;
+					}
 					tokensOut.back().type = TokenType_StringMerge;
 					tokenizeState = TokenizeState_StringMerge;
 				}
 				// "Here string" is e.g. #"#Blah blah "Look ma, no escape chars!"#"#
-				else if (*currentChar == '#' && *(currentChar + 1) == '\"' &&
-				         *(currentChar + 2) == '#')
+				else if (*currentChar == '#' && PeekChar(1) == '\"' && PeekChar(2) == '#')
 				{
 					Token startHereString = {
 					    TokenType_HereString, EmptyString,   source,
@@ -133,45 +348,19 @@ const char* tokenizeLine(const char* inputLine, const char* source, unsigned int
 				else
 				{
 					// Basically anything but parens, whitespace, or quotes can be symbols!
-					tokenizeState = TokenizeState_Symbol;
-					columnStart = currentColumn;
-					WriteContents(*currentChar);
-				}
-				break;
-			case TokenizeState_Symbol:
-			{
-				bool isParenthesis = *currentChar == ')' || *currentChar == '(';
-				// Finished the symbol
-				if (*currentChar == '\n' || isParenthesis || std::isspace(*currentChar))
-				{
-					if (logging.tokenization)
-						Logf("%s\n", contentsBuffer);
+					// Symbols cannot span lines, so find the end and copy it in one go. The
+					// character which ended the symbol is handled on the next iteration
+					const char* symbolEnd = findSymbolEnd(currentChar + 1, end);
 					Token symbol = {TokenType_Symbol, EmptyString, source,
-					                lineNumber,       columnStart, currentColumn};
-					CopyContentsAndReset(symbol.contents);
-					tokensOut.push_back(symbol);
-
-					if (*currentChar == '(')
-					{
-						Token openParen = {TokenType_OpenParen, EmptyString,   source,
-						                   lineNumber,          currentColumn, currentColumn + 1};
-						tokensOut.push_back(openParen);
-					}
-					else if (*currentChar == ')')
-					{
-						Token closeParen = {TokenType_CloseParen, EmptyString,   source,
-						                    lineNumber,           currentColumn, currentColumn + 1};
-						tokensOut.push_back(closeParen);
-					}
-
-					tokenizeState = TokenizeState_Normal;
-				}
-				else
-				{
-					WriteContents(*currentChar);
+					                lineNumber,       currentColumn,
+					                currentColumn + (int)(symbolEnd - currentChar)};
+					symbol.contents.assign(currentChar, symbolEnd - currentChar);
+					if (logging.tokenization)
+						Logf("%s\n", symbol.contents.c_str());
+					tokensOut.push_back(std::move(symbol));
+					currentChar = symbolEnd - 1;
 				}
 				break;
-			}
 			case TokenizeState_StringContinue:
 			case TokenizeState_InString:
 				if (*currentChar == '"' && previousChar != '\\')
@@ -182,24 +371,34 @@ const char* tokenizeLine(const char* inputLine, const char* source, unsigned int
 						if (previousToken.type == TokenType_StringMerge ||
 						    previousToken.type == TokenType_StringContinue)
 						{
-							std::string appendString;
-							CopyContentsAndReset(appendString);
-							previousToken.contents.append(appendString);
+							if (!isMergedStringPending)
+							{
+								mergedString = previousToken.contents.str();
+								isMergedStringPending = true;
+							}
+							mergedString.append(contents);
+							contents.clear();
 							previousToken.type = TokenType_String;
 							tokenizeState = TokenizeState_Normal;
 							break;
 						}
 					}
 
-					Token string = {TokenType_String, EmptyString, source,
-					                lineNumber,       columnStart, currentColumn + 1};
+					// The columnEnd field doesn't make sense for strings spanning multiple lines, so
+					// just make it one wide, like continued strings
+					Token string = {TokenType_String,
+					                EmptyString,
+					                source,
+					                lineNumberStart,
+					                columnStart,
+					                lineNumberStart == lineNumber ? currentColumn + 1 :
+					                                                columnStart + 1};
 					CopyContentsAndReset(string.contents);
 					tokensOut.push_back(string);
 
 					tokenizeState = TokenizeState_Normal;
 				}
-				else if (*currentChar == '\n' ||
-				         (*currentChar == '\r' && *(currentChar + 1) == '\n'))
+				else if (*currentChar == '\n' || (*currentChar == '\r' && PeekChar(1) == '\n'))
 				{
 					// Absorb newline for multi-line strings
 				}
@@ -256,7 +455,7 @@ const char* tokenizeLine(const char* inputLine, const char* source, unsigned int
 				// ends up being a symbol 'my-symbol
 				else if (*currentChar == ')')
 				{
-					if (*(currentChar + 1) != '\'')
+					if (PeekChar(1) != '\'')
 					{
 						Token lispStyleSymbol = {TokenType_Symbol, EmptyString, source,
 						                         lineNumber,       columnStart, currentColumn + 1};
@@ -268,6 +467,9 @@ const char* tokenizeLine(const char* inputLine, const char* source, unsigned int
 						// better because it's a bit easier to follow)
 						Token closeParen = {TokenType_CloseParen, EmptyString,   source,
 						                    lineNumber,           currentColumn, currentColumn + 1};
+						if (balanceCheck)
+							tokenBalanceCheckParen(*balanceCheck, TokenType_CloseParen,
+							                       (int)tokensOut.size());
 						tokensOut.push_back(closeParen);
 						tokenizeState = TokenizeState_Normal;
 						// Log("Write close paren\n");
@@ -280,7 +482,8 @@ const char* tokenizeLine(const char* inputLine, const char* source, unsigned int
 				{
 					if (previousChar == '\'')
 					{
-						if (*(currentChar + 1) != '\'')
+						// A char literal can't continue on the next line
+						if (*currentChar == '\n' || PeekChar(1) != '\'')
 							return "Multi-character char literal or empty quote symbol not allowed";
 						else
 							WriteContents(*currentChar);  // Edge case for ' ' C literal
@@ -304,15 +507,15 @@ const char* tokenizeLine(const char* inputLine, const char* source, unsigned int
 				}
 				break;
 			case TokenizeState_HereString:
-				if (*currentChar == '#' && *(currentChar + 1) == '\"' && *(currentChar + 2) == '#')
+				if (*currentChar == '#' && PeekChar(1) == '\"' && PeekChar(2) == '#')
 				{
 					Token& previousToken = tokensOut.back();
 					if (previousToken.type != TokenType_HereString)
 						return "Here String mode was entered, but previous token is not a here-string";
 
-					std::string appendString;
-					CopyContentsAndReset(appendString);
-					previousToken.contents.append(appendString);
+					// Only has contents already if the here-string started in an earlier call
+					previousToken.contents = previousToken.contents + contents;
+					contents.clear();
 					previousToken.type = TokenType_String;
 					tokenizeState = TokenizeState_Normal;
 					currentChar += 2;
@@ -320,10 +523,11 @@ const char* tokenizeLine(const char* inputLine, const char* source, unsigned int
 				else if (*currentChar == '\\')
 				{
 					WriteContents('\\');
-					WriteContents(*currentChar);
+					WriteContents('\\');
 				}
 				else
 				{
+					// Note that newlines are included in here-strings
 					WriteContents(*currentChar);
 				}
 				break;
@@ -332,25 +536,36 @@ const char* tokenizeLine(const char* inputLine, const char* source, unsigned int
 		}
 
 		if (isCommented)
-			break;
+		{
+			// Skip to the end of the line. The newline itself has no meaning in the states which
+			// allow comments, so it only needs to be counted
+			currentChar = (const char*)memchr(currentChar, '\n', end - currentChar);
+			if (!currentChar)
+				break;
+		}
 
 		previousChar = *currentChar;
+
+		if (*currentChar == '\n')
+		{
+			++lineNumber;
+			lineStart = currentChar + 1;
+		}
 	}
 
+	// A string continued by the next call must have its text so far in its token
+	FinishMergedString();
+
 	if (tokenizeState != TokenizeState_Normal)
 	{
 		switch (tokenizeState)
 		{
-			case TokenizeState_Symbol:
-				return "Unterminated symbol (code error?)";
 			case TokenizeState_StringMerge:
 				break;
 			case TokenizeState_StringContinue:
 			{
 				Token& previousToken = tokensOut.back();
-				std::string appendString;
-				CopyContentsAndReset(appendString);
-				previousToken.contents.append(appendString);
+				previousToken.contents = previousToken.contents + contents;
 				previousToken.type = TokenType_StringContinue;
 				break;
 			}
@@ -358,9 +573,7 @@ const char* tokenizeLine(const char* inputLine, const char* source, unsigned int
 			case TokenizeState_HereString:
 			{
 				Token& previousToken = tokensOut.back();
-				std::string appendString;
-				CopyContentsAndReset(appendString);
-				previousToken.contents.append(appendString);
+				previousToken.contents = previousToken.contents + contents;
 				previousToken.type = TokenType_HereString;
 				break;
 			}
@@ -372,9 +585,7 @@ const char* tokenizeLine(const char* inputLine, const char* source, unsigned int
 					if (previousToken.type == TokenType_StringMerge ||
 					    previousToken.type == TokenType_StringContinue)
 					{
-						std::string appendString;
-						CopyContentsAndReset(appendString);
-						previousToken.contents.append(appendString);
+						previousToken.contents = previousToken.contents + contents;
 						previousToken.type = TokenType_StringContinue;
 						tokenizeState = TokenizeState_Normal;
 						break;
@@ -386,7 +597,7 @@ const char* tokenizeLine(const char* inputLine, const char* source, unsigned int
 					// The columnEnd field isn't going to make sense once we add more lines to the
 					// string, so just make it one wide for now
 					Token string = {
-					    TokenType_StringContinue, EmptyString, source, lineNumber, columnStart,
+					    TokenType_StringContinue, EmptyString, source, lineNumberStart, columnStart,
 					    columnStart + 1};
 					CopyContentsAndReset(string.contents);
 					tokensOut.push_back(string);
@@ -400,10 +611,60 @@ const char* tokenizeLine(const char* inputLine, const char* source, unsigned int
 
 #undef WriteContents
 #undef CopyContentsAndReset
+#undef PeekChar
+#undef FinishMergedString
 
 	return A_OK;
 }
 
+// Returns nullptr if no errors, else the error text
+const char* tokenizeLine(const char* inputLine, const char* source, unsigned int lineNumber,
+                         std::vector<Token>& tokensOut)
+{
+	// For performance estimation only
+	++g_totalLinesTokenized;
+
+	return tokenizeRange(inputLine, inputLine + strlen(inputLine), source, &lineNumber, tokensOut,
+	                     /*balanceCheck=*/nullptr);
+}
+
+const char* tokenizeBuffer(const char* begin, const char* end, const char* source,
+                           unsigned int* lineNumberInOut, std::vector<Token>& tokensOut)
+{
+	return tokenizeRange(begin, end, source, lineNumberInOut, tokensOut, /*balanceCheck=*/nullptr);
+}
+
+const char* tokenizeBufferCheckBalance(const char* begin, const char* end, const char* source,
+                                       unsigned int* lineNumberInOut, std::vector<Token>& tokensOut,
+                                       TokenBalanceCheck& checkOut)
+{
+	tokenBalanceCheckBegin(checkOut);
+	const char* error = tokenizeRange(begin, end, source, lineNumberInOut, tokensOut, &checkOut);
+	if (!error)
+		tokenBalanceCheckFinish(checkOut, tokensOut);
+	return error;
+}
+
+bool tokenizeBufferPrintError(const char* begin, const char* end, const char* source,
+                              unsigned int startLineNumber, std::vector<Token>& tokensOut)
+{
+	unsigned int lineNumber = startLineNumber;
+	const char* error = tokenizeBuffer(begin, end, source, &lineNumber, tokensOut);
+
+	// For performance estimation only. The last line may not have a trailing newline
+	g_totalLinesTokenized += (lineNumber - startLineNumber);
+	if (begin != end && *(end - 1) != '\n')
+		++g_totalLinesTokenized;
+
+	if (error != nullptr)
+	{
+		Logf("%s:%d: error: %s\n", source, lineNumber, error);
+		return false;
+	}
+
+	return true;
+}
+
 const char* tokenTypeToString(TokenType type)
 {
 	switch (type)
@@ -421,18 +682,25 @@ const char* tokenTypeToString(TokenType type)
 	}
 }
 
-bool validateTokens(const std::vector<Token>& tokens)
+// If tokensToLink is set (it must be tokens.data()), each paren is given the offset to its partner
+static bool validateTokensInternal(const std::vector<Token>& tokens, Token* tokensToLink)
 {
 	int nestingDepth = 0;
 	const Token* lastTopLevelOpenParen = nullptr;
-	for (const Token& token : tokens)
+	std::vector<int> openParenIndices;
+
+	int numTokens = (int)tokens.size();
+	for (int i = 0; i < numTokens; ++i)
 	{
+		const Token& token = tokens[i];
 		if (token.type == TokenType_OpenParen)
 		{
 			if (nestingDepth == 0)
 				lastTopLevelOpenParen = &token;
 
 			++nestingDepth;
+			if (tokensToLink)
+				openParenIndices.push_back(i);
 		}
 		else if (token.type == TokenType_CloseParen)
 		{
@@ -444,6 +712,14 @@ bool validateTokens(const std::vector<Token>& tokens)
 				             "opening parenthesies");
 				return false;
 			}
+
+			if (tokensToLink)
+			{
+				int openParenIndex = openParenIndices.back();
+				openParenIndices.pop_back();
+				tokensToLink[openParenIndex].parenPartner.offset = i - openParenIndex;
+				tokensToLink[i].parenPartner.offset = openParenIndex - i;
+			}
 		}
 		else if (token.type == TokenType_StringContinue || token.type == TokenType_StringMerge ||
 		         token.type == TokenType_HereString)
@@ -467,6 +743,122 @@ bool validateTokens(const std::vector<Token>& tokens)
 	return true;
 }
 
+bool validateTokens(const std::vector<Token>& tokens)
+{
+	return validateTokensInternal(tokens, nullptr);
+}
+
+void tokenBalanceCheckBegin(TokenBalanceCheck& check)
+{
+	check.matchingParens.clear();
+	check.unmatchedParens.clear();
+	check.unterminatedStringIndex = -1;
+	check.openParens.clear();
+}
+
+void tokenBalanceCheckParen(TokenBalanceCheck& check, TokenType type, int tokenIndex)
+{
+	// Tokens between parens are filled in lazily, so only parens cost anything here
+	check.matchingParens.resize(tokenIndex + 1, -1);
+
+	if (type == TokenType_OpenParen)
+	{
+		check.openParens.push_back(tokenIndex);
+		return;
+	}
+
+	if (check.openParens.empty())
+	{
+		// Keep going so that any other mismatches are found in the same run
+		check.unmatchedParens.push_back(tokenIndex);
+		return;
+	}
+
+	int openParenIndex = check.openParens.back();
+	check.openParens.pop_back();
+	check.matchingParens[openParenIndex] = tokenIndex;
+	check.matchingParens[tokenIndex] = openParenIndex;
+}
+
+void tokenBalanceCheckFinish(TokenBalanceCheck& check, const std::vector<Token>& tokens)
+{
+	check.matchingParens.resize(tokens.size(), -1);
+
+	// Anything still open was never closed. These all come after the unmatched close parens found
+	// so far, so order is kept. Note that this reports each unclosed paren, not only the top level
+	check.unmatchedParens.insert(check.unmatchedParens.end(), check.openParens.begin(),
+	                             check.openParens.end());
+	check.openParens.clear();
+
+	// Only the last token can be an unfinished string; everything before it was closed
+	if (!tokens.empty())
+	{
+		TokenType lastType = tokens.back().type;
+		if (lastType == TokenType_StringContinue || lastType == TokenType_StringMerge ||
+		    lastType == TokenType_HereString)
+			check.unterminatedStringIndex = (int)tokens.size() - 1;
+	}
+}
+
+bool printTokenBalanceErrors(const std::vector<Token>& tokens, const TokenBalanceCheck& check)
+{
+	for (int parenIndex : check.unmatchedParens)
+	{
+		const Token& paren = tokens[parenIndex];
+		if (paren.type == TokenType_CloseParen)
+			ErrorAtToken(paren,
+			             "Mismatched parenthesis. Too many closing parentheses, or missing "
+			             "opening parenthesies");
+		else
+			ErrorAtToken(paren,
+			             "Mismatched parenthesis. Missing closing parentheses, or too many opening "
+			             "parentheses");
+	}
+
+	if (check.unterminatedStringIndex != -1)
+		ErrorAtToken(tokens[check.unterminatedStringIndex],
+		             "multi-line string malformed. Is it missing a closing quote? Does it "
+		             "have a trailing \\, despite being the last string? Is it a here-string "
+		             "with missing matching #\"#?");
+
+	return check.unmatchedParens.empty() && check.unterminatedStringIndex == -1;
+}
+
+//
+// Matching parenthesis tables
+//
+
+bool validateTokensAddParenTable(std::vector<Token>& tokens)
+{
+	return validateTokensInternal(tokens, tokens.data());
+}
+
+void addTokensParenTable(std::vector<Token>& tokens, const std::vector<int>& matchingParens)
+{
+	int numTokens = (int)tokens.size();
+	for (int i = 0; i < numTokens && i < (int)matchingParens.size(); ++i)
+	{
+		if (matchingParens[i] != -1)
+			tokens[i].parenPartner.offset = matchingParens[i] - i;
+	}
+}
+
+int findMatchingParenIndex(const std::vector<Token>& tokens, int parenIndex)
+{
+	int offset = tokens[parenIndex].parenPartner.offset;
+	if (!offset)
+		return -1;
+	return parenIndex + offset;
+}
+
+const Token* findMatchingParenToken(const Token* parenToken)
+{
+	int offset = parenToken->parenPartner.offset;
+	if (!offset)
+		return nullptr;
+	return parenToken + offset;
+}
+
 bool appendTokenToString(const Token& token, char** at, char* bufferStart, int bufferSize)
 {
 	char previousCharacter = 0;
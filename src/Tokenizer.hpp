@@ -5,14 +5,240 @@
 
 #include "Exporting.hpp"
 #include "TokenEnums.hpp"
+#include "Utilities.hpp"
 
 const char* tokenTypeToString(TokenType type);
 
+// Token contents are interned, so each distinct string is stored only once and Token stays small.
+// This behaves like a const std::string. To build up contents, use a std::string, then assign it
+// once it is finished. Every distinct string stays interned, even if it was only a partial one
+// The copy constructor is user-provided on purpose: like std::string, this cannot be passed to
+// printf-style functions by mistake
+class TokenContents
+{
+public:
+	TokenContents() : id(0)
+	{
+	}
+	TokenContents(const TokenContents& other) : id(other.id)
+	{
+	}
+	TokenContents(const char* str) : id(internString(str))
+	{
+	}
+	TokenContents(const std::string& str) : id(internString(str))
+	{
+	}
+
+	static TokenContents fromInterned(InternedString internedId)
+	{
+		TokenContents contents;
+		contents.id = internedId;
+		return contents;
+	}
+
+	TokenContents& operator=(const TokenContents& other)
+	{
+		id = other.id;
+		return *this;
+	}
+	TokenContents& operator=(const char* str)
+	{
+		id = internString(str);
+		return *this;
+	}
+	TokenContents& operator=(const std::string& str)
+	{
+		id = internString(str);
+		return *this;
+	}
+
+	InternedString internedId() const
+	{
+		return id;
+	}
+	const std::string& str() const
+	{
+		return internedStringGetString(id);
+	}
+	operator const std::string&() const
+	{
+		return str();
+	}
+
+	const char* c_str() const
+	{
+		return str().c_str();
+	}
+	const char* data() const
+	{
+		return str().data();
+	}
+	size_t size() const
+	{
+		return str().size();
+	}
+	size_t length() const
+	{
+		return str().size();
+	}
+	bool empty() const
+	{
+		return id == 0;
+	}
+	char operator[](size_t index) const
+	{
+		return str()[index];
+	}
+	char at(size_t index) const
+	{
+		return str().at(index);
+	}
+	char front() const
+	{
+		return str().front();
+	}
+	char back() const
+	{
+		return str().back();
+	}
+	std::string::const_iterator begin() const
+	{
+		return str().begin();
+	}
+	std::string::const_iterator end() const
+	{
+		return str().end();
+	}
+	std::string substr(size_t position = 0, size_t length = std::string::npos) const
+	{
+		return str().substr(position, length);
+	}
+	template <typename... Arguments>
+	int compare(const Arguments&... arguments) const
+	{
+		return str().compare(arguments...);
+	}
+	template <typename... Arguments>
+	size_t find(const Arguments&... arguments) const
+	{
+		return str().find(arguments...);
+	}
+	template <typename... Arguments>
+	size_t rfind(const Arguments&... arguments) const
+	{
+		return str().rfind(arguments...);
+	}
+
+	template <typename... Arguments>
+	TokenContents& assign(const Arguments&... arguments)
+	{
+		std::string modified;
+		modified.assign(arguments...);
+		id = internString(modified);
+		return *this;
+	}
+	TokenContents& assign(const char* str, size_t length)
+	{
+		id = internString(str, length);
+		return *this;
+	}
+	void clear()
+	{
+		id = 0;
+	}
+
+private:
+	InternedString id;
+};
+
+inline bool operator==(const TokenContents& a, const TokenContents& b)
+{
+	return a.internedId() == b.internedId();
+}
+inline bool operator!=(const TokenContents& a, const TokenContents& b)
+{
+	return a.internedId() != b.internedId();
+}
+inline bool operator==(const TokenContents& a, const std::string& b)
+{
+	return a.str() == b;
+}
+inline bool operator==(const std::string& a, const TokenContents& b)
+{
+	return a == b.str();
+}
+inline bool operator!=(const TokenContents& a, const std::string& b)
+{
+	return a.str() != b;
+}
+inline bool operator!=(const std::string& a, const TokenContents& b)
+{
+	return a != b.str();
+}
+inline bool operator==(const TokenContents& a, const char* b)
+{
+	return a.str() == b;
+}
+inline bool operator==(const char* a, const TokenContents& b)
+{
+	return a == b.str();
+}
+inline bool operator!=(const TokenContents& a, const char* b)
+{
+	return a.str() != b;
+}
+inline bool operator!=(const char* a, const TokenContents& b)
+{
+	return a != b.str();
+}
+inline bool operator<(const TokenContents& a, const TokenContents& b)
+{
+	return a.str() < b.str();
+}
+template <typename Other>
+inline std::string operator+(const TokenContents& a, const Other& b)
+{
+	return a.str() + b;
+}
+inline std::string operator+(const std::string& a, const TokenContents& b)
+{
+	return a + b.str();
+}
+inline std::string operator+(const char* a, const TokenContents& b)
+{
+	return a + b.str();
+}
+inline std::string operator+(char a, const TokenContents& b)
+{
+	return a + b.str();
+}
+
+// The distance from a paren to its partner in the same token vector, or 0 if it isn't known. Only
+// vectors which will no longer change get partners (see addTokensParenTable()). A copied token
+// always starts without one, because its partner isn't necessarily copied along with it
+struct TokenParenPartner
+{
+	int offset;
+
+	TokenParenPartner() : offset(0)
+	{
+	}
+	TokenParenPartner(const TokenParenPartner&) : offset(0)
+	{
+	}
+	TokenParenPartner& operator=(const TokenParenPartner&)
+	{
+		offset = 0;
+		return *this;
+	}
+};
+
 struct Token
 {
 	TokenType type;
 	// Only non-empty if type is ambiguous
-	std::string contents;
+	TokenContents contents;
 
 	// The origin of this token, for debugging etc.
 	// This is a filename for handwritten code, and something else for macro-generated tokens
@@ -23,6 +249,9 @@ struct Token
 	int columnStart;
 	// Exclusive, e.g. line with "(a" would have start 0 end 1, the 'a' would have start 1 end 2
 	int columnEnd;
+
+	// Fits in what would otherwise be padding
+	TokenParenPartner parenPartner;
 };
 
 void destroyToken(Token* token);
@@ -32,12 +261,60 @@ void destroyToken(Token* token);
 // Returns nullptr if no errors, else the error text
 const char* tokenizeLine(const char* inputLine, const char* source, unsigned int lineNumber,
                          std::vector<Token>& tokensOut);
+// Tokenize an entire file's contents in one pass. [begin, end) does not need to be null-terminated.
+// lineNumberInOut is the line number of begin, and is set to the last line reached (or the line of
+// the error). Doesn't print or touch any globals, so files may be tokenized on other threads
+// Returns nullptr if no errors, else the error text
+const char* tokenizeBuffer(const char* begin, const char* end, const char* source,
+                           unsigned int* lineNumberInOut, std::vector<Token>& tokensOut);
+// Prints the error with source and line number if there were any
+bool tokenizeBufferPrintError(const char* begin, const char* end, const char* source,
+                              unsigned int startLineNumber, std::vector<Token>& tokensOut);
 // Invocations of this are generated by TokenizePushGenerator()
 CAKELISP_API bool tokenizeLinePrintError(const char* inputLine, const char* source,
                                          unsigned int lineNumber, std::vector<Token>& tokensOut);
 
 bool validateTokens(const std::vector<Token>& tokens);
 
+// Validation done while the tokens are output, so a file's tokens don't need a second pass. Unlike
+// validateTokens(), checking continues past errors so that every unmatched paren can be reported
+struct TokenBalanceCheck
+{
+	// The index of each paren's partner, or -1 for other tokens and unmatched parens
+	std::vector<int> matchingParens;
+	// Indices of all unmatched open and close parens, in order
+	std::vector<int> unmatchedParens;
+	// Index of a multi-line string which was never closed, or -1
+	int unterminatedStringIndex;
+
+	// Indices of parens which haven't been closed yet
+	std::vector<int> openParens;
+};
+void tokenBalanceCheckBegin(TokenBalanceCheck& check);
+// Must be called for every paren, in order. tokenIndex is the paren's index in the vector
+void tokenBalanceCheckParen(TokenBalanceCheck& check, TokenType type, int tokenIndex);
+// Call once all tokens have been output
+void tokenBalanceCheckFinish(TokenBalanceCheck& check, const std::vector<Token>& tokens);
+// Like tokenizeBuffer(), but checks the tokens as they are output. tokensOut should be empty
+const char* tokenizeBufferCheckBalance(const char* begin, const char* end, const char* source,
+                                       unsigned int* lineNumberInOut, std::vector<Token>& tokensOut,
+                                       TokenBalanceCheck& checkOut);
+// Prints every error found by the check. Returns false if there were any
+bool printTokenBalanceErrors(const std::vector<Token>& tokens, const TokenBalanceCheck& check);
+
+// Matching parenthesis tables
+// Token vectors which will no longer change (module and macro output tokens) keep the offset of
+// each paren's partner in the paren itself, which makes FindCloseParenTokenIndex() and the argument
+// helpers constant time instead of scanning the nested expressions. Other vectors are scanned
+// Validates like validateTokens(), and adds the table if the tokens are valid
+bool validateTokensAddParenTable(std::vector<Token>& tokens);
+// Adds the table from a successful TokenBalanceCheck
+void addTokensParenTable(std::vector<Token>& tokens, const std::vector<int>& matchingParens);
+// Returns -1 if the tokens have no table, or the token at parenIndex isn't a paren
+CAKELISP_API int findMatchingParenIndex(const std::vector<Token>& tokens, int parenIndex);
+// Returns null if the token isn't in a vector with a table, or isn't a paren
+CAKELISP_API const Token* findMatchingParenToken(const Token* parenToken);
+
 CAKELISP_API void printFormattedToken(FILE* fileOut, const Token& token);
 CAKELISP_API void printTokens(const std::vector<Token>& tokens);
 CAKELISP_API void prettyPrintTokens(const std::vector<Token>& tokens);
@@ -1,11 +1,18 @@
 #include "Utilities.hpp"
 
 #include <stdio.h>
+#include <stdlib.h>
+
+#include <mutex>
+#include <new>
+#include <vector>
 
 #include "Logging.hpp"
 
 std::string EmptyString;
 
+NestedPhaseTimes g_nestedPhaseTimes = {};
+
 void printIndentToDepth(int depth)
 {
 	for (int i = 0; i < depth; ++i)
@@ -70,12 +77,272 @@ uint32_t crc32_for_byte(uint32_t r)
 	return r ^ (uint32_t)0xFF000000L;
 }
 
-void crc32(const void* data, size_t n_bytes, uint32_t* crc)
+struct Crc32Table
 {
-	static uint32_t table[0x100];
-	if (!*table)
+	uint32_t entries[0x100];
+
+	Crc32Table()
+	{
 		for (size_t i = 0; i < 0x100; ++i)
-			table[i] = crc32_for_byte(i);
+			entries[i] = crc32_for_byte(i);
+	}
+};
+
+void crc32(const void* data, size_t n_bytes, uint32_t* crc)
+{
+	// Initialized on first use in a thread-safe way, because files are read on prefetch threads
+	static const Crc32Table table;
 	for (size_t i = 0; i < n_bytes; ++i)
-		*crc = table[(uint8_t)*crc ^ ((uint8_t*)data)[i]] ^ *crc >> 8;
+		*crc = table.entries[(uint8_t)*crc ^ ((uint8_t*)data)[i]] ^ *crc >> 8;
+}
+
+//
+// String interning
+//
+
+// Strings are never freed or moved, so ids and the references from internedStringGetString() stay
+// valid. Interning may happen on other threads (e.g. tokenizing prefetched imports), so adding is
+// done under a lock. Getting a string is lock-free: blocks are never reallocated, and any thread
+// with an id got it either from interning or from a hand-off which already synchronized.
+// Everything here is constant-initialized so that it can be used during static initialization
+static std::mutex g_internMutex;
+
+static const InternedString g_internBlockSizeLog2 = 13;
+static const InternedString g_internBlockSize = 1 << g_internBlockSizeLog2;
+static const InternedString g_maxInternBlocks = 1 << 16;
+// Index is the InternedString. Zero is always the empty string
+static std::string* g_internBlocks[g_maxInternBlocks];
+static InternedString g_numInternedStrings = 0;
+
+struct InternSlot
+{
+	// Zero marks an empty slot
+	InternedString id;
+	uint32_t hash;
+};
+// Open addressing, linear probing. Always a power of two
+static InternSlot* g_internSlots = nullptr;
+static size_t g_numInternSlots = 0;
+
+// FNV-1a
+static uint32_t hashInternString(const char* str, size_t length)
+{
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < length; ++i)
+	{
+		hash ^= (uint8_t)str[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static std::string& internedStringAt(InternedString id)
+{
+	return g_internBlocks[id >> g_internBlockSizeLog2][id & (g_internBlockSize - 1)];
+}
+
+// Must hold g_internMutex
+static InternedString internAddString(const char* str, size_t length)
+{
+	InternedString newId = g_numInternedStrings;
+	InternedString blockIndex = newId >> g_internBlockSizeLog2;
+	if (blockIndex >= g_maxInternBlocks)
+	{
+		Log("error: out of space for interned strings\n");
+		abort();
+	}
+
+	// Strings are constructed in place as they are added, rather than a whole block at once
+	if (!g_internBlocks[blockIndex])
+		g_internBlocks[blockIndex] = (std::string*)malloc(sizeof(std::string) * g_internBlockSize);
+	new (&internedStringAt(newId)) std::string(str, length);
+
+	++g_numInternedStrings;
+	return newId;
+}
+
+static void internSlotsGrow()
+{
+	size_t newSize = !g_numInternSlots ? 1024 : g_numInternSlots * 2;
+	InternSlot* newSlots = (InternSlot*)calloc(newSize, sizeof(InternSlot));
+	size_t mask = newSize - 1;
+	for (size_t i = 0; i < g_numInternSlots; ++i)
+	{
+		if (!g_internSlots[i].id)
+			continue;
+		size_t slot = g_internSlots[i].hash & mask;
+		while (newSlots[slot].id)
+			slot = (slot + 1) & mask;
+		newSlots[slot] = g_internSlots[i];
+	}
+	free(g_internSlots);
+	g_internSlots = newSlots;
+	g_numInternSlots = newSize;
+}
+
+// Returns the slot the string is in, or the empty slot it would go in
+static size_t internFindSlot(const char* str, size_t length, uint32_t hash)
+{
+	size_t mask = g_numInternSlots - 1;
+	size_t slot = hash & mask;
+	while (InternedString id = g_internSlots[slot].id)
+	{
+		if (g_internSlots[slot].hash == hash)
+		{
+			const std::string& existing = internedStringAt(id);
+			if (existing.size() == length && memcmp(existing.data(), str, length) == 0)
+				return slot;
+		}
+		slot = (slot + 1) & mask;
+	}
+	return slot;
+}
+
+InternedString internString(const char* str, size_t length)
+{
+	if (!length)
+		return 0;
+
+	uint32_t hash = hashInternString(str, length);
+
+	std::lock_guard<std::mutex> lock(g_internMutex);
+	if (!g_numInternedStrings)
+		internAddString("", 0);
+
+	// Keep the load factor at or below one half
+	if ((g_numInternedStrings + 1) * 2 > g_numInternSlots)
+		internSlotsGrow();
+
+	size_t slot = internFindSlot(str, length, hash);
+	if (g_internSlots[slot].id)
+		return g_internSlots[slot].id;
+
+	InternedString newId = internAddString(str, length);
+	g_internSlots[slot].id = newId;
+	g_internSlots[slot].hash = hash;
+	return newId;
+}
+
+InternedString internString(const char* str)
+{
+	return internString(str, strlen(str));
+}
+
+InternedString internString(const std::string& str)
+{
+	return internString(str.data(), str.size());
+}
+
+InternedString findInternedString(const char* str)
+{
+	size_t length = strlen(str);
+	if (!length)
+		return 0;
+
+	uint32_t hash = hashInternString(str, length);
+	std::lock_guard<std::mutex> lock(g_internMutex);
+	if (!g_numInternSlots)
+		return 0;
+	return g_internSlots[internFindSlot(str, length, hash)].id;
+}
+
+const std::string& internedStringGetString(InternedString id)
+{
+	// Nothing has been interned yet, but default-constructed TokenContents etc. still use zero
+	if (!g_internBlocks[0])
+	{
+		static const std::string emptyString;
+		return emptyString;
+	}
+	return internedStringAt(id);
+}
+
+const char* internedStringGet(InternedString id)
+{
+	return internedStringGetString(id).c_str();
+}
+
+size_t internedStringsMemoryUsage(InternedString* numStringsOut)
+{
+	std::lock_guard<std::mutex> lock(g_internMutex);
+	size_t totalBytes = g_numInternSlots * sizeof(InternSlot);
+	for (InternedString id = 0; id < g_numInternedStrings; ++id)
+	{
+		const std::string& str = internedStringAt(id);
+		totalBytes += sizeof(std::string);
+		// Short strings fit inside std::string itself
+		if (str.capacity() > sizeof(std::string) - 1)
+			totalBytes += str.capacity() + 1;
+	}
+	if (numStringsOut)
+		*numStringsOut = g_numInternedStrings;
+	return totalBytes;
+}
+
+//
+// Generated output text
+//
+
+static const size_t g_outputTextBlockSize = 64 * 1024;
+// Fragments bigger than this get a block to themselves so they don't waste the rest of a block
+static const size_t g_outputTextMaxSharedSize = g_outputTextBlockSize / 8;
+static std::vector<char*> g_outputTextBlocks;
+static size_t g_outputTextBlockUsed = 0;
+static size_t g_outputTextTotalBytes = 0;
+static int g_outputTextNumUsers = 0;
+
+const char* outputTextAdd(const char* str, size_t length)
+{
+	if (!length)
+		return "";
+
+	size_t size = length + 1;
+	char* text = nullptr;
+	if (size > g_outputTextMaxSharedSize)
+	{
+		text = (char*)malloc(size);
+		// Keep the current shared block at the back
+		g_outputTextBlocks.insert(
+		    g_outputTextBlocks.empty() ? g_outputTextBlocks.end() : g_outputTextBlocks.end() - 1,
+		    text);
+		g_outputTextTotalBytes += size;
+	}
+	else
+	{
+		if (g_outputTextBlocks.empty() || g_outputTextBlockUsed + size > g_outputTextBlockSize)
+		{
+			g_outputTextBlocks.push_back((char*)malloc(g_outputTextBlockSize));
+			g_outputTextBlockUsed = 0;
+			g_outputTextTotalBytes += g_outputTextBlockSize;
+		}
+		text = g_outputTextBlocks.back() + g_outputTextBlockUsed;
+		g_outputTextBlockUsed += size;
+	}
+
+	memcpy(text, str, length);
+	text[length] = '\0';
+	return text;
+}
+
+void outputTextAcquire()
+{
+	++g_outputTextNumUsers;
+}
+
+void outputTextRelease()
+{
+	if (--g_outputTextNumUsers > 0)
+		return;
+
+	for (char* block : g_outputTextBlocks)
+		free(block);
+	g_outputTextBlocks.clear();
+	g_outputTextBlockUsed = 0;
+	g_outputTextTotalBytes = 0;
+	g_outputTextNumUsers = 0;
+}
+
+size_t outputTextMemoryUsage()
+{
+	return g_outputTextTotalBytes;
 }
@@ -94,5 +94,39 @@ uint32_t crc32_for_byte(uint32_t r);
 
 CAKELISP_API void crc32(const void* data, size_t n_bytes, uint32_t* crc);
 
+// String interning: each unique string is stored once for the lifetime of the process and given a
+// 32-bit id. Tables keyed by InternedString hash and compare integers rather than strings.
+// Zero is always the empty string. Safe to call from multiple threads
+typedef uint32_t InternedString;
+CAKELISP_API InternedString internString(const char* str);
+CAKELISP_API InternedString internString(const char* str, size_t length);
+CAKELISP_API InternedString internString(const std::string& str);
+// Returns zero if the string has never been interned (or is empty), without interning it
+CAKELISP_API InternedString findInternedString(const char* str);
+CAKELISP_API const char* internedStringGet(InternedString id);
+CAKELISP_API const std::string& internedStringGetString(InternedString id);
+// For --verbose-performance
+size_t internedStringsMemoryUsage(InternedString* numStringsOut);
+
+// Generated output text: each fragment is copied into large blocks rather than getting its own
+// allocation, and all of it is freed at once. Text stays valid until every user has released it
+// (each ModuleManager holds one use). Only call from the evaluating thread
+CAKELISP_API const char* outputTextAdd(const char* str, size_t length);
+void outputTextAcquire();
+void outputTextRelease();
+// For --verbose-performance
+size_t outputTextMemoryUsage();
+
+// Wall-clock time spent in phases which run inside of other phases, so callers can't time them
+// separately. For performance estimation only
+struct NestedPhaseTimes
+{
+	// Reading, tokenizing, and checking module files. Imports are loaded during evaluation
+	double loadTokensSeconds;
+	// Building and loading compile-time code, which happens during reference resolution
+	double comptimeBuildSeconds;
+};
+extern CAKELISP_API NestedPhaseTimes g_nestedPhaseTimes;
+
 // Let this serve as more of a TODO to get rid of std::string
 extern std::string EmptyString;
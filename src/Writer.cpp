@@ -237,13 +237,15 @@ static void writeStringOutput(const NameStyleSettings& nameSettings,
 	if (mode)
 	{
 		char convertedName[MAX_NAME_LENGTH] = {0};
-		lispNameStyleToCNameStyle(mode, outputOperation.output.c_str(), convertedName,
-		                          sizeof(convertedName), *outputOperation.startToken);
+		// Empty outputs don't have any storage
+		const char* nameToConvert = outputOperation.outputLength ? outputOperation.output : "";
+		lispNameStyleToCNameStyle(mode, nameToConvert, convertedName, sizeof(convertedName),
+		                          *outputOperation.startToken);
 		Writer_Writef(state, "%s", convertedName);
 	}
 	else if (outputOperation.modifiers & StringOutMod_SurroundWithQuotes)
 	{
-		const char* stringToOutput = outputOperation.output.c_str();
+		const char* stringToOutput = outputOperation.outputLength ? outputOperation.output : "";
 		Writer_Writef(state, "\"");
 		char previousChar = 0;
 		for (const char* currentChar = stringToOutput; *currentChar; ++currentChar)
@@ -325,8 +327,8 @@ static void writeStringOutput(const NameStyleSettings& nameSettings,
 	}
 	else if (outputOperation.modifiers & StringOutMod_ListSeparator)
 		Writer_Writef(state, ", ");
-	else
-		Writer_Writef(state, "%s", outputOperation.output.c_str());
+	else if (outputOperation.outputLength)
+		Writer_Writef(state, "%s", outputOperation.output);
 
 	// We assume we cannot ignore these even in ugly print mode
 	if (outputOperation.modifiers & StringOutMod_SpaceAfter)
@@ -408,9 +410,9 @@ static void writeOutputFollowSplices_Recursive(const NameStyleSettings& nameSett
 	for (const StringOutput& operation : outputOperations)
 	{
 		// Debug print mapping
-		if (!operation.output.empty() && false)
+		if (operation.outputLength && false)
 		{
-			Logf("%s \t%d\tline %d\n", operation.output.c_str(), outputState.numCharsOutput + 1,
+			Logf("%s \t%d\tline %d\n", operation.output, outputState.numCharsOutput + 1,
 			     outputState.currentLine + 1);
 		}
 